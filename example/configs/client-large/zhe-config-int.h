@@ -43,10 +43,50 @@
 #define ZHE_MAX_RESOURCES 128
 #define ZHE_MAX_URILENGTH 100
 
+/* Incremental URI store GC in housekeeping: at most URISTORE_GC_MAX_BLOCKS blocks and URISTORE_GC_MAX_BYTES bytes are moved per call, scaled down by fragmentation, and with little fragmentation it runs at most once every URISTORE_GC_IDLE_INTERVAL (0: a fixed budget on every call, without scaling); while a store is pending that failed for a lack of contiguous space, it runs on every call with URISTORE_GC_PRESSURE_FACTOR times the budget */
+#define URISTORE_GC_MAX_BLOCKS 10
+#define URISTORE_GC_MAX_BYTES 1024
+#define URISTORE_GC_IDLE_INTERVAL 100 /* units, see ZHE_TIMEBASE */
+#define URISTORE_GC_PRESSURE_FACTOR 8
+
+/* Last-value cache for resources declared with the "transient" property (URI ending in #transient), peer mode only: the latest sample, written locally or received, of up to ZHE_MAX_TRANSIENT such resources is kept, provided it is no larger than ZHE_MAX_TRANSIENT_PAYLOAD bytes, and pushed to a peer as soon as it subscribes */
+#define ZHE_MAX_TRANSIENT 0
+#define ZHE_MAX_TRANSIENT_PAYLOAD 0
+
+/* Queries (zhe_query) and storages (zhe_register_storage), requires URIs: at most ZHE_MAX_QUERIES queries of our own are outstanding and as many received ones waiting for their replies to be sent, the latter shared by all peers (a received query that finds them all taken blocks its reliable conduit until a retransmission succeeds); a query completes when all peers have answered or after QUERY_TIMEOUT. Storages keep the latest sample of up to ZHE_MAX_STORED_SAMPLES resources, provided it is no larger than ZHE_MAX_STORED_PAYLOAD bytes */
+#define ZHE_MAX_QUERIES 0
+#define ZHE_MAX_STORED_SAMPLES 0
+#define ZHE_MAX_STORED_PAYLOAD 0
+#define QUERY_TIMEOUT 1000 /* units, see ZHE_TIMEBASE */
+
+/* Queued subscriptions (zhe_subscribe_queued): up to ZHE_MAX_SUBQUEUES subscriptions can have their samples copied into a ring of SUBQUEUE_DEPTH (a power of 2) samples of at most SUBQUEUE_PAYLOAD bytes, for consumption by another thread using zhe_subqueue_take */
+#define ZHE_MAX_SUBQUEUES 4
+#define SUBQUEUE_DEPTH 16
+#define SUBQUEUE_PAYLOAD 256
+
+/* Consecutive samples for the same resource in a packet are delivered as a batch of up to SUBBATCH_MAX samples, so that the space in the transmit windows is checked once per batch and a batch subscription (zhe_subscribe_batch) is called once for all of them; 1 disables batching */
+#define SUBBATCH_MAX 16
+
+/* Filtered subscriptions (zhe_subscribe_filtered) if ENABLE_SUBFILTERS; the filters are declared to the publishers, which keep track of those of at most ZHE_MAX_RSUB_FILTERS remote subscriptions to skip samples no remote subscriber is interested in (not in client mode) */
+#define ENABLE_SUBFILTERS 1
+#define ZHE_MAX_RSUB_FILTERS 0
+
+/* Whether to publish over the unicast conduit of the only peer subscribing to a publication instead of over its multicast conduit, so other peers don't have to receive and acknowledge data they don't want (requires a unicast conduit, more than one peer and XMITW_BYTES_UNICAST >= XMITW_BYTES) */
+#define ENABLE_AUTO_UNICAST 0
+
+/* Maximum number of entries in the table mapping URI prefixes or RID ranges to multicast conduits, and hence to multicast groups (see zhe_config.mcpartitions; requires more than one multicast conduit) */
+#define ZHE_MAX_MCPARTITIONS 0
+
 /* Whether or not to enable tracing */
 #define ENABLE_TRACING 1
 
-/* Setting a latency budget globally for now, though it could be done per-publisher as well. Packets will go out when full or when LATENCY_BUDGET milliseconds passed since we started filling it. Setting it to 0 will disable packing of data messages, setting to INF only stops packing when the MTU is reached and generally requires explicit flushing. Both edge cases eliminate the latency budget handling and state from the code, saving a whopping 4 bytes of RAM!  */
+/* If > 0, trace messages are recorded in binary form in a ring buffer of TRACE_RING_SIZE records (a power of 2) instead of being formatted by zhe_platform_trace (see zhe-tracing.h) */
+#define TRACE_RING_SIZE 0
+
+/* Whether or not to maintain statistics on traffic, sessions, conduits and publications (see zhe-stats.h) */
+#define ENABLE_STATS 1
+
+/* Setting a default latency budget globally, publishers can override it using zhe_set_latency_budget(). Packets will go out when full or when LATENCY_BUDGET milliseconds passed since we started filling it. Setting it to 0 will disable packing of data messages, setting to INF only stops packing when the MTU is reached and generally requires explicit flushing.  */
 #define LATENCY_BUDGET_INF      (4294967295u)
 #define LATENCY_BUDGET         10 /* units, see ZHE_TIMEBASE */
 
@@ -54,6 +94,9 @@
 #define MSYNCH_INTERVAL        10 /* units, see ZHE_TIMEBASE */
 #define ROUNDTRIP_TIME_ESTIMATE 1 /* units, see ZHE_TIMEBASE */
 
+/* Maximum number of DECLARE messages sent per call to zhe_housekeeping, the transmit window permitting; this determines how quickly a new peer learns of all existing declarations */
+#define DECLARE_BURST 16
+
 /* Scouts are sent periodically by a peer; by a client only when not connected to, or trying to connect to, a broker. The interval is configurable. Scouts are always multicasted (however implemented by the transport). */
 #define SCOUT_INTERVAL       3000 /* units, see ZHE_TIMEBASE */
 #define SCOUT_COUNT             0 /* send 10 scouts then stop scouting (0: unlimited; MAX_PEERS == 0 requires 0) */
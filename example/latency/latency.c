@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "platform-udp.h"
+#include "zhe.h"
+#include "zhe-tracing.h"
+#include "zhe-assert.h"
+
+#include "zhe-config-deriv.h" /* for N_OUT_CONDUITS, N_OUT_MCONDUITS, XMITW_BYTES */
+
+#include "zhe-util.h"
+
+/* Round-trip latency benchmark: for every combination of payload size, conduit, reliability and
+   latency budget, a "ping" and a "pong" process are forked, connected via UDP/IP (using
+   multicast discovery, as usual), the in-memory transport or shared memory, and the ping process measures
+   the time between writing a sample and receiving the echo from pong.  Results are written as
+   CSV, one line per combination, with the percentiles derived from a log-bucketed histogram. */
+
+#define MAX_LIST 16
+#define PER_SAMPLE_OVERHEAD 16      /* generous estimate of header bytes per sample */
+#define RESEND_INTERVAL_NS 100000000 /* resend ping if no pong received within 100ms */
+#define DISCOVERY_TIMEOUT_NS 10000000000ull
+#define RUN_TIMEOUT_NS 60000000000ull
+
+struct params {
+    bool mem;
+    const char *shm;            /* shared-memory transport using this segment if not NULL */
+    zhe_paysize_t size;
+    unsigned cid;
+    int reliable;
+    zhe_time_t budget;
+    unsigned count;
+    unsigned warmup;
+};
+
+/* Log-bucketed histogram: values < HIST_SUB are recorded exactly, larger ones in HIST_SUB
+   buckets per power of 2, for a relative error below 1/HIST_SUB */
+#define HIST_SUBBITS 5
+#define HIST_SUB (1u << HIST_SUBBITS)
+#define HIST_NBUCKETS ((64 - HIST_SUBBITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t n, min, max, sum;
+    uint32_t count[HIST_NBUCKETS];
+};
+
+static unsigned hist_index(uint64_t v)
+{
+    unsigned msb = 0;
+    if (v < HIST_SUB) {
+        return (unsigned)v;
+    }
+    while ((v >> msb) > 1) {
+        msb++;
+    }
+    const unsigned shift = msb - HIST_SUBBITS;
+    return (shift + 1) * HIST_SUB + (unsigned)((v >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_bucket_max(unsigned idx)
+{
+    if (idx < HIST_SUB) {
+        return idx;
+    } else {
+        const unsigned shift = idx / HIST_SUB - 1;
+        const uint64_t lower = (uint64_t)(HIST_SUB + idx % HIST_SUB) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+}
+
+static void hist_record(struct hist *h, uint64_t v)
+{
+    if (h->n == 0 || v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+    h->n++;
+    h->sum += v;
+    h->count[hist_index(v)]++;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double p)
+{
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->n + 0.999999), cum = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (unsigned i = 0; i < HIST_NBUCKETS; i++) {
+        if ((cum += h->count[i]) >= rank) {
+            const uint64_t v = hist_bucket_max(i);
+            return (v > h->max) ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+static uint64_t gethrtime(void)
+{
+    struct timespec t;
+    (void)clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (unsigned)t.tv_nsec;
+}
+
+/* Publishing on the unicast conduit is only possible if there can be at most one peer */
+#if MAX_PEERS_1 == 1
+#  define N_PUB_CONDUITS N_OUT_CONDUITS
+#else
+#  define N_PUB_CONDUITS N_OUT_MCONDUITS
+#endif
+
+static const char *conduit_kind(unsigned cid)
+{
+#if HAVE_UNICAST_CONDUIT
+    if (cid == N_OUT_CONDUITS - 1) {
+        return "unicast";
+    }
+#endif
+    return "multicast";
+}
+
+static unsigned long conduit_window(unsigned cid)
+{
+#if HAVE_UNICAST_CONDUIT
+    if (cid == N_OUT_CONDUITS - 1) {
+        return XMITW_BYTES_UNICAST;
+    }
+#endif
+#if N_OUT_MCONDUITS > 0
+    return XMITW_BYTES;
+#else
+    return 0;
+#endif
+}
+
+#if USE_SHM
+/* Ping and pong each write a byte to this pipe once they have attached to the shared-memory
+   segment, so that run_one can remove its name right away and not leave it behind if either
+   hangs or gets killed */
+static int shm_attached[2] = { -1, -1 };
+#endif
+
+static struct zhe_platform *start_zhe(const struct params *prm, int fd, uint16_t port, uint16_t peerport)
+{
+    unsigned char ownid[16];
+    zhe_paysize_t ownidsize = getrandomid(ownid, sizeof(ownid));
+    struct zhe_config cfg;
+    struct zhe_platform *platform;
+#if N_OUT_MCONDUITS == 0
+    const char *mcgroups_join_str = "";
+    const char *mconduit_dstaddrs_str = "";
+#elif N_OUT_MCONDUITS == 1
+    const char *mcgroups_join_str = "239.255.0.2:7447"; /* in addition to scout */
+    const char *mconduit_dstaddrs_str = "239.255.0.2:7447";
+#else
+    const char *mcgroups_join_str = "239.255.0.2:7447,239.255.0.3:7447"; /* in addition to scout */
+    const char *mconduit_dstaddrs_str = "239.255.0.2:7447,239.255.0.3:7447";
+#endif
+
+#if ENABLE_TRACING
+    zhe_trace_cats = ZTCAT_ERROR;
+#endif
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.id = ownid;
+    cfg.idlen = ownidsize;
+#if USE_SHM
+    if (prm->shm != NULL) {
+        platform = zhe_platform_new_shm(7447, prm->shm, 0);
+        if (platform != NULL) {
+            (void)write(shm_attached[1], "", 1);
+        }
+        close(shm_attached[1]);
+    } else
+#endif
+    if (prm->mem) {
+        platform = zhe_platform_new_mesh(port, 1, &fd, &peerport, 0);
+    } else {
+        platform = zhe_platform_new(7447, 0);
+    }
+    if (platform == NULL) {
+        fprintf(stderr, "platform initialization failed\n");
+        exit(1);
+    }
+    cfg_handle_addrs(&cfg, platform, "239.255.0.1", mcgroups_join_str, mconduit_dstaddrs_str);
+    if (zhe_init(&cfg, platform, zhe_platform_time()) < 0) {
+        fprintf(stderr, "init failed\n");
+        exit(1);
+    }
+    zhe_start(zhe_platform_time());
+    return platform;
+}
+
+static void poll_once(struct zhe_platform *platform, zhe_timediff_t timeout)
+{
+    zhe_time_t tnow;
+    if (zhe_platform_wait(platform, timeout)) {
+        zhe_recvbuf_t inbuf;
+        zhe_address_t insrc;
+        int recvret;
+        tnow = zhe_platform_time();
+        while ((recvret = zhe_platform_recv(platform, &inbuf, &insrc)) > 0) {
+            int cnt = zhe_input(inbuf.buf, (size_t)recvret, &insrc, tnow);
+            zhe_platform_advance(platform, &insrc, cnt);
+        }
+    } else {
+        tnow = zhe_platform_time();
+    }
+    zhe_housekeeping(tnow);
+}
+
+/* With a latency budget, data goes out from zhe_housekeeping, so it must be called often */
+static zhe_timediff_t poll_timeout(const struct params *prm)
+{
+    return (prm->budget == 0) ? 10 : 1;
+}
+
+static void pong_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *vpub)
+{
+    const zhe_pubidx_t *pub = vpub;
+    (void)zhe_write(*pub, payload, size, zhe_platform_time());
+}
+
+static void run_pong(const struct params *prm, int fd)
+{
+    struct zhe_platform * const platform = start_zhe(prm, fd, 7448, 7447);
+    zhe_pubidx_t p = zhe_publish(2, prm->cid, prm->reliable);
+    zhe_set_latency_budget(p, prm->budget);
+    (void)zhe_subscribe(1, 0, 0, pong_handler, &p);
+    while (1) {
+        poll_once(platform, poll_timeout(prm));
+    }
+}
+
+static uint64_t outstanding;
+static uint64_t rtt;
+
+static void ping_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg)
+{
+    uint64_t ts;
+    memcpy(&ts, payload, sizeof(ts));
+    if (ts == outstanding) {
+        rtt = gethrtime() - ts;
+        outstanding = 0;
+    }
+}
+
+static void run_ping(const struct params *prm, int fd)
+{
+    static struct hist h;
+    static uint8_t buf[TRANSPORT_MTU];
+    struct zhe_platform * const platform = start_zhe(prm, fd, 7447, 7448);
+    zhe_pubidx_t p = zhe_publish(1, prm->cid, prm->reliable);
+    zhe_set_latency_budget(p, prm->budget);
+    (void)zhe_subscribe(2, 0, 0, ping_handler, NULL);
+    const uint64_t tstart = gethrtime();
+    uint64_t tsent = 0;
+    unsigned received = 0, resends = 0;
+    bool discovered = false;
+    memset(buf, 0, sizeof(buf));
+    while (received < prm->warmup + prm->count) {
+        const uint64_t hrtnow = gethrtime();
+        if (hrtnow - tstart > (discovered ? RUN_TIMEOUT_NS : DISCOVERY_TIMEOUT_NS)) {
+            break;
+        }
+        if (outstanding == 0 || hrtnow - tsent > RESEND_INTERVAL_NS) {
+            if (outstanding != 0 && discovered) {
+                resends++;
+            }
+            outstanding = tsent = hrtnow;
+            memcpy(buf, &outstanding, sizeof(outstanding));
+            if (!zhe_write(p, buf, prm->size, zhe_platform_time())) {
+                /* reliable and window full: leave it to the resend timer */
+                outstanding = 0;
+                tsent = hrtnow;
+            }
+        }
+        poll_once(platform, (outstanding == 0) ? 0 : poll_timeout(prm));
+        if (rtt != 0) {
+            discovered = true;
+            if (received++ >= prm->warmup) {
+                hist_record(&h, rtt);
+            }
+            rtt = 0;
+        }
+    }
+    printf("%s,%u,%u,%s,%s,%"PRIu32",%"PRIu64",%u",
+           prm->shm ? "shm" : prm->mem ? "mem" : "udp", (unsigned)prm->size, prm->cid, conduit_kind(prm->cid),
+           prm->reliable ? "reliable" : "best-effort", (uint32_t)prm->budget, h.n, resends);
+    if (h.n == 0) {
+        printf(",,,,,,\n");
+    } else {
+        printf(",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", h.min / 1e3, hist_percentile(&h, 50.0) / 1e3,
+               hist_percentile(&h, 99.0) / 1e3, hist_percentile(&h, 99.9) / 1e3, h.max / 1e3,
+               (double)h.sum / (double)h.n / 1e3);
+    }
+    fflush(stdout);
+    exit(h.n == prm->count ? 0 : 1);
+}
+
+static int run_one(const struct params *prm)
+{
+    int sv[2] = { -1, -1 };
+    pid_t pong, ping;
+    int status;
+    if (prm->mem && socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+#if USE_SHM
+    if (prm->shm != NULL && pipe(shm_attached) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+#endif
+    fflush(stdout);
+    if ((pong = fork()) == 0) {
+        if (prm->mem) {
+            close(sv[0]);
+        }
+        run_pong(prm, sv[1]);
+    }
+    if ((ping = fork()) == 0) {
+        if (prm->mem) {
+            close(sv[1]);
+        }
+        run_ping(prm, sv[0]);
+    }
+    if (prm->mem) {
+        close(sv[0]);
+        close(sv[1]);
+    }
+#if USE_SHM
+    if (prm->shm != NULL) {
+        /* both have attached once both bytes have arrived, and if one died first, all write ends
+           are closed once the other has attached or died as well */
+        char c[2];
+        ssize_t n = 0, k;
+        close(shm_attached[1]);
+        while (n < 2 && (k = read(shm_attached[0], c, sizeof(c))) != 0) {
+            if (k > 0) {
+                n += k;
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        close(shm_attached[0]);
+        (void)shm_unlink(prm->shm);
+    }
+#endif
+    (void)waitpid(ping, &status, 0);
+    kill(pong, SIGTERM);
+    (void)waitpid(pong, NULL, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static unsigned parse_list(const char *str, unsigned long *xs, unsigned long max, const char *what)
+{
+    unsigned n = 0;
+    char *copy = strdup(str), *tok, *end;
+    for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        const unsigned long x = strtoul(tok, &end, 0);
+        if (*tok == 0 || *end != 0 || x > max || n == MAX_LIST) {
+            fprintf(stderr, "%s: invalid %s list\n", str, what);
+            exit(2);
+        }
+        xs[n++] = x;
+    }
+    free(copy);
+    return n;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [OPTIONS]\n\
+\n\
+-t TRANSP   transport: mem (in-memory, default), udp (UDP/IP with multicast\n\
+            discovery) or shm (shared memory)\n\
+-s SIZES    comma-separated payload sizes in bytes (default 8,64,512,1024)\n\
+-c CIDS     comma-separated conduit ids (default: 0 and the unicast conduit, if it can be published on)\n\
+-r MODES    comma-separated reliability modes: 1 = reliable, 0 = best-effort (default 1,0)\n\
+-b BUDGETS  comma-separated latency budgets in zhe time units (default 0)\n\
+-n N        number of round trips measured per combination (default 10000)\n\
+-w N        number of warm-up round trips per combination (default 100)\n\
+\n\
+Writes one CSV line per combination to stdout, latencies are in microseconds.\n\
+Reliable combinations that don't fit in the transmit window are skipped.\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char * const *argv)
+{
+    unsigned long sizes[MAX_LIST] = { 8, 64, 512, 1024 }, cids[MAX_LIST] = { 0 }, rels[MAX_LIST] = { 1, 0 }, budgets[MAX_LIST] = { 0 };
+    unsigned nsizes = 4, ncids = 1, nrels = 2, nbudgets = 1;
+    struct params prm = { .mem = true, .count = 10000, .warmup = 100 };
+    int opt, ok = 1;
+#if USE_SHM
+    char shmname[32];
+    snprintf(shmname, sizeof(shmname), "/zhe-latency-%d", (int)getpid());
+#endif
+
+#if HAVE_UNICAST_CONDUIT && MAX_PEERS_1 == 1 && UNICAST_CID > 0
+    cids[ncids++] = UNICAST_CID;
+#endif
+    while ((opt = getopt(argc, argv, "b:c:n:r:s:t:w:")) != EOF) {
+        switch (opt) {
+            case 't':
+                prm.shm = NULL;
+                if (strcmp(optarg, "mem") == 0) {
+                    prm.mem = true;
+                } else if (strcmp(optarg, "udp") == 0) {
+                    prm.mem = false;
+#if USE_SHM
+                } else if (strcmp(optarg, "shm") == 0) {
+                    prm.mem = false;
+                    prm.shm = shmname;
+#endif
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case 's': nsizes = parse_list(optarg, sizes, TRANSPORT_MTU - PER_SAMPLE_OVERHEAD, "size"); break;
+            case 'c': ncids = parse_list(optarg, cids, N_PUB_CONDUITS - 1, "conduit"); break;
+            case 'r': nrels = parse_list(optarg, rels, 1, "reliability"); break;
+            case 'b': nbudgets = parse_list(optarg, budgets, ZHE_TIMEDIFF_MAX, "latency budget"); break;
+            case 'n': prm.count = (unsigned)atoi(optarg); break;
+            case 'w': prm.warmup = (unsigned)atoi(optarg); break;
+            default: usage(argv[0]); break;
+        }
+    }
+    if (optind < argc || prm.count == 0) {
+        usage(argv[0]);
+    }
+
+    printf("transport,size,cid,conduit,reliability,budget,samples,resends,min_us,p50_us,p99_us,p99.9_us,max_us,mean_us\n");
+    for (unsigned is = 0; is < nsizes; is++) {
+        for (unsigned ic = 0; ic < ncids; ic++) {
+            for (unsigned ir = 0; ir < nrels; ir++) {
+                for (unsigned ib = 0; ib < nbudgets; ib++) {
+                    prm.size = (zhe_paysize_t)(sizes[is] < sizeof(uint64_t) ? sizeof(uint64_t) : sizes[is]);
+                    prm.cid = (unsigned)cids[ic];
+                    prm.reliable = (int)rels[ir];
+                    prm.budget = (zhe_time_t)budgets[ib];
+                    if (prm.reliable && prm.size + PER_SAMPLE_OVERHEAD > conduit_window(prm.cid)) {
+                        fprintf(stderr, "skipping reliable size %u on conduit %u: exceeds transmit window\n", (unsigned)prm.size, prm.cid);
+                        continue;
+                    }
+                    if (!run_one(&prm)) {
+                        ok = 0;
+                    }
+                }
+            }
+        }
+    }
+    return !ok;
+}
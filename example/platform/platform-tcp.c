@@ -15,6 +15,7 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 
@@ -28,6 +29,9 @@
 #endif
 
 #include "platform-tcp.h"
+#if USE_EPOLL
+#include <sys/epoll.h>
+#endif
 #include "zhe-assert.h"
 #include "zhe-tracing.h"
 #include "zhe-config-deriv.h"
@@ -39,12 +43,37 @@
 #define PINGADDRIDX_INVALID PEERIDX_INVALID
 typedef peeridx_t pingaddridx_t;
 
+/* Frame lengths are VLE encoded, 7 bits per byte, so an MTU beyond 16383 bytes requires 3 bytes
+   for the length; that remains compatible with peers using 2 bytes as long as the packets are
+   small enough */
+#if TRANSPORT_MTU <= 0x3fff
+#define FRAMELEN_MAXBYTES 2
+#else
+#define FRAMELEN_MAXBYTES 3
+#endif
+
+#if TCP_INBUF_SIZE < TRANSPORT_MTU + FRAMELEN_MAXBYTES
+#  error "TCP_INBUF_SIZE must be able to hold a maximum-size frame"
+#endif
+
 struct buf {
-    zhe_msgsize_t pos;
-    zhe_msgsize_t lim;
-    uint8_t buf[TRANSPORT_MTU + 2]; /* 2 bytes extra for framing */
+    uint32_t pos;
+    uint32_t lim;
+    uint8_t buf[TRANSPORT_MTU + FRAMELEN_MAXBYTES];
+};
+
+/* Received data: bytes [POS,LIM) are yet to be processed; it is only moved to the start of the
+   buffer just before reading, so processing several frames costs a single move */
+struct inbuf {
+    uint32_t pos;
+    uint32_t lim;
+    uint8_t buf[TCP_INBUF_SIZE];
 };
 
+#if TCP_OUTRING_FRAMES < 1 || TCP_OUTRING_FRAMES > 128 || (TCP_OUTRING_FRAMES & (TCP_OUTRING_FRAMES - 1)) != 0
+#  error "TCP_OUTRING_FRAMES must be a power of 2 in [1,128]"
+#endif
+
 enum conn_state {
     CS_CLOSED,
     CS_TCPCONNECT,
@@ -65,11 +94,31 @@ struct conn {
 #endif
     bool inframed, outframed;
     bool datawaiting; /* for framed input */
-    struct buf in, out;
+    struct inbuf in;
+    /* Packets (including framing) not yet (completely) written, OUTTAIL is the oldest one and the
+       first OUT[OUTTAIL].POS bytes of it have been written already; free-running indices */
+    uint8_t outhead, outtail;
+    struct buf out[TCP_OUTRING_FRAMES];
     zhe_time_t ttent; /* FIXME: only when TENTATIVE; but in that case we don't need out I think, so a union might be nicer */
     pingaddridx_t pingprogeny; /* index in tcp->pingaddrs */
+#if USE_EPOLL
+    bool ready; /* in the ready list */
+    bool outwatch; /* registered for EPOLLOUT because of queued output or a pending connect */
+    connidx_t readyprev, readynext;
+#endif
 };
 
+#if USE_EPOLL
+/* Connections are registered edge-triggered, so a connection that was reported readable remains
+   in the ready list until a read finds nothing and no complete frame is left in its buffer; the
+   listening socket is level-triggered and identified by MAX_CONNECTIONS */
+#define CONNIDX_NONE ((connidx_t)MAX_CONNECTIONS)
+#define EPOLL_MAX_EVENTS 32
+/* Completion of a connect is checked in housekeeping, a connecting socket is additionally
+   watched for EPOLLOUT so that waiting ends when it completes */
+#define CONN_EPOLL_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLET)
+#endif
+
 struct tcp {
     int servsock;
     uint16_t port;
@@ -80,6 +129,12 @@ struct tcp {
     BIO *ssl_servsock_bio;
 #endif
 
+#if USE_EPOLL
+    int epfd;
+    bool acceptready;
+    connidx_t readyhead, readytail;
+#endif
+
     DECL_BITSET(pingmask, MAX_PINGADDRS);
     DECL_BITSET(pingthrottle, MAX_PINGADDRS);
     pingaddridx_t npingaddrs;
@@ -127,6 +182,14 @@ static void set_nosigpipe(int sock)
 #endif
 }
 
+static void set_nodelay(int sock)
+{
+    /* packets are already as large as the core can make them within its latency budget, delaying
+       them further (and especially the ACKNACKs) only costs throughput */
+    int set = 1;
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&set, sizeof(int));
+}
+
 #if USE_SSL
 static int ssl_verify (int ok, X509_STORE_CTX * store)
 {
@@ -277,6 +340,79 @@ static ssize_t conn_writev(struct conn *conn, const struct iovec *iov, int iovcn
 #endif
 }
 
+#if USE_EPOLL
+static void ready_append(struct tcp *tcp, connidx_t idx)
+{
+    struct conn * const conn = &tcp->conns[idx];
+    if (conn->ready) {
+        return;
+    }
+    conn->ready = true;
+    conn->readyprev = tcp->readytail;
+    conn->readynext = CONNIDX_NONE;
+    if (tcp->readytail == CONNIDX_NONE) {
+        tcp->readyhead = idx;
+    } else {
+        tcp->conns[tcp->readytail].readynext = idx;
+    }
+    tcp->readytail = idx;
+}
+
+static void ready_remove(struct tcp *tcp, connidx_t idx)
+{
+    struct conn * const conn = &tcp->conns[idx];
+    if (!conn->ready) {
+        return;
+    }
+    conn->ready = false;
+    if (conn->readyprev == CONNIDX_NONE) {
+        tcp->readyhead = conn->readynext;
+    } else {
+        tcp->conns[conn->readyprev].readynext = conn->readynext;
+    }
+    if (conn->readynext == CONNIDX_NONE) {
+        tcp->readytail = conn->readyprev;
+    } else {
+        tcp->conns[conn->readynext].readyprev = conn->readyprev;
+    }
+}
+
+static int epoll_register(struct tcp *tcp, int sock, uint32_t events, uint32_t idx)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = idx;
+    return epoll_ctl(tcp->epfd, EPOLL_CTL_ADD, sock, &ev);
+}
+
+static ssize_t conn_flush(struct tcp *tcp, struct conn *conn);
+static int send_result(struct tcp *tcp, struct conn *conn, ssize_t ret);
+static void conn_watch_output(struct tcp *tcp, struct conn *conn, bool watch);
+
+/* Moves the connections for which events are pending to the ready list, waiting at most TIMEOUT
+   ms for them; returns the number of events */
+static int epoll_harvest(struct tcp *tcp, int timeout)
+{
+    struct epoll_event evs[EPOLL_MAX_EVENTS];
+    const int n = epoll_wait(tcp->epfd, evs, EPOLL_MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+        if (evs[i].data.u32 == MAX_CONNECTIONS) {
+            tcp->acceptready = true;
+        } else {
+            struct conn * const conn = &tcp->conns[evs[i].data.u32];
+            if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                ready_append(tcp, (connidx_t)evs[i].data.u32);
+            }
+            if ((evs[i].events & EPOLLOUT) && conn->state == CS_LIVE) {
+                (void)send_result(tcp, conn, conn_flush(tcp, conn));
+            }
+        }
+    }
+    return n;
+}
+#endif
+
 struct zhe_platform *zhe_platform_new(uint16_t port, const char *pingaddrs)
 {
     struct tcp * const tcp = &gtcp;
@@ -291,7 +427,18 @@ struct zhe_platform *zhe_platform_new(uint16_t port, const char *pingaddrs)
         id.u.s.serial = 0;
         tcp->conns[i].state = CS_CLOSED;
         tcp->conns[i].id = id.u.id;
+#if USE_EPOLL
+        tcp->conns[i].ready = false;
+#endif
+    }
+#if USE_EPOLL
+    tcp->readyhead = tcp->readytail = CONNIDX_NONE;
+    tcp->acceptready = false;
+    if ((tcp->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1");
+        return NULL;
     }
+#endif
 
     tcp->cursor = 0;
     tcp->port = htons(port);
@@ -358,6 +505,12 @@ struct zhe_platform *zhe_platform_new(uint16_t port, const char *pingaddrs)
             perror("listen");
             goto err_listen;
         }
+#if USE_EPOLL
+        if (epoll_register(tcp, tcp->servsock, EPOLLIN, MAX_CONNECTIONS) == -1) {
+            perror("epoll_ctl");
+            goto err_listen;
+        }
+#endif
 #if USE_SSL
         tcp->ssl_servsock_bio = BIO_new(BIO_s_accept());
         BIO_set_fd(tcp->ssl_servsock_bio, tcp->servsock, BIO_NOCLOSE);
@@ -370,6 +523,9 @@ err_bind:
 err_servsock:
 #if USE_SSL
     SSL_CTX_free(tcp->ssl_ctx);
+#endif
+#if USE_EPOLL
+    close(tcp->epfd);
 #endif
     return NULL;
 }
@@ -495,6 +651,11 @@ bool zhe_platform_needs_keepalive(struct zhe_platform *pf)
 
 static void make_closed(struct tcp *tcp, struct conn *conn, bool throttle)
 {
+#if USE_EPOLL
+    /* closing the socket also removes it from the epoll set */
+    ready_remove(tcp, (connidx_t)(conn - tcp->conns));
+    conn->outwatch = false;
+#endif
     close(conn->s);
 #if USE_SSL
     SSL_free(conn->ssl);
@@ -523,7 +684,15 @@ static void make_waitdata(struct tcp *tcp, struct conn *conn)
     conn->outframed = true;
     conn->datawaiting = false;
     conn->in.lim = conn->in.pos = 0;
-    conn->out.lim = conn->out.pos = 0;
+    conn->outhead = conn->outtail = 0;
+#if USE_EPOLL
+    if (conn->outwatch) {
+        /* no longer waiting for the connect to complete */
+        conn_watch_output(tcp, conn, false);
+    }
+    /* data may have arrived while handshaking, without there being a new edge for it */
+    ready_append(tcp, (connidx_t)(conn - tcp->conns));
+#endif
 
     if (conn->pingprogeny == PINGADDRIDX_INVALID) {
         if (!conn->outframed) {
@@ -546,96 +715,135 @@ static void make_waitdata(struct tcp *tcp, struct conn *conn)
 }
 
 #if USE_SSL
-static void make_sslhandshake(struct conn *conn)
+static void make_sslhandshake(struct tcp *tcp, struct conn *conn)
 {
     conn->state = CS_SSLHANDSHAKE;
+#if USE_EPOLL
+    if (conn->outwatch) {
+        /* no longer waiting for the connect to complete */
+        conn_watch_output(tcp, conn, false);
+    }
+#else
+    (void)tcp;
+#endif
 }
 #endif
 
-static size_t encvle14(uint8_t *dst, size_t val)
+static size_t encvle(uint8_t *dst, size_t val)
 {
-    zhe_assert(val < 16384); /* max 2 bytes */
-    if (val <= 0x7f) {
-        dst[0] = (uint8_t)val;
-        return 1;
-    } else {
-        dst[0] = (uint8_t)(0x80 | (val & 0x7f));
-        dst[1] = (uint8_t)(val >> 7);
-        return 2;
+    size_t n = 0;
+    zhe_assert(val <= TRANSPORT_MTU); /* max FRAMELEN_MAXBYTES bytes */
+    while (val > 0x7f) {
+        dst[n++] = (uint8_t)(0x80 | (val & 0x7f));
+        val >>= 7;
     }
+    dst[n++] = (uint8_t)val;
+    return n;
 }
 
-static int decvle14(const uint8_t *src, size_t sz, size_t *val)
+static int decvle(const uint8_t *src, size_t sz, size_t *val)
 {
+    size_t v = 0;
     if (sz < 1) {
         return -1;
-    } else if (src[0] <= 0x7f) {
-        *val = src[0];
-        return 1;
-    } else if (sz == 1) {
-        return 0;
-    } else if (src[1] <= 0x7f) {
-        *val = (src[1] << 7) | (src[0] & 0x7f);
-        return 2;
-    } else {
-        return -1;
     }
+    for (size_t i = 0; i < FRAMELEN_MAXBYTES; i++) {
+        if (i == sz) {
+            return 0;
+        }
+        v |= (size_t)(src[i] & 0x7f) << (7 * i);
+        if (src[i] <= 0x7f) {
+            *val = v;
+            return (int)(i + 1);
+        }
+    }
+    return -1;
 }
 
-static int zhe_platform_send_conn(struct tcp * const tcp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+#if USE_EPOLL
+static void conn_watch_output(struct tcp *tcp, struct conn *conn, bool watch)
 {
-    struct conn * const conn = &tcp->conns[dst->u.s.idx];
-    ssize_t ret;
-    zhe_assert(size <= TRANSPORT_MTU);
-    if (conn->state != CS_LIVE || dst->u.id != conn->id) {
-        return SENDRECV_HANGUP;
-    }
-    zhe_assert(conn->s != -1);
-    zhe_assert(conn->out.pos < conn->out.lim || (conn->out.pos == 0 && conn->out.lim == 0));
-    if (conn->out.pos < conn->out.lim) {
-        ret = conn_write(conn, conn->out.buf + conn->out.pos, conn->out.lim - conn->out.pos);
-        if (ret > 0) {
-            conn->out.pos += (zhe_msgsize_t)ret;
-            if (conn->out.pos == conn->out.lim) {
-                conn->out.pos = conn->out.lim = 0;
-            }
-        }
+    /* edge-triggered, so re-arming with EPOLLOUT reports writability even if it was so already */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = CONN_EPOLL_EVENTS | (watch ? EPOLLOUT : 0);
+    ev.data.u32 = (uint32_t)(conn - tcp->conns);
+    if (epoll_ctl(tcp->epfd, EPOLL_CTL_MOD, conn->s, &ev) == 0) {
+        conn->outwatch = watch;
     }
-    if (conn->out.lim == 0) {
-        uint8_t vlelen[2];
-        struct iovec iov[2];
-        int iovcnt = 0;
-        size_t xsize;
-        if (!conn->outframed) {
-            xsize = 0;
+}
+#endif
+
+/* Appends the contents of IOV, less the first SKIP bytes, to the output ring of CONN as a single
+   packet; there must be room */
+static void conn_enqueue(struct tcp *tcp, struct conn *conn, const struct iovec *iov, int iovcnt, size_t skip)
+{
+    struct buf * const b = &conn->out[conn->outhead % TCP_OUTRING_FRAMES];
+    zhe_assert((uint8_t)(conn->outhead - conn->outtail) < TCP_OUTRING_FRAMES);
+    b->pos = b->lim = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
         } else {
-            iov[iovcnt].iov_base = vlelen;
-            iov[iovcnt++].iov_len = xsize = encvle14(vlelen, size);
-            ZT(TRANSPORT, "send %d frame %u", conn->s, (unsigned)size);
+            memcpy(b->buf + b->lim, (const uint8_t *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+            b->lim += (zhe_msgsize_t)(iov[i].iov_len - skip);
+            skip = 0;
         }
-        iov[iovcnt].iov_base = (void *)buf;
-        iov[iovcnt++].iov_len = size;
-        xsize += size;
-        /* write length + messages and retain any leftovers */
-        ret = conn_writev(conn, iov, iovcnt);
-        if (ret > 0 && (size_t)ret < xsize) {
-            size_t nwr = (size_t)ret;
-            int i = 0;
-            while (nwr >= iov[i].iov_len) {
-                nwr -= iov[i++].iov_len;
-                zhe_assert(i < iovcnt);
-            }
-            zhe_msgsize_t rem = (zhe_msgsize_t)(iov[i].iov_len - nwr);
-            memcpy(conn->out.buf + conn->out.lim, (const uint8_t *)iov[i].iov_base + nwr, rem);
-            conn->out.lim += rem;
-            for (++i; i < iovcnt; i++) {
-                memcpy(conn->out.buf + conn->out.lim, iov[i].iov_base, iov[i].iov_len);
-                conn->out.lim += iov[i].iov_len;
+    }
+#if USE_EPOLL
+    if (conn->outhead++ == conn->outtail && !conn->outwatch) {
+        conn_watch_output(tcp, conn, true);
+    }
+#else
+    (void)tcp;
+    conn->outhead++;
+#endif
+}
+
+/* Writes as much of the output ring of CONN as the socket will take using a single writev,
+   returning the result of the writev (1 if there was nothing to write) */
+static ssize_t conn_flush(struct tcp *tcp, struct conn *conn)
+{
+    struct iovec iov[TCP_OUTRING_FRAMES];
+    int iovcnt = 0;
+    ssize_t ret;
+#if !USE_EPOLL
+    (void)tcp;
+#endif
+    for (uint8_t k = conn->outtail; k != conn->outhead; k++) {
+        struct buf * const b = &conn->out[k % TCP_OUTRING_FRAMES];
+        zhe_assert(b->pos < b->lim);
+        iov[iovcnt].iov_base = b->buf + b->pos;
+        iov[iovcnt++].iov_len = b->lim - b->pos;
+    }
+    if (iovcnt == 0) {
+        return 1;
+    }
+    ret = conn_writev(conn, iov, iovcnt);
+    if (ret > 0) {
+        size_t nwr = (size_t)ret;
+        ZT(TRANSPORT, "sock %d flushed %u bytes of %d packets", conn->s, (unsigned)nwr, iovcnt);
+        while (nwr > 0) {
+            struct buf * const b = &conn->out[conn->outtail % TCP_OUTRING_FRAMES];
+            const size_t rem = b->lim - b->pos;
+            if (nwr < rem) {
+                b->pos += (zhe_msgsize_t)nwr;
+                break;
             }
+            nwr -= rem;
+            conn->outtail++;
         }
-    } else {
-        return 0;
+#if USE_EPOLL
+        if (conn->outtail == conn->outhead && conn->outwatch) {
+            conn_watch_output(tcp, conn, false);
+        }
+#endif
     }
+    return ret;
+}
+
+static int send_result(struct tcp *tcp, struct conn *conn, ssize_t ret)
+{
     if (ret > 0) {
         return (int)ret;
     } else if (ret == 0 || errno == EPIPE) {
@@ -649,6 +857,57 @@ static int zhe_platform_send_conn(struct tcp * const tcp, const void * restrict
     }
 }
 
+static int zhe_platform_send_conn(struct tcp * const tcp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    struct conn * const conn = &tcp->conns[dst->u.s.idx];
+    uint8_t vlelen[FRAMELEN_MAXBYTES];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    size_t xsize;
+    ssize_t ret;
+    zhe_assert(size <= TRANSPORT_MTU);
+    if (conn->state != CS_LIVE || dst->u.id != conn->id) {
+        return SENDRECV_HANGUP;
+    }
+    zhe_assert(conn->s != -1);
+    if (!conn->outframed) {
+        xsize = 0;
+    } else {
+        iov[iovcnt].iov_base = vlelen;
+        iov[iovcnt++].iov_len = xsize = encvle(vlelen, size);
+        ZT(TRANSPORT, "send %d frame %u", conn->s, (unsigned)size);
+    }
+    iov[iovcnt].iov_base = (void *)buf;
+    iov[iovcnt++].iov_len = size;
+    xsize += size;
+
+    /* Older packets go first: if any remain queued after trying to write them, the new one gets
+       queued behind them, and it is only dropped if the ring is full */
+    if (conn->outhead != conn->outtail) {
+        const int res = send_result(tcp, conn, conn_flush(tcp, conn));
+        if (res < 0) {
+            return res;
+        } else if (conn->outhead != conn->outtail) {
+            if ((uint8_t)(conn->outhead - conn->outtail) == TCP_OUTRING_FRAMES) {
+                ZT(TRANSPORT, "sock %d output ring full", conn->s);
+                return 0;
+            }
+            conn_enqueue(tcp, conn, iov, iovcnt, 0);
+            return (int)size;
+        }
+    }
+
+    /* write length + messages and queue any leftovers */
+    ret = conn_writev(conn, iov, iovcnt);
+    if (ret > 0 && (size_t)ret < xsize) {
+        conn_enqueue(tcp, conn, iov, iovcnt, (size_t)ret);
+    } else if (ret == -1 && (errno == EAGAIN || errno == ENOBUFS || errno == EWOULDBLOCK)) {
+        conn_enqueue(tcp, conn, iov, iovcnt, 0);
+        return (int)size;
+    }
+    return send_result(tcp, conn, ret);
+}
+
 int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
 {
     /* FIXME: generic code currently sends scouts & keepalives using IP addresses - we fake it by sending them over all live connections */
@@ -669,18 +928,27 @@ int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t
     }
 }
 
+static void inbuf_compact(struct inbuf *in)
+{
+    if (in->pos > 0) {
+        memmove(in->buf, in->buf + in->pos, in->lim - in->pos);
+        in->lim -= in->pos;
+        in->pos = 0;
+    }
+}
+
 static int handle_data(struct tcp *tcp, struct conn *conn, zhe_recvbuf_t *buf, ssize_t cnt)
 {
     if (cnt > 0) {
-        conn->in.lim += (zhe_msgsize_t)cnt;
+        conn->in.lim += (uint32_t)cnt;
     }
     if (!conn->inframed) {
         buf->buf = conn->in.buf + conn->in.pos;
         return (int)(conn->in.lim - conn->in.pos);
     } else {
         size_t len;
-        int lenlen = decvle14(conn->in.buf + conn->in.pos, conn->in.lim - conn->in.pos, &len);
-        if (lenlen < 0) {
+        int lenlen = decvle(conn->in.buf + conn->in.pos, conn->in.lim - conn->in.pos, &len);
+        if (lenlen < 0 || (lenlen > 0 && len > TRANSPORT_MTU)) {
             ZT(TRANSPORT, "sock %d framing error", conn->s);
             make_closed(tcp, conn, true);
             return (conn->state == CS_LIVE ? SENDRECV_HANGUP : 0);
@@ -712,6 +980,70 @@ static int handle_data(struct tcp *tcp, struct conn *conn, zhe_recvbuf_t *buf, s
     }
 }
 
+static void accept_conn(struct tcp *tcp);
+
+#if USE_EPOLL
+int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t * restrict src)
+{
+    struct tcp *tcp = (struct tcp *)pf;
+
+    if (tcp->readyhead == CONNIDX_NONE && !tcp->acceptready) {
+        (void)epoll_harvest(tcp, 0);
+    }
+    /* Round-robin over the ready connections: one that yielded something goes to the back of the
+       list, one that had nothing left is dropped from it until the next edge */
+    while (tcp->readyhead != CONNIDX_NONE) {
+        const connidx_t i = tcp->readyhead;
+        struct conn * const conn = &tcp->conns[i];
+        ssize_t ret;
+        ready_remove(tcp, i);
+        zhe_assert(conn->in.pos < conn->in.lim || (conn->in.pos == 0 && conn->in.lim == 0));
+        if (!state_allows_receive(conn->state)) {
+            /* handshake in progress, make_waitdata puts it back in */
+            continue;
+        }
+        if (conn->datawaiting) {
+            /* process the frames read earlier, only reading again once no complete one remains */
+            ret = -1;
+        } else {
+            inbuf_compact(&conn->in);
+            ret = conn_read(conn, conn->in.buf + conn->in.lim, sizeof(conn->in.buf) - conn->in.lim);
+        }
+        if (ret > 0 || (ret == -1 && conn->datawaiting)) {
+            int res;
+            if (conn->state == CS_WAITDATA) {
+                ZT(TRANSPORT, "sock %d now live", conn->s);
+                make_live(conn);
+            }
+            src->kind = ZHE_AK_CONN;
+            src->u.id = conn->id;
+            res = handle_data(tcp, conn, buf, ret);
+            if (conn->state != CS_CLOSED) {
+                ready_append(tcp, i);
+            }
+            return res;
+        } else if (ret == 0) {
+            ZT(TRANSPORT, "sock %d eof", conn->s);
+            src->kind = ZHE_AK_CONN;
+            src->u.id = conn->id;
+            make_closed(tcp, conn, false);
+            /* only inform the core code of the closing of the connection if we previously informed it of its existence */
+            return (conn->state == CS_LIVE ? SENDRECV_HANGUP : 0);
+        } else if (errno == EINTR) {
+            ready_append(tcp, i);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ready_append(tcp, i);
+            return SENDRECV_ERROR;
+        }
+    }
+
+    if (tcp->acceptready) {
+        tcp->acceptready = false;
+        accept_conn(tcp);
+    }
+    return 0;
+}
+#else
 int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t * restrict src)
 {
     struct tcp *tcp = (struct tcp *)pf;
@@ -724,8 +1056,14 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
         if (!state_allows_receive(conn->state)) {
             continue;
         }
-        ret = conn_read(conn, conn->in.buf + conn->in.lim, sizeof(conn->in.buf) - conn->in.lim);
-        if (ret > 0 || (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && conn->datawaiting)) {
+        if (conn->datawaiting) {
+            /* process the frames read earlier, only reading again once no complete one remains */
+            ret = -1;
+        } else {
+            inbuf_compact(&conn->in);
+            ret = conn_read(conn, conn->in.buf + conn->in.lim, sizeof(conn->in.buf) - conn->in.lim);
+        }
+        if (ret > 0 || (ret == -1 && conn->datawaiting)) {
             if (conn->state == CS_WAITDATA) {
                 ZT(TRANSPORT, "sock %d now live", conn->s);
                 make_live(conn);
@@ -749,6 +1087,13 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
 
     /* Round-robin with an attempt at accepting a connection as the last step in the cycle */
     tcp->cursor = 0;
+    accept_conn(tcp);
+    return 0;
+}
+#endif
+
+static void accept_conn(struct tcp *tcp)
+{
     if (tcp->servsock != -1) {
         connidx_t idx;
         for (idx = 0; idx < MAX_CONNECTIONS; idx++) {
@@ -776,6 +1121,22 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
             }
 #else
             news = accept(tcp->servsock, (struct sockaddr *)&addr.u.a, &addrlen);
+#endif
+            if (news >= 0) {
+                /* on Linux, O_NONBLOCK is not inherited from the listening socket */
+                set_nonblock(news);
+                set_nosigpipe(news);
+                set_nodelay(news);
+            }
+#if USE_EPOLL
+            if (news >= 0 && epoll_register(tcp, news, CONN_EPOLL_EVENTS, idx) == -1) {
+                perror("epoll_ctl");
+#if USE_SSL
+                SSL_free(ssl);
+#endif
+                close(news);
+                news = -1;
+            }
 #endif
             if (news >= 0) {
                 struct conn * const conn = &tcp->conns[idx];
@@ -790,14 +1151,13 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
                 conn->ttent = zhe_platform_time(); /* FIXME: I kinda try to avoid calling time(), but then, this is platform code */
                 conn->pingprogeny = PINGADDRIDX_INVALID;
 #if USE_SSL
-                make_sslhandshake(conn);
+                make_sslhandshake(tcp, conn);
 #else
                 make_waitdata(tcp, conn);
 #endif
             }
         }
     }
-    return 0;
 }
 
 int zhe_platform_advance(struct zhe_platform *pf, const zhe_address_t * restrict src, int cnt)
@@ -807,11 +1167,13 @@ int zhe_platform_advance(struct zhe_platform *pf, const zhe_address_t * restrict
     struct conn * const conn = &tcp->conns[src->u.s.idx];
     if (conn->state == CS_LIVE && conn->id == src->u.id && cnt > 0) {
         zhe_assert(cnt <= conn->in.lim - conn->in.pos);
-        const zhe_msgsize_t pos1 = conn->in.pos + (zhe_msgsize_t)cnt;
-        const zhe_msgsize_t rem = conn->in.lim - pos1;
-        memmove(conn->in.buf, conn->in.buf + pos1, rem);
-        conn->in.lim = rem;
-        conn->in.pos = 0;
+        const uint32_t pos1 = conn->in.pos + (uint32_t)cnt;
+        const uint32_t rem = conn->in.lim - pos1;
+        if (rem == 0) {
+            conn->in.lim = conn->in.pos = 0;
+        } else {
+            conn->in.pos = pos1;
+        }
         conn->datawaiting = (conn->inframed && rem > 0);
     }
     return 0;
@@ -896,6 +1258,15 @@ static void try_connect(struct tcp *tcp, connidx_t clidx, pingaddridx_t pidx, zh
     }
     set_nonblock(conn->s);
     set_nosigpipe(conn->s);
+    set_nodelay(conn->s);
+#if USE_EPOLL
+    /* EPOLLOUT signals completion of the connect */
+    if (epoll_register(tcp, conn->s, CONN_EPOLL_EVENTS | EPOLLOUT, clidx) == -1) {
+        close(conn->s);
+        return;
+    }
+    conn->outwatch = true;
+#endif
     ret = connect(conn->s, (struct sockaddr *)&tcp->pingaddrs[pidx], sizeof(tcp->pingaddrs[pidx]));
     if (ret == -1 && errno != EINPROGRESS) {
             close(conn->s);
@@ -911,7 +1282,7 @@ static void try_connect(struct tcp *tcp, connidx_t clidx, pingaddridx_t pidx, zh
 #endif
     if (ret != -1) {
 #if USE_SSL
-        make_sslhandshake(conn);
+        make_sslhandshake(tcp, conn);
 #else
         make_waitdata(tcp, conn);
 #endif
@@ -946,7 +1317,11 @@ void zhe_platform_housekeeping(struct zhe_platform *pf, zhe_time_t tnow)
             if (conn->pingprogeny != PINGADDRIDX_INVALID) {
                 zhe_bitset_clear(pingmask, conn->pingprogeny);
             }
-            if (conn->state < CS_LIVE) {
+            if (conn->state == CS_LIVE) {
+                if (conn->outhead != conn->outtail) {
+                    (void)send_result(tcp, conn, conn_flush(tcp, conn));
+                }
+            } else {
                 if ((zhe_timediff_t)(tnow - tcp->conns[i].ttent) > ZHE_TCPOPEN_MAXWAIT) {
                     ZT(TRANSPORT, "sock %d did not make it to live", conn->s);
                     make_closed(tcp, conn, true);
@@ -966,7 +1341,7 @@ void zhe_platform_housekeeping(struct zhe_platform *pf, zhe_time_t tnow)
                             if (err == 0) {
                                 ZT(TRANSPORT, "sock %d connection established", conn->s);
 #if USE_SSL
-                                make_sslhandshake(conn);
+                                make_sslhandshake(tcp, conn);
 #else
                                 make_waitdata(tcp, conn);
 #endif
@@ -1028,6 +1403,32 @@ int zhe_platform_addr_eq(const struct zhe_address *a, const struct zhe_address *
     }
 }
 
+#if USE_EPOLL
+void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platform *pf)
+{
+    const struct tcp * const tcp = (const struct tcp *)pf;
+    wi->pf = (struct zhe_platform *)pf;
+    /* a connection in the ready list may have data buffered, so no point in blocking */
+    wi->shouldwait = (tcp->readyhead == CONNIDX_NONE && !tcp->acceptready);
+}
+
+int zhe_platform_wait_block(zhe_platform_waitinfo_t *wi, zhe_timediff_t timeout)
+{
+    if (!wi->shouldwait) {
+        return 1;
+    } else {
+        struct tcp * const tcp = (struct tcp *)wi->pf;
+        int ms;
+        if (timeout < 0) {
+            ms = 100;
+        } else {
+            ms = (int)(1000 * ZTIME_TO_SECu32(timeout) + ZTIME_TO_MSECu32(timeout));
+        }
+        (void)epoll_harvest(tcp, ms);
+        return tcp->readyhead != CONNIDX_NONE || tcp->acceptready;
+    }
+}
+#else
 void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platform *pf)
 {
     struct tcp * const tcp = (struct tcp *)pf;
@@ -1049,6 +1450,10 @@ void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platfo
             }
             const int s = tcp->conns[i].s;
             FD_SET(s, &wi->rs);
+            if (tcp->conns[i].outhead != tcp->conns[i].outtail) {
+                /* wake up for flushing the output ring in housekeeping */
+                FD_SET(s, &wi->ws);
+            }
             if (s > wi->maxfd) { wi->maxfd = s; }
         } else if (tcp->conns[i].state == CS_TCPCONNECT) {
             const int s = tcp->conns[i].s;
@@ -1074,6 +1479,7 @@ int zhe_platform_wait_block(zhe_platform_waitinfo_t *wi, zhe_timediff_t timeout)
         return select(wi->maxfd+1, &wi->rs, &wi->ws, NULL, &tv) > 0;
     }
 }
+#endif
 
 int zhe_platform_wait(const struct zhe_platform *pf, zhe_timediff_t timeout)
 {
@@ -12,7 +12,12 @@ extern "C" {
 #  error "platform include file should come after core configuration settings have been defined"
 #endif
 
-#define TRANSPORT_MTU        100u
+/* The default MTU suits constrained devices; for connections between servers it can be raised
+   to the maximum of 65534 supported by the core (e.g., cmake -DTCP=ON -DTCP_MTU=65534) */
+#ifndef TCP_MTU
+#  define TCP_MTU 100u
+#endif
+#define TRANSPORT_MTU        TCP_MTU
 #define TRANSPORT_MODE       TRANSPORT_STREAM
 #define TRANSPORT_ADDRSTRLEN (4 + INET_ADDRSTRLEN + 6) /* tcp/IP:PORT -- tcp/ is 4, colon is 1, PORT in [1,5] */
 
@@ -57,10 +62,37 @@ int zhe_platform_wait(const struct zhe_platform *pf, zhe_timediff_t timeout);
 int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *rbuf, struct zhe_address * restrict src);
 int zhe_platform_advance(struct zhe_platform *pf, const struct zhe_address * restrict src, int cnt);
 
+/* On Linux, readiness of the connections is tracked using epoll by default, so that the cost of
+   receiving and waiting depends on the number of active connections rather than the number of
+   connections; elsewhere (or with USE_EPOLL set to 0) select is used */
+#ifndef USE_EPOLL
+#  ifdef __linux__
+#    define USE_EPOLL 1
+#  else
+#    define USE_EPOLL 0
+#  endif
+#endif
+
+/* Size of the receive buffer of a connection, which may hold several frames so that these can be
+   processed without reading from the socket for each one (3 is the maximum framing overhead) */
+#ifndef TCP_INBUF_SIZE
+#  define TCP_INBUF_SIZE (4 * (TRANSPORT_MTU + 3))
+#endif
+
+/* Number of packets that can be queued for transmission on a connection while its socket isn't
+   accepting data; anything beyond that is dropped. Must be a power of 2 and at most 128. */
+#ifndef TCP_OUTRING_FRAMES
+#  define TCP_OUTRING_FRAMES 8
+#endif
+
 typedef struct zhe_platform_waitinfo {
     bool shouldwait;
+#if USE_EPOLL
+    struct zhe_platform *pf;
+#else
     int maxfd;
     fd_set rs, ws;
+#endif
 } zhe_platform_waitinfo_t;
 
 void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platform *pf);
@@ -18,6 +18,22 @@
 #include <ifaddrs.h>
 
 #include "platform-udp.h"
+#if USE_UDP_GSO
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#endif
+#if USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#if USE_SHM
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include "zhe-assert.h"
 #include "zhe-tracing.h"
 #include "zhe-config-deriv.h"
@@ -25,12 +41,142 @@
 
 #define BLOCKING_SEND 0
 #define SIMUL_PACKET_LOSS 1
+#define PACKET_CAPTURE 1
 
 #define MAX_SELF 16
+#define MAX_MESH 32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if USE_UDP_GSO
+/* Limits of the kernel on a UDP_SEGMENT send: the IPv4 payload size less the UDP header, and (on
+   older kernels) 64 segments */
+#define GSO_MAXBYTES 65507
+#define GSO_MAXSEGS 64
+
+/* Packets collected for a single UDP_SEGMENT send: all have size SEGSIZE, except possibly the
+   last one, which then closes the batch */
+struct gso_out {
+    zhe_address_t dst;
+    size_t segsize;
+    size_t len;
+    unsigned nsegs;
+    bool closed;
+    uint8_t buf[GSO_MAXBYTES];
+};
+
+/* A received datagram, possibly packets coalesced by the kernel, all of size SEGSIZE but the last;
+   bytes [POS,LIM) are yet to be returned */
+struct gro_in {
+    zhe_address_t src;
+    size_t segsize;
+    size_t pos;
+    size_t lim;
+    uint8_t buf[GSO_MAXBYTES];
+};
+#endif
+
+#if USE_IO_URING
+#define URING_ENTRIES 128      /* submission queue entries */
+#define URING_NRECVBUFS 256    /* provided buffers for the multishot receives, a power of 2 */
+#define URING_NSENDS 64        /* packets that can be in flight */
+#define URING_BGID 0
+#define URING_MAXMAPS 5
+
+/* user_data of a completion: the index in SENDS for a send, URING_UD_RECV + socket index for a
+   receive */
+#define URING_UD_RECV URING_NSENDS
+
+/* A provided buffer gets a struct io_uring_recvmsg_out, the source address and the payload */
+#define URING_RECVBUF_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + TRANSPORT_MTU)
+
+struct uring_send {
+    bool busy;                    /* submitted, completion not yet seen */
+    zhe_address_t dst;
+    struct iovec iov;
+    struct msghdr msg;
+    uint8_t data[TRANSPORT_MTU];
+};
+
+/* A received packet, in provided buffer BID, taken from the completion queue while looking for
+   send completions */
+struct uring_rx {
+    uint16_t bid;
+    uint8_t sock;
+    int32_t res;
+};
+
+struct uring {
+    int fd;
+    unsigned nmaps;
+    void *maps[URING_MAXMAPS];
+    size_t mapsz[URING_MAXMAPS];
+    /* submission queue: SQTAIL is only published to the kernel by uring_enter */
+    unsigned sqentries;
+    unsigned sqtail;
+    unsigned *ksqhead, *ksqtail, *ksqmask, *ksqarray;
+    struct io_uring_sqe *sqes;
+    /* completion queue */
+    unsigned *kcqhead, *kcqtail, *kcqmask;
+    struct io_uring_cqe *cqes;
+    /* provided buffer ring feeding the multishot receives */
+    struct io_uring_buf_ring *br;
+    uint16_t brtail;
+    uint8_t *recvbufs;
+    struct msghdr recvhdr;        /* template for the multishot receives, only the lengths matter */
+    bool armed[2];                /* multishot receive active on socket */
+    unsigned rxhead, rxtail;
+    struct uring_rx rxq[URING_NRECVBUFS];
+    unsigned nextsend;
+    struct uring_send sends[URING_NSENDS];
+};
+#endif
+
+#if USE_SHM
+#define SHM_MAGIC 0x7a686501u  /* "zhe" + layout version */
+#define SHM_RINGSLOTS 64       /* packets per ring, a power of 2 */
+#define SHM_CACHELINE 64
+
+struct shm_pkt {
+    uint32_t size;
+    uint8_t data[TRANSPORT_MTU];
+};
+
+/* Packets from one slot to another: HEAD is only written by the receiver, TAIL by the sender */
+struct shm_ring {
+    uint32_t head;
+    uint8_t pad0[SHM_CACHELINE - sizeof(uint32_t)];
+    uint32_t tail;
+    uint8_t pad1[SHM_CACHELINE - sizeof(uint32_t)];
+    struct shm_pkt pkt[SHM_RINGSLOTS];
+};
+
+struct shm_peer {
+    int32_t pid;                  /* owner of the slot, 0 if free */
+    uint32_t sleeping;            /* owner is (about to be) blocked in a futex wait on WAKE */
+    uint32_t wake;                /* futex, incremented by a sender that finds the owner sleeping */
+    uint8_t pad[SHM_CACHELINE - 3 * sizeof(uint32_t)];
+};
+
+/* An all-zero segment is a valid, empty one, so whoever attaches first needn't initialise it */
+struct shm_seg {
+    uint32_t magic;
+    uint8_t pad[SHM_CACHELINE - sizeof(uint32_t)];
+    struct shm_peer peers[ZHE_SHM_MAXPEERS];
+    struct shm_ring rings[ZHE_SHM_MAXPEERS][ZHE_SHM_MAXPEERS]; /* [from][to] */
+};
+#endif
 
 struct udp {
     int s[2];
     int next;
+    bool mesh;                    /* in-memory mode */
+    unsigned nmesh;               /* in-memory mode: number of peers in meshfd/meshport */
+    unsigned meshnext;            /* in-memory mode: index of next socket to try receiving from */
+    int meshfd[MAX_MESH];         /* in-memory mode: socket connected to peer, -1 once it is gone */
+    uint16_t meshport[MAX_MESH];  /* in-memory mode: port of peer (network byte order) */
     uint16_t port;
     uint16_t ucport;
     size_t nself;
@@ -38,6 +184,23 @@ struct udp {
 #if SIMUL_PACKET_LOSS
     long randomthreshold;
 #endif
+#if PACKET_CAPTURE
+    FILE *capture;
+#endif
+#if USE_UDP_GSO
+    bool gso;                     /* false: in-memory mode or the kernel refused UDP_SEGMENT */
+    struct gso_out gsoout;
+    struct gro_in groin;
+#endif
+#if USE_IO_URING
+    bool uring;                   /* false: in-memory mode or io_uring setup failed */
+    struct uring ring;
+#endif
+#if USE_SHM
+    struct shm_seg *shm;          /* shared-memory mode if not NULL */
+    unsigned shmself;             /* shared-memory mode: own slot */
+    unsigned shmnext;             /* shared-memory mode: index of next slot to try receiving from */
+#endif
 };
 
 static struct udp gudp;
@@ -70,6 +233,222 @@ static void set_nonblock(int sock)
     (void)fcntl(sock, F_SETFL, flags);
 }
 
+#if USE_IO_URING
+static void *uring_map(struct uring *u, size_t size, int flags, int fd, off_t off)
+{
+    void *p;
+    zhe_assert(u->nmaps < URING_MAXMAPS);
+    if ((p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, off)) == MAP_FAILED) {
+        return NULL;
+    }
+    u->maps[u->nmaps] = p;
+    u->mapsz[u->nmaps] = size;
+    u->nmaps++;
+    return p;
+}
+
+/* Publishes the queued submissions and enters the kernel to submit them (and, depending on
+   FLAGS, to wait for WAITNR completions) */
+static int uring_enter(struct uring *u, unsigned waitnr, unsigned flags, const void *arg, size_t argsz)
+{
+    const unsigned n = u->sqtail - __atomic_load_n(u->ksqhead, __ATOMIC_ACQUIRE);
+    __atomic_store_n(u->ksqtail, u->sqtail, __ATOMIC_RELEASE);
+    return (int)syscall(__NR_io_uring_enter, u->fd, n, waitnr, flags, arg, argsz);
+}
+
+static void uring_submit(struct uring *u)
+{
+    if (u->sqtail != __atomic_load_n(u->ksqhead, __ATOMIC_ACQUIRE)) {
+        (void)uring_enter(u, 0, 0, NULL, 0);
+    }
+}
+
+static struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+    if (u->sqtail - __atomic_load_n(u->ksqhead, __ATOMIC_ACQUIRE) == u->sqentries) {
+        uring_submit(u);
+        if (u->sqtail - __atomic_load_n(u->ksqhead, __ATOMIC_ACQUIRE) == u->sqentries) {
+            return NULL;
+        }
+    }
+    idx = u->sqtail & *u->ksqmask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->ksqarray[idx] = idx;
+    u->sqtail++;
+    return sqe;
+}
+
+static bool uring_arm_recv(struct uring *u, unsigned k, int sock)
+{
+    struct io_uring_sqe * const sqe = uring_sqe(u);
+    if (sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sock;
+    sqe->addr = (uintptr_t)&u->recvhdr;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_UD_RECV + k;
+    return true;
+}
+
+static void uring_recycle(struct uring *u, uint16_t bid)
+{
+    struct io_uring_buf * const b = &u->br->bufs[u->brtail & (URING_NRECVBUFS - 1)];
+    b->addr = (uintptr_t)(u->recvbufs + bid * URING_RECVBUF_SIZE);
+    b->len = (uint32_t)URING_RECVBUF_SIZE;
+    b->bid = bid;
+    u->brtail++;
+    __atomic_store_n(&u->br->tail, u->brtail, __ATOMIC_RELEASE);
+}
+
+/* Consumes all completions: finished sends free their slot, received packets are moved to RXQ
+   (which can't overflow because each one holds one of the URING_NRECVBUFS buffers) and
+   multishot receives the kernel terminated (e.g., because it ran out of buffers) are re-armed */
+static void uring_reap(struct udp *udp)
+{
+    struct uring * const u = &udp->ring;
+    unsigned head = *u->kcqhead;
+    const unsigned tail = __atomic_load_n(u->kcqtail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe * const cqe = &u->cqes[head & *u->kcqmask];
+        if (cqe->user_data < URING_UD_RECV) {
+            u->sends[cqe->user_data].busy = false;
+            if (cqe->res < 0) {
+                ZT(TRANSPORT, "send failed (%d)", -cqe->res);
+            }
+        } else {
+            const unsigned k = (unsigned)(cqe->user_data - URING_UD_RECV);
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                u->armed[k] = false;
+            }
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                struct uring_rx * const rx = &u->rxq[u->rxtail++ % URING_NRECVBUFS];
+                rx->bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                rx->sock = (uint8_t)k;
+                rx->res = cqe->res;
+            } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                ZT(TRANSPORT, "recv[%u] failed (%d)", k, -cqe->res);
+            }
+        }
+        head++;
+    }
+    __atomic_store_n(u->kcqhead, head, __ATOMIC_RELEASE);
+    for (unsigned k = 0; k < 2; k++) {
+        if (!u->armed[k]) {
+            u->armed[k] = uring_arm_recv(u, k, udp->s[k]);
+        }
+    }
+}
+
+static bool uring_idle(struct uring *u)
+{
+    return u->rxhead == u->rxtail && *u->kcqhead == __atomic_load_n(u->kcqtail, __ATOMIC_ACQUIRE);
+}
+
+static bool uring_init(struct udp *udp)
+{
+    struct uring * const u = &udp->ring;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    size_t sqsz, cqsz;
+    uint8_t *sq, *cq;
+    u->nmaps = 0;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = 2 * (URING_NRECVBUFS + URING_NSENDS);
+    if ((u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) == -1) {
+        ZT(TRANSPORT, "io_uring_setup failed (%d)", errno);
+        return false;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        ZT(TRANSPORT, "io_uring lacks IORING_FEAT_EXT_ARG");
+        goto err;
+    }
+    sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sqsz = cqsz = (sqsz > cqsz) ? sqsz : cqsz;
+    }
+    if ((sq = uring_map(u, sqsz, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING)) == NULL) {
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else if ((cq = uring_map(u, cqsz, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING)) == NULL) {
+        goto err;
+    }
+    if ((u->sqes = uring_map(u, p.sq_entries * sizeof(struct io_uring_sqe), MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES)) == NULL) {
+        goto err;
+    }
+    u->sqentries = p.sq_entries;
+    u->ksqhead = (unsigned *)(sq + p.sq_off.head);
+    u->ksqtail = (unsigned *)(sq + p.sq_off.tail);
+    u->ksqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->ksqarray = (unsigned *)(sq + p.sq_off.array);
+    u->sqtail = *u->ksqtail;
+    u->kcqhead = (unsigned *)(cq + p.cq_off.head);
+    u->kcqtail = (unsigned *)(cq + p.cq_off.tail);
+    u->kcqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* the buffer ring must be page-aligned, anonymous mappings are zero-filled and so start out
+       with a tail of 0 */
+    if ((u->br = uring_map(u, URING_NRECVBUFS * sizeof(struct io_uring_buf), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == NULL ||
+        (u->recvbufs = uring_map(u, URING_NRECVBUFS * URING_RECVBUF_SIZE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == NULL) {
+        goto err;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)u->br;
+    reg.ring_entries = URING_NRECVBUFS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        ZT(TRANSPORT, "IORING_REGISTER_PBUF_RING failed (%d)", errno);
+        goto err;
+    }
+    u->brtail = 0;
+    for (uint16_t bid = 0; bid < URING_NRECVBUFS; bid++) {
+        uring_recycle(u, bid);
+    }
+    memset(&u->recvhdr, 0, sizeof(u->recvhdr));
+    u->recvhdr.msg_namelen = sizeof(struct sockaddr_in);
+    u->rxhead = u->rxtail = 0;
+    u->nextsend = 0;
+    for (unsigned i = 0; i < URING_NSENDS; i++) {
+        u->sends[i].busy = false;
+    }
+    for (unsigned k = 0; k < 2; k++) {
+        u->armed[k] = uring_arm_recv(u, k, udp->s[k]);
+    }
+    if (uring_enter(u, 0, 0, NULL, 0) == -1) {
+        ZT(TRANSPORT, "io_uring_enter failed (%d)", errno);
+        goto err;
+    }
+    /* a kernel that doesn't support multishot receives fails them right away */
+    for (unsigned head = *u->kcqhead; head != __atomic_load_n(u->kcqtail, __ATOMIC_ACQUIRE); head++) {
+        const struct io_uring_cqe * const cqe = &u->cqes[head & *u->kcqmask];
+        if (cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+            ZT(TRANSPORT, "multishot recvmsg failed (%d)", -cqe->res);
+            goto err;
+        }
+    }
+    return true;
+
+err:
+    close(u->fd);
+    while (u->nmaps > 0) {
+        u->nmaps--;
+        (void)munmap(u->maps[u->nmaps], u->mapsz[u->nmaps]);
+    }
+    return false;
+}
+#endif
+
 struct zhe_platform *zhe_platform_new(uint16_t port, int drop_pct)
 {
     const int one = 1;
@@ -86,6 +465,14 @@ struct zhe_platform *zhe_platform_new(uint16_t port, int drop_pct)
 #endif
 
     udp->port = htons(port);
+    udp->mesh = false;
+    udp->nmesh = 0;
+#if USE_SHM
+    udp->shm = NULL;
+#endif
+#if PACKET_CAPTURE
+    udp->capture = NULL;
+#endif
 
     /* Get own IP addresses so we know what to filter out -- disabling MC loopback would help if
        we knew there was only a single proces on a node, but I actually want to run multiple for
@@ -127,7 +514,17 @@ struct zhe_platform *zhe_platform_new(uint16_t port, int drop_pct)
             return NULL;
         }
         set_nonblock(udp->s[i]);
+#if USE_UDP_GSO
+        /* if the kernel doesn't support it, received packets simply don't get coalesced */
+        (void)setsockopt(udp->s[i], SOL_UDP, UDP_GRO, (char *)&one, sizeof(one));
+#endif
     }
+#if USE_UDP_GSO
+    /* whether UDP_SEGMENT works only becomes clear when sending */
+    udp->gso = true;
+    udp->gsoout.nsegs = 0;
+    udp->groin.pos = udp->groin.lim = 0;
+#endif
 
     /* UC socket gets bound to random port number, INADDR_ANY -- the recipients will find the
        the source address in the incoming packets & use that to reply */
@@ -163,6 +560,9 @@ struct zhe_platform *zhe_platform_new(uint16_t port, int drop_pct)
         perror("bind[1]");
         goto err;
     }
+#if USE_IO_URING
+    udp->uring = uring_init(udp);
+#endif
     return (struct zhe_platform *)udp;
 
 err:
@@ -172,6 +572,218 @@ err:
     return NULL;
 }
 
+struct zhe_platform *zhe_platform_new_mesh(uint16_t port, unsigned npeers, const int *fds, const uint16_t *peerports, int drop_pct)
+{
+    struct udp * const udp = &gudp;
+
+    if (npeers > MAX_MESH) {
+        return NULL;
+    }
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &toffset);
+    toffset.tv_sec -= toffset.tv_sec % 10000;
+
+#if SIMUL_PACKET_LOSS
+    udp->randomthreshold = drop_pct * 21474836;
+#endif
+
+    /* There is no IP stack involved, but zhe still needs addresses: this node pretends to be
+       127.0.0.1:PORT, the peers 127.0.0.1:PEERPORTS[i], and packets sent to a multicast address
+       go to all peers (and with no peers at all, everything sent is lost) */
+    udp->s[0] = udp->s[1] = -1;
+    udp->next = 0;
+    udp->port = htons(port);
+    udp->ucport = htons(port);
+    udp->nself = 1;
+    udp->self[0] = htonl(INADDR_LOOPBACK);
+#if PACKET_CAPTURE
+    udp->capture = NULL;
+#endif
+#if USE_UDP_GSO
+    udp->gso = false;
+    udp->gsoout.nsegs = 0;
+    udp->groin.pos = udp->groin.lim = 0;
+#endif
+#if USE_IO_URING
+    udp->uring = false;
+#endif
+#if USE_SHM
+    udp->shm = NULL;
+#endif
+    udp->mesh = true;
+    udp->nmesh = npeers;
+    udp->meshnext = 0;
+    for (unsigned i = 0; i < npeers; i++) {
+        set_nonblock(fds[i]);
+        udp->meshfd[i] = fds[i];
+        udp->meshport[i] = htons(peerports[i]);
+    }
+    return (struct zhe_platform *)udp;
+}
+
+#if USE_SHM
+static bool shm_claim(struct udp *udp)
+{
+    struct shm_seg * const seg = udp->shm;
+    const int32_t self = (int32_t)getpid();
+    for (unsigned i = 0; i < ZHE_SHM_MAXPEERS; i++) {
+        int32_t pid = __atomic_load_n(&seg->peers[i].pid, __ATOMIC_ACQUIRE);
+        if (pid != 0 && (kill((pid_t)pid, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&seg->peers[i].pid, &pid, self, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* whatever was sent to the previous owner is of no interest */
+            for (unsigned k = 0; k < ZHE_SHM_MAXPEERS; k++) {
+                struct shm_ring * const r = &seg->rings[k][i];
+                __atomic_store_n(&r->head, __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(&seg->peers[i].sleeping, 0, __ATOMIC_RELAXED);
+            udp->shmself = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct zhe_platform *zhe_platform_new_shm(uint16_t port, const char *name, int drop_pct)
+{
+    struct udp * const udp = &gudp;
+    struct stat st;
+    uint32_t magic = 0;
+    void *seg;
+    int fd;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &toffset);
+    toffset.tv_sec -= toffset.tv_sec % 10000;
+
+#if SIMUL_PACKET_LOSS
+    udp->randomthreshold = drop_pct * 21474836;
+#endif
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT, 0600)) == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+    /* concurrent creators all extend it to the same size, and the new bytes are zero */
+    if (fstat(fd, &st) == -1 || (st.st_size == 0 && ftruncate(fd, sizeof(struct shm_seg)) == -1)) {
+        perror(name);
+        close(fd);
+        return NULL;
+    } else if (st.st_size != 0 && st.st_size != sizeof(struct shm_seg)) {
+        fprintf(stderr, "%s: size mismatch\n", name);
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(struct shm_seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    udp->shm = seg;
+    if (!__atomic_compare_exchange_n(&udp->shm->magic, &magic, SHM_MAGIC, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && magic != SHM_MAGIC) {
+        fprintf(stderr, "%s: not a zhe segment\n", name);
+        goto err;
+    }
+    if (!shm_claim(udp)) {
+        fprintf(stderr, "%s: no free slot\n", name);
+        goto err;
+    }
+
+    udp->s[0] = udp->s[1] = -1;
+    udp->next = 0;
+    udp->port = htons(port);
+    udp->ucport = htons((uint16_t)(udp->shmself + 1));
+    udp->nself = 1;
+    udp->self[0] = htonl(INADDR_LOOPBACK);
+#if PACKET_CAPTURE
+    udp->capture = NULL;
+#endif
+#if USE_UDP_GSO
+    udp->gso = false;
+    udp->gsoout.nsegs = 0;
+    udp->groin.pos = udp->groin.lim = 0;
+#endif
+#if USE_IO_URING
+    udp->uring = false;
+#endif
+    udp->mesh = false;
+    udp->nmesh = 0;
+    udp->shmnext = 0;
+    return (struct zhe_platform *)udp;
+
+err:
+    (void)munmap(udp->shm, sizeof(struct shm_seg));
+    udp->shm = NULL;
+    return NULL;
+}
+#endif
+
+#if PACKET_CAPTURE
+static void put_u16(uint8_t *p, uint16_t x)
+{
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t x)
+{
+    put_u16(p, (uint16_t)x);
+    put_u16(p + 2, (uint16_t)(x >> 16));
+}
+
+int zhe_platform_capture(struct zhe_platform *pf, const char *path, const void *id, size_t idlen)
+{
+    struct udp * const udp = (struct udp *)pf;
+    uint8_t hdr[12];
+    if (idlen > 255 || udp->capture != NULL || (udp->capture = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    memcpy(hdr, "ZCAP", 4);
+    hdr[4] = ZHE_CAPTURE_VERSION;
+    hdr[5] = (uint8_t)idlen;
+    put_u16(hdr + 6, 0);
+    put_u32(hdr + 8, ZHE_TIMEBASE);
+    if (fwrite(hdr, sizeof(hdr), 1, udp->capture) != 1 || (idlen > 0 && fwrite(id, idlen, 1, udp->capture) != 1)) {
+        fclose(udp->capture);
+        udp->capture = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void zhe_platform_capture_close(struct zhe_platform *pf)
+{
+    struct udp * const udp = (struct udp *)pf;
+    if (udp->capture != NULL) {
+        fclose(udp->capture);
+        udp->capture = NULL;
+    }
+}
+
+static void capture_record(struct udp *udp, uint8_t kind, const void * restrict buf, size_t size, const zhe_address_t * restrict addr)
+{
+    /* Errors are ignored: a capture is a debugging aid, and a truncated one is still useful */
+    uint8_t hdr[ZHE_CAPTURE_RECHDR_SIZE];
+    hdr[0] = kind;
+    put_u16(hdr + 1, (uint16_t)size);
+    put_u32(hdr + 3, (uint32_t)zhe_platform_time());
+    memcpy(hdr + 7, &addr->a.sin_addr.s_addr, 4);
+    memcpy(hdr + 11, &addr->a.sin_port, 2);
+    (void)fwrite(hdr, sizeof(hdr), 1, udp->capture);
+    (void)fwrite(buf, size, 1, udp->capture);
+}
+#else
+int zhe_platform_capture(struct zhe_platform *pf, const char *path, const void *id, size_t idlen)
+{
+    return -1;
+}
+
+void zhe_platform_capture_close(struct zhe_platform *pf)
+{
+}
+#endif
+
 static char *uint16_to_string(char * restrict str, uint16_t val)
 {
     if (val == 0) {
@@ -262,6 +874,14 @@ int zhe_platform_join(const struct zhe_platform *pf, const struct zhe_address *a
 {
     struct udp *udp = (struct udp *)pf;
     struct ip_mreq mreq;
+    if (udp->mesh) {
+        return 1;
+    }
+#if USE_SHM
+    if (udp->shm != NULL) {
+        return 1;
+    }
+#endif
     mreq.imr_multiaddr = addr->a.sin_addr;
     mreq.imr_interface.s_addr = htonl(INADDR_ANY);
     if (setsockopt(udp->s[1], IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&mreq, sizeof(mreq)) == -1) {
@@ -289,20 +909,315 @@ static void wait_send(int sock)
 }
 #endif
 
-int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+static ssize_t mesh_send1(struct udp *udp, unsigned i, const void * restrict buf, size_t size)
 {
-    struct udp *udp = (struct udp *)pf;
     ssize_t ret;
-    zhe_assert(size <= TRANSPORT_MTU);
+    if (udp->meshfd[i] < 0) {
+        /* peer is gone: just like UDP, sending to it silently succeeds */
+        return (ssize_t)size;
+    }
 #if SIMUL_PACKET_LOSS
     if (udp->randomthreshold && random() < udp->randomthreshold) {
-        return (int)size;
+        return (ssize_t)size;
     }
 #endif
+    ret = send(udp->meshfd[i], buf, size, MSG_NOSIGNAL);
+    if (ret == -1 && (errno == EPIPE || errno == ECONNRESET)) {
+        return (ssize_t)size;
+    }
+    return ret;
+}
+
+static ssize_t mesh_send(struct udp *udp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    if (IN_MULTICAST(ntohl(dst->a.sin_addr.s_addr))) {
+        /* Each peer receives a multicast independently (a full socket buffer at one of them
+           is a loss for that peer only), the packet itself always counts as sent */
+        for (unsigned i = 0; i < udp->nmesh; i++) {
+            (void)mesh_send1(udp, i, buf, size);
+        }
+        return (ssize_t)size;
+    } else {
+        for (unsigned i = 0; i < udp->nmesh; i++) {
+            if (udp->meshport[i] == dst->a.sin_port) {
+                return mesh_send1(udp, i, buf, size);
+            }
+        }
+        return (ssize_t)size;
+    }
+}
+
+#if USE_SHM
+static ssize_t shm_send1(struct udp *udp, unsigned i, const void * restrict buf, size_t size)
+{
+    struct shm_seg * const seg = udp->shm;
+    struct shm_ring * const r = &seg->rings[udp->shmself][i];
+    struct shm_peer * const peer = &seg->peers[i];
+    const uint32_t tail = r->tail;
+    struct shm_pkt *pkt;
+#if SIMUL_PACKET_LOSS
+    if (udp->randomthreshold && random() < udp->randomthreshold) {
+        return (ssize_t)size;
+    }
+#endif
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == SHM_RINGSLOTS) {
+        errno = EAGAIN;
+        return -1;
+    }
+    pkt = &r->pkt[tail % SHM_RINGSLOTS];
+    pkt->size = (uint32_t)size;
+    memcpy(pkt->data, buf, size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    /* pairs with the fence in shm_wait: either the receiver sees the packet before going to
+       sleep, or this sees that it is sleeping */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&peer->sleeping, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&peer->wake, 1, __ATOMIC_RELEASE);
+        (void)syscall(SYS_futex, &peer->wake, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+    return (ssize_t)size;
+}
+
+static ssize_t shm_send(struct udp *udp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    struct shm_seg * const seg = udp->shm;
+    if (IN_MULTICAST(ntohl(dst->a.sin_addr.s_addr))) {
+        /* as for the in-memory transport, a full ring is a loss for that peer only */
+        for (unsigned i = 0; i < ZHE_SHM_MAXPEERS; i++) {
+            if (i != udp->shmself && __atomic_load_n(&seg->peers[i].pid, __ATOMIC_RELAXED) != 0) {
+                (void)shm_send1(udp, i, buf, size);
+            }
+        }
+        return (ssize_t)size;
+    } else {
+        const unsigned i = (unsigned)ntohs(dst->a.sin_port) - 1;
+        if (i < ZHE_SHM_MAXPEERS && i != udp->shmself && __atomic_load_n(&seg->peers[i].pid, __ATOMIC_RELAXED) != 0) {
+            return shm_send1(udp, i, buf, size);
+        }
+        return (ssize_t)size;
+    }
+}
+#endif
+
+static ssize_t udp_sendto(struct udp *udp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
 #if BLOCKING_SEND
     wait_send(udp->s[0]);
 #endif
-    ret = sendto(udp->s[0], buf, size, 0, (const struct sockaddr *)&dst->a, sizeof(dst->a));
+    return sendto(udp->s[0], buf, size, 0, (const struct sockaddr *)&dst->a, sizeof(dst->a));
+}
+
+#if USE_UDP_GSO
+static ssize_t gso_sendmsg(struct udp *udp)
+{
+    struct gso_out * const o = &udp->gsoout;
+    const uint16_t segsize = (uint16_t)o->segsize;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = o->buf;
+    iov.iov_len = o->len;
+    msg.msg_name = &o->dst.a;
+    msg.msg_namelen = sizeof(o->dst.a);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(segsize));
+    memcpy(CMSG_DATA(cm), &segsize, sizeof(segsize));
+#if BLOCKING_SEND
+    wait_send(udp->s[0]);
+#endif
+    return sendmsg(udp->s[0], &msg, 0);
+}
+
+/* Sends the collected packets; zhe_platform_send already reported success for each of them, so
+   failure to send them amounts to packet loss */
+static void gso_flush(struct udp *udp)
+{
+    struct gso_out * const o = &udp->gsoout;
+    ssize_t ret;
+    if (o->nsegs == 0) {
+        return;
+    } else if (o->nsegs == 1) {
+        ret = udp_sendto(udp, o->buf, o->len, &o->dst);
+    } else if ((ret = gso_sendmsg(udp)) == -1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+        /* no segmentation offload after all (old kernel, or a device that can't do it): send
+           these one by one and stop collecting packets */
+        ZT(TRANSPORT, "UDP_SEGMENT failed (%d), no longer using it", errno);
+        udp->gso = false;
+        for (size_t off = 0; off < o->len; off += o->segsize) {
+            const size_t n = (o->len - off < o->segsize) ? o->len - off : o->segsize;
+            ret = udp_sendto(udp, o->buf + off, n, &o->dst);
+        }
+    }
+    if (ret == -1) {
+        ZT(TRANSPORT, "send of %u packets failed (%d)", o->nsegs, errno);
+    } else {
+        ZT(TRANSPORT, "sent %u packets of %zu bytes", o->nsegs, o->segsize);
+    }
+    o->nsegs = 0;
+}
+
+static ssize_t gso_append(struct udp *udp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    struct gso_out * const o = &udp->gsoout;
+    if (o->nsegs > 0 && (o->closed || size > o->segsize || o->nsegs == GSO_MAXSEGS || o->len + size > GSO_MAXBYTES || !zhe_platform_addr_eq(dst, &o->dst))) {
+        gso_flush(udp);
+    }
+    if (o->nsegs == 0) {
+        o->dst = *dst;
+        o->segsize = size;
+        o->len = 0;
+    }
+    memcpy(o->buf + o->len, buf, size);
+    o->len += size;
+    o->nsegs++;
+    o->closed = (size < o->segsize);
+    return (ssize_t)size;
+}
+
+#endif
+
+#if USE_IO_URING
+/* Queues the packet for sending by zhe_platform_flush (or an earlier call to io_uring_enter) */
+static ssize_t uring_send(struct udp *udp, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    struct uring * const u = &udp->ring;
+    struct uring_send *s = NULL;
+    struct io_uring_sqe *sqe;
+    unsigned i;
+    if (u->sends[u->nextsend].busy) {
+        uring_reap(udp);
+    }
+    for (i = 0; i < URING_NSENDS; i++) {
+        if (!u->sends[(u->nextsend + i) % URING_NSENDS].busy) {
+            s = &u->sends[(u->nextsend + i) % URING_NSENDS];
+            break;
+        }
+    }
+    if (s == NULL || (sqe = uring_sqe(u)) == NULL) {
+        /* everything is in flight: equivalent to a full socket buffer */
+        uring_submit(u);
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(s->data, buf, size);
+    s->dst = *dst;
+    s->iov.iov_base = s->data;
+    s->iov.iov_len = size;
+    memset(&s->msg, 0, sizeof(s->msg));
+    s->msg.msg_name = &s->dst.a;
+    s->msg.msg_namelen = sizeof(s->dst.a);
+    s->msg.msg_iov = &s->iov;
+    s->msg.msg_iovlen = 1;
+    s->busy = true;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = udp->s[0];
+    sqe->addr = (uintptr_t)&s->msg;
+    sqe->user_data = (uint64_t)(s - u->sends);
+    u->nextsend = (unsigned)(s - u->sends + 1) % URING_NSENDS;
+    return (ssize_t)size;
+}
+
+static ssize_t uring_recv(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
+    struct uring * const u = &udp->ring;
+    const struct uring_rx *rx;
+    struct io_uring_recvmsg_out out;
+    const uint8_t *p, *payload;
+    size_t n;
+    if (u->rxhead == u->rxtail) {
+        uring_reap(udp);
+        if (u->rxhead == u->rxtail) {
+            /* let the kernel submit the re-armed receives and post what it has */
+            (void)uring_enter(u, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+            uring_reap(udp);
+            if (u->rxhead == u->rxtail) {
+                return 0;
+            }
+        }
+    }
+    rx = &u->rxq[u->rxhead++ % URING_NRECVBUFS];
+    p = u->recvbufs + rx->bid * URING_RECVBUF_SIZE;
+    memcpy(&out, p, sizeof(out));
+    payload = p + sizeof(out) + u->recvhdr.msg_namelen + u->recvhdr.msg_controllen;
+    n = ((size_t)rx->res > (size_t)(payload - p)) ? (size_t)rx->res - (size_t)(payload - p) : 0;
+    if (n > out.payloadlen) {
+        n = out.payloadlen;
+    }
+    memset(&src->a, 0, sizeof(src->a));
+    memcpy(&src->a, p + sizeof(out), (out.namelen < sizeof(src->a)) ? out.namelen : sizeof(src->a));
+    memcpy(buf, payload, (n < size) ? n : size);
+    uring_recycle(u, rx->bid);
+    udp->next = 1 - rx->sock;
+    return (ssize_t)((n < size) ? n : size);
+}
+
+static int uring_wait(struct udp *udp, zhe_timediff_t timeout)
+{
+    struct uring * const u = &udp->ring;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0) {
+        ts.tv_sec = ZTIME_TO_SECu32(timeout);
+        ts.tv_nsec = 1000000 * (long long)ZTIME_TO_MSECu32(timeout);
+        arg.ts = (uintptr_t)&ts;
+    }
+    (void)uring_enter(u, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return !uring_idle(u);
+}
+#endif
+
+#if TRANSPORT_BATCHING
+void zhe_platform_flush(struct zhe_platform *pf)
+{
+    struct udp * const udp = (struct udp *)pf;
+#if USE_IO_URING
+    if (udp->uring) {
+        uring_submit(&udp->ring);
+    }
+#else
+    gso_flush(udp);
+#endif
+}
+#endif
+
+int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t size, const zhe_address_t * restrict dst)
+{
+    struct udp *udp = (struct udp *)pf;
+    ssize_t ret;
+    zhe_assert(size <= TRANSPORT_MTU);
+    if (udp->mesh) {
+        ret = mesh_send(udp, buf, size, dst);
+#if USE_SHM
+    } else if (udp->shm != NULL) {
+        ret = shm_send(udp, buf, size, dst);
+#endif
+    } else {
+#if SIMUL_PACKET_LOSS
+        if (udp->randomthreshold && random() < udp->randomthreshold) {
+            return (int)size;
+        }
+#endif
+#if USE_UDP_GSO
+        ret = udp->gso ? gso_append(udp, buf, size, dst) : udp_sendto(udp, buf, size, dst);
+#elif USE_IO_URING
+        ret = udp->uring ? uring_send(udp, buf, size, dst) : udp_sendto(udp, buf, size, dst);
+#else
+        ret = udp_sendto(udp, buf, size, dst);
+#endif
+    }
     if (ret > 0) {
 #if ENABLE_TRACING
         if (ZTT(TRANSPORT)) {
@@ -310,6 +1225,11 @@ int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t
             zhe_platform_addr2string(pf, tmp, sizeof(tmp), dst);
             ZT(TRANSPORT, "send %zu to %s", ret, tmp);
         }
+#endif
+#if PACKET_CAPTURE
+        if (udp->capture != NULL) {
+            capture_record(udp, ZHE_CAPTURE_OUT, buf, (size_t)ret, dst);
+        }
 #endif
         return (int)ret;
     } else if (ret == -1 && (errno == EAGAIN || errno == ENOBUFS || errno == EHOSTDOWN || errno == EHOSTUNREACH)) {
@@ -319,16 +1239,179 @@ int zhe_platform_send(struct zhe_platform *pf, const void * restrict buf, size_t
     }
 }
 
-static ssize_t recv1(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+static ssize_t mesh_recv(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
+    for (unsigned k = 0; k < udp->nmesh; k++) {
+        const unsigned i = (udp->meshnext + k) % udp->nmesh;
+        ssize_t ret;
+        if (udp->meshfd[i] < 0) {
+            continue;
+        }
+        ret = recv(udp->meshfd[i], buf, size, 0);
+        if (ret > 0) {
+            memset(&src->a, 0, sizeof(src->a));
+            src->a.sin_family = AF_INET;
+            src->a.sin_port = udp->meshport[i];
+            src->a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            udp->meshnext = (i + 1) % udp->nmesh;
+            return ret;
+        } else if (ret == 0 || (errno != EAGAIN && errno != EINTR)) {
+            /* peer terminated: stop listening to it, zhe will notice it is gone when the
+               lease expires */
+            close(udp->meshfd[i]);
+            udp->meshfd[i] = -1;
+        }
+    }
+    return 0;
+}
+
+#if USE_SHM
+static bool shm_pending(const struct udp *udp)
+{
+    const struct shm_seg * const seg = udp->shm;
+    for (unsigned i = 0; i < ZHE_SHM_MAXPEERS; i++) {
+        const struct shm_ring * const r = &seg->rings[i][udp->shmself];
+        if (r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static ssize_t shm_recv(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
+    struct shm_seg * const seg = udp->shm;
+    for (unsigned k = 0; k < ZHE_SHM_MAXPEERS; k++) {
+        const unsigned i = (udp->shmnext + k) % ZHE_SHM_MAXPEERS;
+        struct shm_ring * const r = &seg->rings[i][udp->shmself];
+        const uint32_t head = r->head;
+        if (head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+            const struct shm_pkt * const pkt = &r->pkt[head % SHM_RINGSLOTS];
+            const size_t n = (pkt->size < size) ? pkt->size : size;
+            memcpy(buf, pkt->data, n);
+            __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+            memset(&src->a, 0, sizeof(src->a));
+            src->a.sin_family = AF_INET;
+            src->a.sin_port = htons((uint16_t)(i + 1));
+            src->a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            udp->shmnext = (i + 1) % ZHE_SHM_MAXPEERS;
+            return (ssize_t)n;
+        }
+    }
+    return 0;
+}
+
+static int shm_wait(struct udp *udp, zhe_timediff_t timeout)
 {
+    struct shm_peer * const self = &udp->shm->peers[udp->shmself];
+    struct timespec ts;
+    uint32_t wake;
+    __atomic_store_n(&self->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    wake = __atomic_load_n(&self->wake, __ATOMIC_ACQUIRE);
+    if (!shm_pending(udp)) {
+        if (timeout >= 0) {
+            ts.tv_sec = ZTIME_TO_SECu32(timeout);
+            ts.tv_nsec = 1000000 * (long)ZTIME_TO_MSECu32(timeout);
+        }
+        /* returns immediately if a sender incremented WAKE in the meantime */
+        (void)syscall(SYS_futex, &self->wake, FUTEX_WAIT, wake, (timeout < 0) ? NULL : &ts, NULL, 0);
+    }
+    __atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+    return shm_pending(udp);
+}
+#endif
+
+#if USE_UDP_GSO
+static ssize_t gro_next(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
+    struct gro_in * const g = &udp->groin;
+    size_t n = g->lim - g->pos;
+    if (n > g->segsize) {
+        n = g->segsize;
+    }
+    *src = g->src;
+    memcpy(buf, g->buf + g->pos, (n < size) ? n : size);
+    g->pos += n;
+    return (ssize_t)((n < size) ? n : size);
+}
+
+static ssize_t gro_recv(struct udp *udp, int sock)
+{
+    struct gro_in * const g = &udp->groin;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t ret;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = g->buf;
+    iov.iov_len = sizeof(g->buf);
+    msg.msg_name = &g->src.a;
+    msg.msg_namelen = sizeof(g->src.a);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if ((ret = recvmsg(sock, &msg, 0)) > 0) {
+        g->pos = 0;
+        g->lim = (size_t)ret;
+        g->segsize = (size_t)ret;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                int segsize;
+                memcpy(&segsize, CMSG_DATA(cm), sizeof(segsize));
+                if (segsize > 0) {
+                    g->segsize = (size_t)segsize;
+                }
+            }
+        }
+    }
+    return ret;
+}
+#endif
+
+static ssize_t recv_sock(struct udp *udp, int sock, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
+#if USE_UDP_GSO
+    const ssize_t ret = gro_recv(udp, sock);
+    return (ret > 0) ? gro_next(udp, buf, size, src) : ret;
+#else
     socklen_t srclen = sizeof(src->a);
+    return recvfrom(sock, buf, size, 0, (struct sockaddr *)&src->a, &srclen);
+#endif
+}
+
+static ssize_t recv1(struct udp *udp, void * restrict buf, size_t size, zhe_address_t * restrict src)
+{
     ssize_t ret;
-    ret = recvfrom(udp->s[udp->next], buf, size, 0, (struct sockaddr *)&src->a, &srclen);
+    if (udp->mesh) {
+        return mesh_recv(udp, buf, size, src);
+    }
+#if USE_SHM
+    if (udp->shm != NULL) {
+        return shm_recv(udp, buf, size, src);
+    }
+#endif
+#if USE_IO_URING
+    if (udp->uring) {
+        return uring_recv(udp, buf, size, src);
+    }
+#endif
+#if USE_UDP_GSO
+    if (udp->groin.pos < udp->groin.lim) {
+        /* remainder of a coalesced datagram */
+        return gro_next(udp, buf, size, src);
+    }
+#endif
+    ret = recv_sock(udp, udp->s[udp->next], buf, size, src);
     if (ret > 0) {
         udp->next = 1 - udp->next;
         return ret;
     } else if (ret == -1 && errno == EAGAIN) {
-        ret = recvfrom(udp->s[1 - udp->next], buf, size, 0, (struct sockaddr *)&src->a, &srclen);
+        ret = recv_sock(udp, udp->s[1 - udp->next], buf, size, src);
         if (ret > 0) {
             return ret;
         } else if (ret == -1 && errno == EAGAIN) {
@@ -362,6 +1445,11 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
             zhe_platform_addr2string(pf, tmp, sizeof(tmp), src);
             ZT(TRANSPORT, "recv[%d] %zu from %s", 1 - udp->next, ret, tmp);
         }
+#endif
+#if PACKET_CAPTURE
+        if (udp->capture != NULL && ret > 0) {
+            capture_record(udp, ZHE_CAPTURE_IN, buf->buf, (size_t)ret, src);
+        }
 #endif
         assert(ret < INT_MAX);
         return (int)ret;
@@ -394,6 +1482,42 @@ void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platfo
 {
     struct udp * const udp = (struct udp *)pf;
     FD_ZERO(&wi->rs);
+    wi->shouldwait = true;
+#if USE_UDP_GSO
+    /* not blocking while packets are waiting to be sent or returned */
+    gso_flush(udp);
+    if (udp->groin.pos < udp->groin.lim) {
+        wi->shouldwait = false;
+    }
+#endif
+#if USE_IO_URING || USE_SHM
+    wi->pf = pf;
+#endif
+#if USE_SHM
+    if (udp->shm != NULL) {
+        wi->shouldwait = !shm_pending(udp);
+        wi->maxfd = -1;
+        return;
+    }
+#endif
+#if USE_IO_URING
+    if (udp->uring) {
+        uring_submit(&udp->ring);
+        wi->shouldwait = uring_idle(&udp->ring);
+    }
+#endif
+    if (udp->mesh) {
+        wi->maxfd = -1;
+        for (unsigned i = 0; i < udp->nmesh; i++) {
+            if (udp->meshfd[i] >= 0) {
+                FD_SET(udp->meshfd[i], &wi->rs);
+                if (udp->meshfd[i] > wi->maxfd) {
+                    wi->maxfd = udp->meshfd[i];
+                }
+            }
+        }
+        return;
+    }
     FD_SET(udp->s[0], &wi->rs);
     FD_SET(udp->s[1], &wi->rs);
     wi->maxfd = (udp->s[0] > udp->s[1]) ? udp->s[0] : udp->s[1];
@@ -401,7 +1525,17 @@ void zhe_platform_wait_prep(zhe_platform_waitinfo_t *wi, const struct zhe_platfo
 
 int zhe_platform_wait_block(zhe_platform_waitinfo_t *wi, zhe_timediff_t timeout)
 {
-    if (timeout < 0) {
+    if (!wi->shouldwait) {
+        return 1;
+#if USE_SHM
+    } else if (((const struct udp *)wi->pf)->shm != NULL) {
+        return shm_wait((struct udp *)wi->pf, timeout);
+#endif
+#if USE_IO_URING
+    } else if (((const struct udp *)wi->pf)->uring) {
+        return uring_wait((struct udp *)wi->pf, timeout);
+#endif
+    } else if (timeout < 0) {
         return select(wi->maxfd+1, &wi->rs, NULL, NULL, NULL) > 0;
     } else {
         struct timeval tv;
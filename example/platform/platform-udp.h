@@ -12,6 +12,39 @@ extern "C" {
 #define TRANSPORT_MODE       TRANSPORT_PACKET
 #define TRANSPORT_ADDRSTRLEN (4 + INET_ADDRSTRLEN + 6) /* udp/IP:PORT -- udp/ is 4, colon is 1, PORT in [1,5] */
 
+/* On Linux, consecutive packets for the same destination are collected and handed to the kernel
+   in a single sendmsg using UDP generic segmentation offload (UDP_SEGMENT), and datagrams the
+   kernel coalesced on receipt (UDP_GRO) are split again before returning them one at a time.
+   Neither applies to the in-memory transport. */
+/* Alternatively (Linux 6.0 or later, selected with cmake -DURING=ON), the sockets are served by an
+   io_uring: a multishot recvmsg per socket fills buffers from a registered buffer ring, receiving
+   only consumes completions, and sends are queued as submissions that are handed to the kernel in
+   one io_uring_enter call by zhe_platform_flush. If setting up the ring fails, it falls back to
+   plain sendto/recvfrom. */
+#ifndef USE_IO_URING
+#  define USE_IO_URING 0
+#endif
+#ifndef USE_UDP_GSO
+#  if defined __linux__ && !USE_IO_URING
+#    define USE_UDP_GSO 1
+#  else
+#    define USE_UDP_GSO 0
+#  endif
+#endif
+#if USE_UDP_GSO && USE_IO_URING
+#  error "USE_UDP_GSO and USE_IO_URING are mutually exclusive"
+#endif
+#define TRANSPORT_BATCHING   (USE_UDP_GSO || USE_IO_URING)
+
+/* The shared-memory transport needs futexes, hence Linux */
+#ifndef USE_SHM
+#  ifdef __linux__
+#    define USE_SHM 1
+#  else
+#    define USE_SHM 0
+#  endif
+#endif
+
 typedef struct zhe_address {
     struct sockaddr_in a;
 } zhe_address_t;
@@ -22,6 +55,39 @@ typedef struct zhe_recvbuf {
 
 zhe_time_t zhe_platform_time(void);
 struct zhe_platform *zhe_platform_new(uint16_t port, int drop_pct);
+/* In-memory transport for testing and benchmarking a set of nodes (processes) on one machine
+   without involving the IP stack: FDS[i] is one end of a socketpair(AF_UNIX, SOCK_SEQPACKET), the
+   other end of which belongs to the peer with port PEERPORTS[i]; with NPEERS = 0 it is an
+   isolated node that can only be fed by calling zhe_input directly */
+struct zhe_platform *zhe_platform_new_mesh(uint16_t port, unsigned npeers, const int *fds, const uint16_t *peerports, int drop_pct);
+#if USE_SHM
+/* Shared-memory transport for nodes (processes) on one host: all nodes attaching to the POSIX
+   shared memory object NAME (e.g., "/zhe", created if it doesn't exist yet) find each other in
+   it, each claiming one of ZHE_SHM_MAXPEERS slots. A node's address is 127.0.0.1:(slot + 1),
+   packets sent to a multicast address go to all other nodes, and packets travel through
+   single-producer, single-consumer rings between each pair of slots, so that no system calls
+   are involved unless the receiving node is blocked in zhe_platform_wait. The slot of a node
+   that terminated is reclaimed by the next one to attach. Remove NAME with shm_unlink when it
+   is no longer needed. */
+#define ZHE_SHM_MAXPEERS 8
+struct zhe_platform *zhe_platform_new_shm(uint16_t port, const char *name, int drop_pct);
+#endif
+/* Packet capture: records every packet returned by zhe_platform_recv (that is, every packet
+   about to be passed to zhe_input) with its source address and every packet sent with its
+   destination address. ID is the node's id, needed for replaying it (see example/replay). The
+   format of the file is (all integers little-endian):
+
+     header: "ZCAP" version:u8 idlen:u8 0:u16 timebase:u32 id:idlen
+     record: kind:u8 size:u16 t:u32 ipaddr:4 port:2 data:size
+
+   with kind ZHE_CAPTURE_IN or ZHE_CAPTURE_OUT, t the low 32 bits of zhe_platform_time(), and the
+   IPv4 address and port in network byte order. */
+#define ZHE_CAPTURE_VERSION 1
+#define ZHE_CAPTURE_IN 0
+#define ZHE_CAPTURE_OUT 1
+#define ZHE_CAPTURE_RECHDR_SIZE 13
+int zhe_platform_capture(struct zhe_platform *pf, const char *path, const void *id, size_t idlen);
+void zhe_platform_capture_close(struct zhe_platform *pf);
 int zhe_platform_string2addr(const struct zhe_platform *pf, struct zhe_address *addr, const char *str);
 int zhe_platform_join(const struct zhe_platform *pf, const struct zhe_address *addr);
 int zhe_platform_wait(const struct zhe_platform *pf, zhe_timediff_t timeout);
@@ -29,6 +95,10 @@ int zhe_platform_recv(struct zhe_platform *pf, zhe_recvbuf_t *buf, zhe_address_t
 #define zhe_platform_advance(pf_,src_,cnt_) ((void)(cnt_))
 
 typedef struct zhe_platform_waitinfo {
+    bool shouldwait;
+#if USE_IO_URING || USE_SHM
+    const struct zhe_platform *pf;
+#endif
     int maxfd;
     fd_set rs;
 } zhe_platform_waitinfo_t;
@@ -194,3 +194,30 @@ void cfg_handle_addrs(struct zhe_config *cfg, struct zhe_platform *platform, con
     }
     free(str);
 }
+
+#if ENABLE_TRACING && TRACE_RING_SIZE > 0
+static void dump_trace_ring_write(void *arg, const void *buf, size_t sz)
+{
+    (void)fwrite(buf, sz, 1, (FILE *)arg);
+}
+#endif
+
+int dump_trace_ring(const char *path)
+{
+#if ENABLE_TRACING && TRACE_RING_SIZE > 0
+    FILE *fp;
+    if ((fp = fopen(path, "wb")) == NULL) {
+        perror(path);
+        return -1;
+    }
+    zhe_trace_ring_dump(dump_trace_ring_write, fp);
+    if (fclose(fp) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "%s: not written, binary tracing not configured\n", path);
+    return -1;
+#endif
+}
@@ -10,5 +10,6 @@ void zhe_loop(struct zhe_platform *platform, uint64_t period);
 zhe_paysize_t getrandomid(unsigned char *ownid, size_t ownidsize);
 zhe_paysize_t getidfromarg(unsigned char *ownid, size_t ownidsize, const char *in);
 void cfg_handle_addrs(struct zhe_config *cfg, struct zhe_platform *platform, const char *scoutaddrstr, const char *mcgroups_join_str, const char *mconduit_dstaddrs_str);
+int dump_trace_ring(const char *path);
 
 #endif
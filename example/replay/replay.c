@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "platform-udp.h"
+#include "zhe.h"
+#include "zhe-tracing.h"
+#include "zhe-assert.h"
+
+#include "zhe-config-deriv.h"
+
+#include "zhe-util.h"
+
+/* Replays the incoming packets in a capture written by zhe_platform_capture into zhe_input, using
+   the node id from the capture and virtual time derived from the capture timestamps, as fast as
+   possible.  The node is isolated (everything it sends is dropped), so only the processing of the
+   input (parsing, delivering, generating ACKs, &c.) is reproduced, not what the application did;
+   that makes it useful for profiling the input path on real traffic and for comparing builds on
+   identical input. */
+
+#define MAX_LIST 64
+
+static uint64_t delivered, delivered_bytes;
+
+static void fail(const char *msg)
+{
+    fprintf(stderr, "replay: %s\n", msg);
+    exit(1);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *fp;
+    uint8_t *buf = NULL;
+    size_t n = 0, cap = 0, r;
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    do {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 65536;
+            if ((buf = realloc(buf, cap)) == NULL) {
+                fail("out of memory");
+            }
+        }
+        r = fread(buf + n, 1, cap - n, fp);
+        n += r;
+    } while (r > 0);
+    fclose(fp);
+    *size = n;
+    return buf;
+}
+
+static void handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg)
+{
+    delivered++;
+    delivered_bytes += size;
+}
+
+static uint64_t gethrtime(void)
+{
+    struct timespec t;
+    (void)clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (unsigned)t.tv_nsec;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [OPTIONS] CAPTURE\n\
+\n\
+-s SUBS     comma-separated subscriptions, each RID or RID=URI (default none)\n\
+-S ADDR     scout address (default 239.255.0.1)\n\
+-G ADDRS    multicast groups to join (default 239.255.0.2)\n\
+-M ADDRS    multicast conduit destination addresses (default 239.255.0.2)\n\
+-q          no tracing\n\
+\n\
+The addressing options should match those of the node that wrote the capture. Resources\n\
+that the peers declared with a URI must be subscribed to as RID=URI with the same URI. Writes\n\
+a single line of KEY=VALUE pairs to stdout.\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char * const *argv)
+{
+    const char *scoutaddrstr = "239.255.0.1";
+    char *mcgroups_join_str = "239.255.0.2"; /* in addition to scout */
+    char *mconduit_dstaddrs_str = "239.255.0.2";
+    unsigned long rids[MAX_LIST];
+    char *uris[MAX_LIST];
+    unsigned nrids = 0;
+    struct zhe_config cfg;
+    size_t capsize, off;
+    uint8_t *cap;
+    int opt;
+
+#if ENABLE_TRACING
+    zhe_trace_cats = ZTCAT_ERROR | ZTCAT_PEERDISC;
+#endif
+    while ((opt = getopt(argc, argv, "G:M:qS:s:")) != EOF) {
+        switch (opt) {
+            case 's': {
+                char *copy = strdup(optarg), *tok, *end;
+                nrids = 0;
+                for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+                    rids[nrids] = strtoul(tok, &end, 0);
+                    uris[nrids] = (*end == '=') ? end + 1 : NULL;
+                    if (*tok == 0 || (*end != 0 && *end != '=') || rids[nrids] == 0 || rids[nrids] > ZHE_MAX_RID || ++nrids == MAX_LIST) {
+                        usage(argv[0]);
+                    }
+#if ZHE_MAX_URISPACE == 0
+                    if (uris[nrids - 1] != NULL) {
+                        fail("URIs not supported in this configuration");
+                    }
+#endif
+                }
+                break;
+            }
+            case 'S': scoutaddrstr = optarg; break;
+            case 'G': mcgroups_join_str = optarg; break;
+            case 'M': mconduit_dstaddrs_str = optarg; break;
+            case 'q':
+#if ENABLE_TRACING
+                zhe_trace_cats = 0;
+#endif
+                break;
+            default: usage(argv[0]); break;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    cap = read_file(argv[optind], &capsize);
+    if (capsize < 12 || memcmp(cap, "ZCAP", 4) != 0 || cap[4] != ZHE_CAPTURE_VERSION) {
+        fail("not a version 1 zhe capture");
+    } else if (get_u32(cap + 8) != ZHE_TIMEBASE) {
+        fail("capture time base differs from ZHE_TIMEBASE");
+    } else if (capsize < 12 + (size_t)cap[5]) {
+        fail("truncated header");
+    }
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.id = cap + 12;
+    cfg.idlen = cap[5];
+    off = 12 + (size_t)cap[5];
+
+    /* Time starts at the first record so that leases &c. behave as they did when capturing */
+    uint32_t tprev = (capsize >= off + ZHE_CAPTURE_RECHDR_SIZE) ? get_u32(cap + off + 3) : 0;
+    zhe_time_t tnow = (zhe_time_t)tprev;
+
+    struct zhe_platform * const platform = zhe_platform_new_mesh(7447, 0, NULL, NULL, 0);
+    if (platform == NULL) {
+        fail("platform initialization failed");
+    }
+    cfg_handle_addrs(&cfg, platform, scoutaddrstr, mcgroups_join_str, mconduit_dstaddrs_str);
+    if (zhe_init(&cfg, platform, tnow) < 0) {
+        fail("init failed");
+    }
+    zhe_start(tnow);
+    for (unsigned i = 0; i < nrids; i++) {
+#if ZHE_MAX_URISPACE > 0
+        if (uris[i] != NULL) {
+            zhe_declare_resource((zhe_rid_t)rids[i], uris[i]);
+        }
+#endif
+        (void)zhe_subscribe((zhe_rid_t)rids[i], 0, 0, handler, NULL);
+    }
+
+    uint64_t npkts_in = 0, nbytes_in = 0, npkts_out = 0;
+    const uint64_t tstart = gethrtime();
+    while (off < capsize) {
+        if (capsize - off < ZHE_CAPTURE_RECHDR_SIZE) {
+            fprintf(stderr, "replay: ignoring truncated record at end of capture\n");
+            break;
+        }
+        const uint8_t * const rec = cap + off;
+        const uint16_t size = get_u16(rec + 1);
+        const uint32_t t = get_u32(rec + 3);
+        if (capsize - off - ZHE_CAPTURE_RECHDR_SIZE < size) {
+            fprintf(stderr, "replay: ignoring truncated record at end of capture\n");
+            break;
+        }
+        off += ZHE_CAPTURE_RECHDR_SIZE + size;
+        if (rec[0] == ZHE_CAPTURE_OUT) {
+            npkts_out++;
+            continue;
+        } else if (rec[0] != ZHE_CAPTURE_IN) {
+            fail("invalid record kind");
+        }
+        if (t != tprev) {
+            /* like a real event loop: time passing means housekeeping gets a chance to run */
+            tnow += (zhe_time_t)(uint32_t)(t - tprev);
+            tprev = t;
+            zhe_housekeeping(tnow);
+        }
+        zhe_address_t src;
+        memset(&src, 0, sizeof(src));
+        src.a.sin_family = AF_INET;
+        memcpy(&src.a.sin_addr.s_addr, rec + 7, 4);
+        memcpy(&src.a.sin_port, rec + 11, 2);
+        (void)zhe_input(rec + ZHE_CAPTURE_RECHDR_SIZE, size, &src, tnow);
+        npkts_in++;
+        nbytes_in += size;
+    }
+    const uint64_t elapsed = gethrtime() - tstart;
+
+    printf("packets_in=%"PRIu64" bytes_in=%"PRIu64" captured_out=%"PRIu64" delivered=%"PRIu64" delivered_bytes=%"PRIu64" elapsed_s=%.6f ns_per_packet=%.1f\n",
+           npkts_in, nbytes_in, npkts_out, delivered, delivered_bytes, (double)elapsed / 1e9,
+           npkts_in ? (double)elapsed / (double)npkts_in : 0.0);
+    free(cap);
+    return 0;
+}
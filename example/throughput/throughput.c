@@ -104,6 +104,74 @@ static void rhandler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, voi
     printf ("%4"PRIu32".%03"PRIu32" pong %u %4"PRIu32".%03"PRIu32"\n", ZTIME_TO_SECu32(tnow), ZTIME_TO_MSECu32(tnow), pong->k, ZTIME_TO_SECu32(pong->t), ZTIME_TO_MSECu32(pong->t));
 }
 
+#if HAVE_MCPARTITIONS && !defined TCP
+/* "-Y PREFIX=CID,..." or "-Y RIDMIN-RIDMAX=CID,...": multicast conduit CID gets its own group,
+   239.255.0.(2+CID), and a node joins the groups of the partitions covering what it subscribes to */
+static struct zhe_mcpartition mcpartitions[ZHE_MAX_MCPARTITIONS];
+static char mcpartitions_join[16 * N_OUT_MCONDUITS];
+static char mcpartitions_dstaddrs[16 * N_OUT_MCONDUITS];
+
+static size_t parse_mcpartitions(char *str)
+{
+    size_t n = 0;
+    for (char *tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        struct zhe_mcpartition * const p = &mcpartitions[n];
+        char *eq = strrchr(tok, '=');
+        unsigned long cid;
+        if (n == ZHE_MAX_MCPARTITIONS) {
+            fprintf(stderr, "too many multicast partitions specified\n"); exit(1);
+        }
+        if (eq == NULL || (cid = strtoul(eq + 1, NULL, 0)) >= N_OUT_MCONDUITS) {
+            fprintf(stderr, "%s: invalid multicast partition\n", tok); exit(1);
+        }
+        *eq = 0;
+        memset(p, 0, sizeof(*p));
+        p->cid = (unsigned)cid;
+        if (*tok == '/') {
+            p->uriprefix = tok;
+        } else {
+            char *end;
+            p->ridmin = (zhe_rid_t)strtoul(tok, &end, 0);
+            p->ridmax = (*end == '-') ? (zhe_rid_t)strtoul(end + 1, NULL, 0) : p->ridmin;
+        }
+        n++;
+    }
+    return n;
+}
+
+static bool mcpartition_covers(const struct zhe_mcpartition *p, zhe_rid_t rid, const char *uri)
+{
+    if (p->uriprefix != NULL) {
+        return strncmp(uri, p->uriprefix, strlen(p->uriprefix)) == 0;
+    } else {
+        return p->ridmin <= rid && rid <= p->ridmax;
+    }
+}
+
+static void mcpartitions_addrs(size_t n, int mode)
+{
+    bool join[N_OUT_MCONDUITS] = { true };
+    size_t pos;
+    for (size_t i = 0; i < n; i++) {
+        /* subscribers get /t/data, the pong publisher /t/pong */
+        if ((mode != 0 && mcpartition_covers(&mcpartitions[i], 1, "/t/data")) ||
+            (mode == 1 && mcpartition_covers(&mcpartitions[i], 2, "/t/pong"))) {
+            join[mcpartitions[i].cid] = true;
+        }
+    }
+    pos = 0;
+    for (unsigned cid = 0; cid < N_OUT_MCONDUITS; cid++) {
+        pos += (size_t)snprintf(mcpartitions_dstaddrs + pos, sizeof(mcpartitions_dstaddrs) - pos, "%s239.255.0.%u", (cid == 0) ? "" : ",", 2 + cid);
+    }
+    pos = 0;
+    for (unsigned cid = 0; cid < N_OUT_MCONDUITS; cid++) {
+        if (join[cid]) {
+            pos += (size_t)snprintf(mcpartitions_join + pos, sizeof(mcpartitions_join) - pos, "%s239.255.0.%u", (pos == 0) ? "" : ",", 2 + cid);
+        }
+    }
+}
+#endif
+
 int main(int argc, char * const *argv)
 {
     unsigned char ownid[16];
@@ -117,6 +185,7 @@ int main(int argc, char * const *argv)
     int check_likely_success = 0;
     bool sub_to_wildcard = false;
     zhe_time_t duration = (zhe_time_t)~0;
+    const char *tracedump = NULL;
 #ifdef TCP
     uint16_t port = 0;
     const char *pingaddrs = "";
@@ -126,10 +195,16 @@ int main(int argc, char * const *argv)
 #else
     uint16_t port = 7447;
     int drop_pct = 0;
+    const char *capture = NULL;
+    const char *shmname = NULL;
     const char *scoutaddrstr = "239.255.0.1";
     char *mcgroups_join_str = "239.255.0.2"; /* in addition to scout */
     char *mconduit_dstaddrs_str = "239.255.0.2";
 #endif
+#if HAVE_MCPARTITIONS && !defined TCP
+    size_t n_mcpartitions = 0;
+    bool explicit_G = false, explicit_M = false;
+#endif
 
 #ifdef __APPLE__
     srandomdev();
@@ -141,9 +216,15 @@ int main(int argc, char * const *argv)
     zhe_trace_cats = ~0u;
 #endif
 
-    while((opt = getopt(argc, argv, "D:C:k:c:h:pP:squX:xw"
+    while((opt = getopt(argc, argv, "D:C:k:c:h:pP:squT:X:xw"
 #ifndef TCP
-                        "S:G:M:" /* options controlling addressing that are meaningful only for UDP/IP */
+                        "S:G:M:R:" /* options controlling addressing that are meaningful only for UDP/IP */
+#if USE_SHM
+                        "m:"
+#endif
+#if HAVE_MCPARTITIONS
+                        "Y:"
+#endif
 #endif
                         )) != EOF) {
         switch(opt) {
@@ -173,12 +254,23 @@ int main(int argc, char * const *argv)
 #ifndef TCP
             case 'X': drop_pct = atoi(optarg); break;
             case 'S': scoutaddrstr = optarg; break;
+#if HAVE_MCPARTITIONS
+            case 'G': mcgroups_join_str = optarg; explicit_G = true; break;
+            case 'M': mconduit_dstaddrs_str = optarg; explicit_M = true; break;
+            case 'Y': n_mcpartitions = parse_mcpartitions(optarg); break;
+#else
             case 'G': mcgroups_join_str = optarg; break;
             case 'M': mconduit_dstaddrs_str = optarg; break;
+#endif
+            case 'R': capture = optarg; break;
+#if USE_SHM
+            case 'm': shmname = optarg; break;
+#endif
 #else
             case 'X': pingaddrs = optarg; break;
 #endif
             case 'D': duration = (zhe_time_t)atoi(optarg); break;
+            case 'T': tracedump = optarg; break;
             case 'w': sub_to_wildcard = true; break;
             default: fprintf(stderr, "invalid options given\n"); exit(1); break;
         }
@@ -191,9 +283,24 @@ int main(int argc, char * const *argv)
     memset(&cfg, 0, sizeof(cfg));
     cfg.id = ownid;
     cfg.idlen = ownidsize;
+#if HAVE_MCPARTITIONS && !defined TCP
+    if (n_mcpartitions > 0) {
+        mcpartitions_addrs(n_mcpartitions, mode);
+        if (!explicit_G) {
+            mcgroups_join_str = mcpartitions_join;
+        }
+        if (!explicit_M) {
+            mconduit_dstaddrs_str = mcpartitions_dstaddrs;
+        }
+        cfg.n_mcpartitions = n_mcpartitions;
+        cfg.mcpartitions = mcpartitions;
+    }
+#endif
 
 #ifdef TCP
     struct zhe_platform * const platform = zhe_platform_new(port, pingaddrs);
+#elif USE_SHM
+    struct zhe_platform * const platform = (shmname != NULL) ? zhe_platform_new_shm(port, shmname, drop_pct) : zhe_platform_new(port, drop_pct);
 #else
     struct zhe_platform * const platform = zhe_platform_new(port, drop_pct);
 #endif
@@ -201,6 +308,12 @@ int main(int argc, char * const *argv)
         fprintf(stderr, "platform initialization failed\n");
         exit(1);
     }
+#ifndef TCP
+    if (capture != NULL && zhe_platform_capture(platform, capture, ownid, ownidsize) < 0) {
+        fprintf(stderr, "%s: can't create capture file\n", capture);
+        exit(1);
+    }
+#endif
     cfg_handle_addrs(&cfg, platform, scoutaddrstr, mcgroups_join_str, mconduit_dstaddrs_str);
     if (zhe_init(&cfg, platform, zhe_platform_time()) < 0) {
         fprintf(stderr, "init failed\n");
@@ -291,6 +404,14 @@ int main(int argc, char * const *argv)
             fprintf(stderr, "mode = %d?", mode);
             exit(1);
     }
+#ifndef TCP
+    if (capture != NULL) {
+        zhe_platform_capture_close(platform);
+    }
+#endif
+    if (tracedump != NULL && dump_trace_ring(tracedump) < 0) {
+        return 1;
+    }
     if (!check_likely_success) {
         return 0;
     } else {
@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "platform-udp.h"
+#include "zhe.h"
+#include "zhe-tracing.h"
+#include "zhe-assert.h"
+
+#include "zhe-config-deriv.h" /* for MAX_PEERS, N_OUT_MCONDUITS, XMITW_BYTES, ENABLE_STATS */
+#if ENABLE_STATS
+#include "zhe-stats.h"
+#endif
+
+#include "zhe-util.h"
+
+/* Throughput benchmark: for every combination of payload size, number of subscribing peers,
+   reliability and simulated packet loss, one publisher and NPEERS subscriber processes are forked,
+   connected either via UDP/IP or via the in-memory transport.  The publisher writes as fast as it
+   can for a fixed duration, then tells the subscribers it is done on a reliable control channel;
+   everyone reports its counts and CPU time to the parent over a pipe, and the parent writes one
+   CSV line per combination. */
+
+#define MAX_LIST 16
+#define MAX_NODES 32                 /* publisher + subscribers, limited by bitmasks below */
+#define PER_SAMPLE_OVERHEAD 16       /* generous estimate of header bytes per sample */
+#define BASE_PORT 7447
+#define READY_INTERVAL_NS 100000000  /* subscribers announce themselves every 100ms */
+#define DISCOVERY_TIMEOUT_NS 15000000000ull
+#define DRAIN_TIMEOUT_NS 30000000000ull
+
+#define RID_DATA 1
+#define RID_CTRL 2
+#define RID_STATUS 3
+
+struct params {
+    bool mem;
+    zhe_paysize_t size;
+    unsigned npeers;
+    int reliable;
+    int loss_pct;
+    unsigned duration_ms;
+};
+
+/* What each node reports to the parent at the end of a run */
+struct result {
+    unsigned idx;                    /* 0 is the publisher, 1 .. NPEERS the subscribers */
+    int ok;                          /* run completed */
+    uint64_t count;                  /* samples written (publisher) or received (subscribers) */
+    uint64_t bytes;                  /* payload bytes written/received */
+    uint64_t elapsed_ns;             /* time between first and last sample */
+    uint64_t cpu_ns;                 /* user + system CPU time used in that interval */
+    int64_t rexmits;                 /* retransmitted samples (publisher), -1 if unknown */
+};
+
+/* Control messages, the publisher sends END on RID_CTRL, the subscribers READY and DONE on
+   RID_STATUS */
+enum msgkind { MSG_READY, MSG_DONE, MSG_END };
+
+struct ctrlmsg {
+    uint32_t kind;
+    uint32_t idx;
+    uint64_t count;
+};
+
+#if N_OUT_MCONDUITS > 0
+#define MCONDUIT_WINDOW XMITW_BYTES
+#else
+#define MCONDUIT_WINDOW 0
+#endif
+
+static uint64_t gethrtime(void)
+{
+    struct timespec t;
+    (void)clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (unsigned)t.tv_nsec;
+}
+
+static uint64_t getcputime(void)
+{
+    struct rusage ru;
+    (void)getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000 +
+           ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000;
+}
+
+static struct zhe_platform *start_zhe(const struct params *prm, unsigned idx, const int *fds)
+{
+    unsigned char ownid[16];
+    zhe_paysize_t ownidsize = getrandomid(ownid, sizeof(ownid));
+    struct zhe_config cfg;
+    struct zhe_platform *platform;
+#if N_OUT_MCONDUITS == 1
+    const char *mcgroups_join_str = "239.255.0.2:7447"; /* in addition to scout */
+    const char *mconduit_dstaddrs_str = "239.255.0.2:7447";
+#else
+    const char *mcgroups_join_str = "239.255.0.2:7447,239.255.0.3:7447"; /* in addition to scout */
+    const char *mconduit_dstaddrs_str = "239.255.0.2:7447,239.255.0.3:7447";
+#endif
+
+#if ENABLE_TRACING
+    zhe_trace_cats = ZTCAT_ERROR;
+#endif
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.id = ownid;
+    cfg.idlen = ownidsize;
+    if (prm->mem) {
+        uint16_t peerports[MAX_NODES];
+        unsigned n = 0;
+        for (unsigned i = 0; i <= prm->npeers; i++) {
+            if (i != idx) {
+                peerports[n++] = (uint16_t)(BASE_PORT + i);
+            }
+        }
+        platform = zhe_platform_new_mesh((uint16_t)(BASE_PORT + idx), n, fds, peerports, prm->loss_pct);
+    } else {
+        platform = zhe_platform_new(BASE_PORT, prm->loss_pct);
+    }
+    if (platform == NULL) {
+        fprintf(stderr, "platform initialization failed\n");
+        exit(1);
+    }
+    cfg_handle_addrs(&cfg, platform, "239.255.0.1:7447", mcgroups_join_str, mconduit_dstaddrs_str);
+    if (zhe_init(&cfg, platform, zhe_platform_time()) < 0) {
+        fprintf(stderr, "init failed\n");
+        exit(1);
+    }
+    zhe_start(zhe_platform_time());
+    zhe_declare_resource(RID_DATA, "/t/data");
+    zhe_declare_resource(RID_CTRL, "/t/ctrl");
+    zhe_declare_resource(RID_STATUS, "/t/status");
+    return platform;
+}
+
+static void poll_once(struct zhe_platform *platform, zhe_timediff_t timeout)
+{
+    zhe_time_t tnow;
+    if (zhe_platform_wait(platform, timeout)) {
+        zhe_recvbuf_t inbuf;
+        zhe_address_t insrc;
+        int recvret;
+        tnow = zhe_platform_time();
+        while ((recvret = zhe_platform_recv(platform, &inbuf, &insrc)) > 0) {
+            int cnt = zhe_input(inbuf.buf, (size_t)recvret, &insrc, tnow);
+            zhe_platform_advance(platform, &insrc, cnt);
+        }
+    } else {
+        tnow = zhe_platform_time();
+    }
+    zhe_housekeeping(tnow);
+}
+
+/* Reliable writes of control messages can fail only because of a full transmit window */
+static void write_ctrl(struct zhe_platform *platform, zhe_pubidx_t pub, const struct ctrlmsg *msg)
+{
+    while (!zhe_write(pub, msg, sizeof(*msg), zhe_platform_time())) {
+        poll_once(platform, 1);
+    }
+}
+
+static void report(int resfd, const struct result *res)
+{
+    if (write(resfd, res, sizeof(*res)) != (ssize_t)sizeof(*res)) {
+        perror("write result");
+    }
+}
+
+static void idle_forever(struct zhe_platform *platform)
+{
+    /* Keep serving retransmit requests &c. until the parent kills us */
+    while (1) {
+        poll_once(platform, 10);
+    }
+}
+
+static uint32_t ready_mask, done_mask;
+
+static void status_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg)
+{
+    struct ctrlmsg msg;
+    zhe_assert(size == sizeof(msg));
+    memcpy(&msg, payload, sizeof(msg));
+    if (msg.idx < MAX_NODES) {
+        if (msg.kind == MSG_READY) {
+            ready_mask |= 1u << msg.idx;
+        } else if (msg.kind == MSG_DONE) {
+            done_mask |= 1u << msg.idx;
+        }
+    }
+}
+
+static void run_publisher(const struct params *prm, const int *fds, int resfd)
+{
+    static uint8_t buf[TRANSPORT_MTU];
+    struct zhe_platform * const platform = start_zhe(prm, 0, fds);
+    const zhe_pubidx_t pdata = zhe_publish(RID_DATA, 0, prm->reliable);
+    const zhe_pubidx_t pctrl = zhe_publish(RID_CTRL, 0, 1);
+    const uint32_t all = ((1u << prm->npeers) - 1) << 1;
+    struct result res = { .idx = 0, .rexmits = -1 };
+    (void)zhe_subscribe(RID_STATUS, 0, 0, status_handler, NULL);
+
+    uint64_t tstart = gethrtime();
+    while ((ready_mask & all) != all) {
+        if (gethrtime() - tstart > DISCOVERY_TIMEOUT_NS) {
+            fprintf(stderr, "publisher: discovery timed out\n");
+            report(resfd, &res);
+            idle_forever(platform);
+        }
+        poll_once(platform, 10);
+    }
+
+    memset(buf, 0, sizeof(buf));
+    const uint64_t cpu0 = getcputime();
+    tstart = gethrtime();
+    const uint64_t tend = tstart + (uint64_t)prm->duration_ms * 1000000;
+    uint64_t hrtnow;
+    uint32_t seq = 0;
+    while ((hrtnow = gethrtime()) < tend) {
+        const zhe_time_t tnow = zhe_platform_time();
+        poll_once(platform, 0);
+        /* Writing blocks of samples means we don't poll for each sample, as in throughput */
+        for (int i = 0; i < 50; i++) {
+            memcpy(buf, &seq, sizeof(seq));
+            if (!zhe_write(pdata, buf, prm->size, tnow)) {
+                /* no space in transmit window => must first process incoming ACKs */
+                poll_once(platform, 1);
+                break;
+            }
+            seq++;
+        }
+    }
+    res.count = seq;
+    res.bytes = (uint64_t)seq * prm->size;
+    res.elapsed_ns = hrtnow - tstart;
+    res.cpu_ns = getcputime() - cpu0;
+
+    const struct ctrlmsg end = { .kind = MSG_END, .idx = 0, .count = seq };
+    write_ctrl(platform, pctrl, &end);
+    tstart = gethrtime();
+    while ((done_mask & all) != all && gethrtime() - tstart < DRAIN_TIMEOUT_NS) {
+        poll_once(platform, 10);
+    }
+#if ENABLE_STATS
+    struct zhe_conduit_stats cst;
+    if (zhe_get_conduit_stats(0, &cst)) {
+        res.rexmits = cst.rexmits;
+    }
+#endif
+    res.ok = ((done_mask & all) == all);
+    report(resfd, &res);
+    idle_forever(platform);
+}
+
+struct substate {
+    uint64_t count, bytes;
+    uint64_t tfirst, cpufirst;
+    bool ended;
+};
+
+static void data_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *vst)
+{
+    struct substate * const st = vst;
+    if (st->count++ == 0) {
+        st->tfirst = gethrtime();
+        st->cpufirst = getcputime();
+    }
+    st->bytes += size;
+}
+
+static void ctrl_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *vst)
+{
+    struct substate * const st = vst;
+    struct ctrlmsg msg;
+    zhe_assert(size == sizeof(msg));
+    memcpy(&msg, payload, sizeof(msg));
+    if (msg.kind == MSG_END) {
+        st->ended = true;
+    }
+}
+
+static void run_subscriber(const struct params *prm, unsigned idx, const int *fds, int resfd)
+{
+    static struct substate st;
+    struct zhe_platform * const platform = start_zhe(prm, idx, fds);
+    const zhe_pubidx_t pstatus = zhe_publish(RID_STATUS, 0, 1);
+    struct ctrlmsg msg = { .kind = MSG_READY, .idx = idx };
+    struct result res = { .idx = idx, .rexmits = -1 };
+    (void)zhe_subscribe(RID_DATA, 0, 0, data_handler, &st);
+    (void)zhe_subscribe(RID_CTRL, 0, 0, ctrl_handler, &st);
+
+    const uint64_t tstart = gethrtime();
+    uint64_t tready = 0;
+    while (!st.ended) {
+        const uint64_t hrtnow = gethrtime();
+        if (hrtnow - tstart > DISCOVERY_TIMEOUT_NS + DRAIN_TIMEOUT_NS + (uint64_t)prm->duration_ms * 1000000) {
+            fprintf(stderr, "subscriber %u: timed out\n", idx);
+            report(resfd, &res);
+            idle_forever(platform);
+        }
+        /* Writes are dropped while the publisher isn't known yet, so keep announcing ourselves
+           until data arrives */
+        if (st.count == 0 && hrtnow - tready > READY_INTERVAL_NS) {
+            (void)zhe_write(pstatus, &msg, sizeof(msg), zhe_platform_time());
+            tready = hrtnow;
+        }
+        poll_once(platform, 10);
+    }
+    res.ok = 1;
+    res.count = st.count;
+    res.bytes = st.bytes;
+    if (st.count > 0) {
+        res.elapsed_ns = gethrtime() - st.tfirst;
+        res.cpu_ns = getcputime() - st.cpufirst;
+    }
+    report(resfd, &res);
+
+    msg.kind = MSG_DONE;
+    write_ctrl(platform, pstatus, &msg);
+    idle_forever(platform);
+}
+
+static int collect_results(int resfd, unsigned nnodes, struct result *res, uint64_t timeout_ns)
+{
+    const uint64_t tend = gethrtime() + timeout_ns;
+    unsigned n = 0;
+    uint64_t hrtnow;
+    while (n < nnodes && (hrtnow = gethrtime()) < tend) {
+        struct pollfd pfd = { .fd = resfd, .events = POLLIN };
+        struct result r;
+        if (poll(&pfd, 1, (int)((tend - hrtnow) / 1000000) + 1) <= 0) {
+            continue;
+        }
+        if (read(resfd, &r, sizeof(r)) != (ssize_t)sizeof(r) || r.idx >= nnodes) {
+            break;
+        }
+        res[r.idx] = r;
+        n++;
+    }
+    return n == nnodes;
+}
+
+static void print_result(const struct params *prm, const struct result *res)
+{
+    const struct result *pub = &res[0];
+    double sub_rate = 0.0, sub_brate = 0.0, sub_cpu = 0.0, sub_ratio = 0.0;
+    unsigned nsubs = 0;
+    for (unsigned i = 1; i <= prm->npeers; i++) {
+        if (res[i].ok && res[i].elapsed_ns > 0) {
+            sub_rate += (double)res[i].count * 1e9 / (double)res[i].elapsed_ns;
+            sub_brate += (double)res[i].bytes * 1e9 / (double)res[i].elapsed_ns;
+            sub_cpu += (double)res[i].cpu_ns / (double)res[i].count;
+            if (pub->count > 0) {
+                sub_ratio += (double)res[i].count / (double)pub->count;
+            }
+            nsubs++;
+        }
+    }
+    printf("%s,%u,%u,%s,%d,%.3f,%"PRIu64,
+           prm->mem ? "mem" : "udp", (unsigned)prm->size, prm->npeers,
+           prm->reliable ? "reliable" : "best-effort", prm->loss_pct,
+           (double)pub->elapsed_ns / 1e9, pub->count);
+    if (pub->elapsed_ns > 0 && pub->count > 0) {
+        printf(",%.0f,%.0f", (double)pub->count * 1e9 / (double)pub->elapsed_ns, (double)pub->cpu_ns / (double)pub->count);
+    } else {
+        printf(",,");
+    }
+    if (pub->rexmits >= 0 && pub->count > 0) {
+        printf(",%.4f", (double)pub->rexmits / (double)pub->count);
+    } else {
+        printf(",");
+    }
+    if (nsubs > 0) {
+        printf(",%u,%.0f,%.0f,%.4f,%.0f\n", nsubs, sub_rate / nsubs, sub_brate / nsubs, sub_ratio / nsubs, sub_cpu / nsubs);
+    } else {
+        printf(",0,,,,\n");
+    }
+    fflush(stdout);
+}
+
+static int run_one(const struct params *prm)
+{
+    static int fds[MAX_NODES][MAX_NODES - 1];
+    static struct result res[MAX_NODES];
+    const unsigned nnodes = prm->npeers + 1;
+    pid_t pids[MAX_NODES];
+    int resp[2];
+    int ok;
+
+    /* Full mesh: fds[i][k] is node i's end of the socketpair connecting it to the k-th of the
+       other nodes, in the order start_zhe passes them to zhe_platform_new_mesh */
+    if (prm->mem) {
+        for (unsigned i = 0; i < nnodes; i++) {
+            for (unsigned j = i + 1; j < nnodes; j++) {
+                int sv[2];
+                if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+                    perror("socketpair");
+                    exit(1);
+                }
+                fds[i][j - 1] = sv[0];
+                fds[j][i] = sv[1];
+            }
+        }
+    }
+    if (pipe(resp) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    memset(res, 0, sizeof(res));
+    fflush(stdout);
+    for (unsigned i = 0; i < nnodes; i++) {
+        if ((pids[i] = fork()) == 0) {
+            close(resp[0]);
+            if (prm->mem) {
+                for (unsigned k = 0; k < nnodes; k++) {
+                    if (k != i) {
+                        for (unsigned l = 0; l < nnodes - 1; l++) {
+                            close(fds[k][l]);
+                        }
+                    }
+                }
+            }
+            if (i == 0) {
+                run_publisher(prm, fds[i], resp[1]);
+            } else {
+                run_subscriber(prm, i, fds[i], resp[1]);
+            }
+        }
+    }
+    close(resp[1]);
+    if (prm->mem) {
+        for (unsigned k = 0; k < nnodes; k++) {
+            for (unsigned l = 0; l < nnodes - 1; l++) {
+                close(fds[k][l]);
+            }
+        }
+    }
+    ok = collect_results(resp[0], nnodes, res, DISCOVERY_TIMEOUT_NS + DRAIN_TIMEOUT_NS + (uint64_t)prm->duration_ms * 1000000);
+    close(resp[0]);
+    for (unsigned i = 0; i < nnodes; i++) {
+        kill(pids[i], SIGTERM);
+        (void)waitpid(pids[i], NULL, 0);
+    }
+    for (unsigned i = 0; i < nnodes; i++) {
+        ok = ok && res[i].ok;
+    }
+    print_result(prm, res);
+    return ok;
+}
+
+static unsigned parse_list(const char *str, unsigned long *xs, unsigned long min, unsigned long max, const char *what)
+{
+    unsigned n = 0;
+    char *copy = strdup(str), *tok, *end;
+    for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        const unsigned long x = strtoul(tok, &end, 0);
+        if (*tok == 0 || *end != 0 || x < min || x > max || n == MAX_LIST) {
+            fprintf(stderr, "%s: invalid %s list\n", str, what);
+            exit(2);
+        }
+        xs[n++] = x;
+    }
+    free(copy);
+    return n;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [OPTIONS]\n\
+\n\
+-t mem|udp  transport: in-memory (default) or UDP/IP with multicast discovery\n\
+-s SIZES    comma-separated payload sizes in bytes (default 8,64,512,1024,%u)\n\
+-p PEERS    comma-separated numbers of subscribing peers (default 1,2,4)\n\
+-r MODES    comma-separated reliability modes: 1 = reliable, 0 = best-effort (default 1,0)\n\
+-l PCTS     comma-separated simulated packet loss percentages (default 0)\n\
+-d MS       duration of each run in milliseconds (default 2000)\n\
+\n\
+Writes one CSV line per combination to stdout. The retransmit ratio is only available if\n\
+zhe was built with ENABLE_STATS. Reliable combinations that don't fit in the transmit\n\
+window and peer counts exceeding MAX_PEERS are skipped.\n", argv0, TRANSPORT_MTU - PER_SAMPLE_OVERHEAD);
+    exit(2);
+}
+
+int main(int argc, char * const *argv)
+{
+    unsigned long sizes[MAX_LIST] = { 8, 64, 512, 1024, TRANSPORT_MTU - PER_SAMPLE_OVERHEAD }, peers[MAX_LIST] = { 1, 2, 4 }, rels[MAX_LIST] = { 1, 0 }, losses[MAX_LIST] = { 0 };
+    unsigned nsizes = 5, npeers = 3, nrels = 2, nlosses = 1;
+    struct params prm = { .mem = true, .duration_ms = 2000 };
+    int opt, ok = 1;
+
+#if MAX_PEERS == 0 || N_OUT_MCONDUITS == 0
+    fprintf(stderr, "%s: requires a peer-to-peer configuration with multicast conduits\n", argv[0]);
+    return 2;
+#endif
+    while ((opt = getopt(argc, argv, "d:l:p:r:s:t:")) != EOF) {
+        switch (opt) {
+            case 't':
+                if (strcmp(optarg, "mem") == 0) {
+                    prm.mem = true;
+                } else if (strcmp(optarg, "udp") == 0) {
+                    prm.mem = false;
+                } else {
+                    usage(argv[0]);
+                }
+                break;
+            case 's': nsizes = parse_list(optarg, sizes, sizeof(uint32_t), TRANSPORT_MTU - PER_SAMPLE_OVERHEAD, "size"); break;
+            case 'p': npeers = parse_list(optarg, peers, 1, MAX_NODES - 1, "peer count"); break;
+            case 'r': nrels = parse_list(optarg, rels, 0, 1, "reliability"); break;
+            case 'l': nlosses = parse_list(optarg, losses, 0, 100, "loss percentage"); break;
+            case 'd': prm.duration_ms = (unsigned)atoi(optarg); break;
+            default: usage(argv[0]); break;
+        }
+    }
+    if (optind < argc || prm.duration_ms == 0) {
+        usage(argv[0]);
+    }
+
+    printf("transport,size,peers,reliability,loss_pct,duration_s,written,pub_samples_per_s,pub_cpu_ns_per_sample,rexmit_ratio,subs_reporting,sub_samples_per_s,sub_bytes_per_s,delivery_ratio,sub_cpu_ns_per_sample\n");
+    for (unsigned is = 0; is < nsizes; is++) {
+        for (unsigned ip = 0; ip < npeers; ip++) {
+            for (unsigned ir = 0; ir < nrels; ir++) {
+                for (unsigned il = 0; il < nlosses; il++) {
+                    prm.size = (zhe_paysize_t)sizes[is];
+                    prm.npeers = (unsigned)peers[ip];
+                    prm.reliable = (int)rels[ir];
+                    prm.loss_pct = (int)losses[il];
+                    if (prm.npeers > MAX_PEERS) {
+                        fprintf(stderr, "skipping %u peers: exceeds MAX_PEERS\n", prm.npeers);
+                        continue;
+                    }
+                    if (prm.reliable && prm.size + PER_SAMPLE_OVERHEAD > MCONDUIT_WINDOW) {
+                        fprintf(stderr, "skipping reliable size %u: exceeds transmit window\n", (unsigned)prm.size);
+                        continue;
+                    }
+                    if (!run_one(&prm)) {
+                        ok = 0;
+                    }
+                }
+            }
+        }
+    }
+    return !ok;
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Decoder for the binary trace ring dumps written by zhe_trace_ring_dump (see zhe-tracering.c for
+   the format).  Independent of the zhe configuration, so it can decode dumps from any node. */
+
+#define MAXARGS 255
+
+struct fmtdef {
+    uint32_t seq;
+    char *fmt;
+};
+
+static struct fmtdef *fmts;
+static size_t nfmts, maxfmts;
+
+static void fail(const char *msg)
+{
+    fprintf(stderr, "tracedec: %s\n", msg);
+    exit(1);
+}
+
+static void get(FILE *fp, void *buf, size_t sz)
+{
+    if (sz > 0 && fread(buf, sz, 1, fp) != 1) {
+        fail("truncated input");
+    }
+}
+
+static uint16_t get_u16(FILE *fp)
+{
+    uint8_t b[2];
+    get(fp, b, sizeof(b));
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static uint32_t get_u32(FILE *fp)
+{
+    const uint32_t lo = get_u16(fp);
+    return lo | ((uint32_t)get_u16(fp) << 16);
+}
+
+static const char *lookup_fmt(uint32_t seq)
+{
+    for (size_t i = 0; i < nfmts; i++) {
+        if (fmts[i].seq == seq) {
+            return fmts[i].fmt;
+        }
+    }
+    return NULL;
+}
+
+static void add_fmt(uint32_t seq, char *fmt)
+{
+    if (nfmts == maxfmts) {
+        maxfmts = maxfmts ? 2 * maxfmts : 64;
+        if ((fmts = realloc(fmts, maxfmts * sizeof(*fmts))) == NULL) {
+            fail("out of memory");
+        }
+    }
+    fmts[nfmts].seq = seq;
+    fmts[nfmts].fmt = fmt;
+    nfmts++;
+}
+
+static const char *catname(unsigned cat)
+{
+    switch (cat) {
+        case 1:  return "ERROR";
+        case 2:  return "DEBUG";
+        case 4:  return "PEERDISC";
+        case 8:  return "TRANSPORT";
+        case 16: return "RELIABLE";
+        case 32: return "PUBSUB";
+        default: return "?";
+    }
+}
+
+/* Interprets FMT as a printf format string with all arguments replaced by the 32-bit integers in
+   ARGS; strings and pointers can only be shown as placeholders */
+static void print_formatted(const char *fmt, unsigned nargs, const uint32_t *args)
+{
+    unsigned ai = 0;
+    const char *p = fmt;
+    while (*p) {
+        char spec[48];
+        size_t n = 0;
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        } else if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0", *p) && n < 8) {
+            spec[n++] = *p++;
+        }
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*p != '.') {
+                    break;
+                }
+                spec[n++] = *p++;
+            }
+            if (*p == '*') {
+                const int x = (ai < nargs) ? (int)(int32_t)args[ai] : 0;
+                n += (size_t)snprintf(spec + n, 12, "%d", x);
+                ai++;
+                p++;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    if (n < 24) {
+                        spec[n++] = *p;
+                    }
+                    p++;
+                }
+            }
+        }
+        while (*p && strchr("hljztL", *p)) {
+            p++;
+        }
+        if (*p == 0) {
+            break;
+        }
+        const char conv = *p++;
+        if (ai >= nargs) {
+            fputs("<?>", stdout);
+            continue;
+        }
+        const uint32_t a = args[ai++];
+        switch (conv) {
+            case 'd': case 'i':
+                spec[n++] = 'l'; spec[n++] = 'd'; spec[n] = 0;
+                printf(spec, (long)(int32_t)a);
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                spec[n++] = 'l'; spec[n++] = conv; spec[n] = 0;
+                printf(spec, (unsigned long)a);
+                break;
+            case 'c':
+                spec[n++] = 'c'; spec[n] = 0;
+                printf(spec, (int)a);
+                break;
+            case 'p':
+                printf("0x%08"PRIx32, a);
+                break;
+            case 's':
+                fputs("<str>", stdout);
+                break;
+            default:
+                printf("<%%%c:%"PRIu32">", conv, a);
+                break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp = stdin;
+    uint8_t hdr[8];
+    uint32_t timebase;
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [DUMPFILE]\n", argv[0]);
+        return 1;
+    } else if (argc == 2 && (fp = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    get(fp, hdr, sizeof(hdr));
+    if (memcmp(hdr, "ZTRC", 4) != 0 || hdr[4] != 1) {
+        fail("not a version 1 zhe trace dump");
+    }
+    timebase = get_u32(fp);
+    if (timebase == 0 || timebase > 1000000000) {
+        fail("invalid time base");
+    }
+
+    int c;
+    while ((c = getc(fp)) != EOF) {
+        uint32_t args[MAXARGS];
+        const char *fmt;
+        ungetc(c, fp);
+        const uint32_t seq = get_u32(fp);
+        const uint32_t t = get_u32(fp);
+        uint8_t catnargs[2];
+        get(fp, catnargs, sizeof(catnargs));
+        const unsigned cat = catnargs[0];
+        const unsigned nargs = catnargs[1];
+        const uint32_t fmtref = get_u32(fp);
+        if (fmtref == seq) {
+            const uint16_t len = get_u16(fp);
+            char *s = malloc((size_t)len + 1);
+            if (s == NULL) {
+                fail("out of memory");
+            }
+            get(fp, s, len);
+            s[len] = 0;
+            add_fmt(seq, s);
+        }
+        if ((fmt = lookup_fmt(fmtref)) == NULL) {
+            fail("reference to undefined format string");
+        }
+        for (unsigned i = 0; i < nargs; i++) {
+            args[i] = get_u32(fp);
+        }
+        const uint64_t ns = (uint64_t)t * timebase;
+        printf("%10"PRIu32" %4"PRIu64".%06"PRIu64" %-9s ", seq, ns / 1000000000, (ns / 1000) % 1000000, catname(cat));
+        print_formatted(fmt, nargs, args);
+        putchar('\n');
+    }
+    return 0;
+}
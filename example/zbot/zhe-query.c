@@ -0,0 +1 @@
+../../src/zhe-query.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/zhe-query.h
\ No newline at end of file
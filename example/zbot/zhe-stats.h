@@ -0,0 +1 @@
+../../src/zhe-stats.h
\ No newline at end of file
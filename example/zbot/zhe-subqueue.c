@@ -0,0 +1 @@
+../../src/zhe-subqueue.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/zhe-subqueue.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../src/zhe-tracering.c
\ No newline at end of file
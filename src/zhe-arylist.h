@@ -24,6 +24,9 @@
 #define MAKE_ARYLIST_SPEC_insert(linkage_, name_, type_, index_type_, max_elems_) \
     linkage_ void name_##_insert(name_##_t *set, type_ elem);
 
+#define MAKE_ARYLIST_SPEC_delete(linkage_, name_, type_, index_type_, max_elems_) \
+    linkage_ bool name_##_delete(name_##_t *set, type_ elem);
+
 #define MAKE_ARYLIST_SPEC_iter_first(linkage_, name_, type_, index_type_, max_elems_) \
     linkage_ bool name_##_iter_first(name_##_iter_t *it, const name_##_t *set, type_ *elem); \
 
@@ -50,6 +53,28 @@
         set->count index_type_sub_ = set->count index_type_sub_ + 1;    \
     }
 
+#define MAKE_ARYLIST_BODY_delete(linkage_, name_, type_, index_type_, index_type_sub_, max_elems_) \
+    linkage_ bool name_##_delete(name_##_t *set, type_ elem)            \
+    {                                                                   \
+        index_type_ pos;                                                \
+        for (pos index_type_sub_ = 0; pos index_type_sub_ < set->count index_type_sub_; pos index_type_sub_ = pos index_type_sub_ + 1) { \
+            if (memcmp(&set->elems[pos index_type_sub_], &elem, sizeof(elem)) == 0) { \
+                break;                                                  \
+            }                                                           \
+        }                                                               \
+        if (pos index_type_sub_ == set->count index_type_sub_) {        \
+            return false;                                               \
+        } else {                                                        \
+            if (pos index_type_sub_ + 1 < set->count index_type_sub_) { \
+                memmove(&set->elems[pos index_type_sub_],               \
+                        &set->elems[pos index_type_sub_+1],             \
+                        (set->count index_type_sub_ - pos index_type_sub_ - 1) * sizeof(set->elems[0])); \
+            }                                                           \
+            set->count index_type_sub_ = set->count index_type_sub_ - 1; \
+            return true;                                                \
+        }                                                               \
+    }
+
 #define MAKE_ARYLIST_BODY_iter_first(linkage_, name_, type_, index_type_, index_type_sub_, max_elems_) \
     linkage_ bool name_##_iter_first(name_##_iter_t *it, const name_##_t *set, type_ *elem) \
     {                                                                   \
@@ -23,6 +23,12 @@
 #  error "transport configuration did not set MODE properly"
 #endif
 
+/* A platform that may hold on to packets passed to zhe_platform_send to hand them to the OS in
+   batches sets TRANSPORT_BATCHING to 1, and then must provide zhe_platform_flush */
+#ifndef TRANSPORT_BATCHING
+#  define TRANSPORT_BATCHING 0
+#endif
+
 /* There is some lower limit that really won't work anymore, but I actually know what that is, so the 16 is just a placeholder (but it is roughly correct); 16-bit unsigned indices are used to index a packet, with the maximum value used as an exceptional value, so larger than 2^16-2 is also no good; and finally, the return type of zhe_input is an int, and so the number of consumed bytes must fit in an int */
 #if TRANSPORT_MTU < 16 || TRANSPORT_MTU > 65534 || TRANSPORT_MTU > INT_MAX
 #  error "transport configuration did not set MTU properly"
@@ -122,6 +128,37 @@ typedef int64_t sseq_t;
 
 #define ZHE_NEED_ICGCB (ZHE_MAX_URISPACE > 0)
 
+/* The "transient" property only exists for resources with a URI, and the values are pushed to peers */
+#define HAVE_TRANSIENT_CACHE (ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0 && ZHE_MAX_TRANSIENT > 0)
+
+/* Queries are by URI, and storages only store samples of resources that have one */
+#define HAVE_QUERY (ZHE_MAX_URISPACE > 0 && ZHE_MAX_QUERIES > 0)
+#define HAVE_STORAGE (HAVE_QUERY && ZHE_MAX_STORED_SAMPLES > 0)
+
+#define HAVE_SUBQUEUES (ZHE_MAX_SUBQUEUES > 0)
+
+/* Publishers can only skip samples based on the filters of the remote subscribers if they keep
+   track of the individual remote subscriptions, which they only do in peer-to-peer mode and when
+   URIs are supported; a client leaves it to the broker */
+#define HAVE_RSUB_FILTERS (ENABLE_SUBFILTERS && ZHE_MAX_RSUB_FILTERS > 0 && ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0)
+
+/* Switching a publication to the unicast conduit of its only subscriber requires both kinds of
+   conduits, and is pointless with at most one peer */
+#define HAVE_AUTO_UNICAST (ENABLE_AUTO_UNICAST && HAVE_UNICAST_CONDUIT && N_OUT_MCONDUITS > 0 && MAX_PEERS > 1)
+/* A subscriber is only asked for an acknowledgement when the window is 3/4 full or once every
+   MSYNCH_INTERVAL, so a publication moved to a (much) smaller unicast window keeps running into a
+   full one in between */
+#if HAVE_AUTO_UNICAST && XMITW_BYTES_UNICAST < XMITW_BYTES
+#  error "ENABLE_AUTO_UNICAST requires XMITW_BYTES_UNICAST >= XMITW_BYTES"
+#endif
+
+/* Routing publications to multicast conduits by resource only makes sense if there is a choice */
+#define HAVE_MCPARTITIONS (ZHE_MAX_MCPARTITIONS > 0 && N_OUT_MCONDUITS > 1)
+
+#if SUBBATCH_MAX < 1
+#error "SUBBATCH_MAX must be at least 1"
+#endif
+
 #if ZHE_TIMEBASE != 1000000
 #warning "better get the time conversions correct first ..."
 #endif
@@ -39,7 +39,7 @@
 
 #define URIPOS_INVALID ((uripos_t)-1)
 
-/* Limits on GC: number of blocks inspected & number of bytes moved */
+/* Default limits on GC: number of blocks inspected & number of bytes moved */
 #define MAX_BLOCKS 10
 #define MAX_BYTES  4096
 
@@ -94,6 +94,7 @@ static void check(struct icgcb const * const b)
     idx += b->e[idx].size / UNIT;
     zhe_assert(idx == b->sentinel);
     zhe_assert(b->freespace == freespace);
+    zhe_assert(b->need == 0 || b->need > b->e[b->openspace].size);
 }
 
 void zhe_icgcb_init(struct icgcb * const b, uripos_t size)
@@ -101,6 +102,7 @@ void zhe_icgcb_init(struct icgcb * const b, uripos_t size)
     zhe_assert(sizeof(struct icgcb) <= size && size < (URIPOS_INVALID & ~(UNIT - 1)) - UNIT);
     b->freespace = (uripos_t)(size - offsetof(struct icgcb, e) - UNIT) & ~(UNIT - 1);
     b->size      = b->freespace + offsetof(struct icgcb, e) + UNIT;
+    b->need      = 0;
     b->firstfree = 0;
     b->openspace = 0;
     b->sentinel  = b->freespace / UNIT;
@@ -143,6 +145,9 @@ enum icgcb_alloc_result zhe_icgcb_alloc(void ** const ptr, struct icgcb * const
     if (b->freespace < sizeA) {
         res = IAR_NOSPACE;
     } else if (b->e[b->openspace].size < sizeA) {
+        if (sizeA > b->need) {
+            b->need = sizeA;
+        }
         res = IAR_AGAIN;
     } else {
         struct icgcb_hdr * const e = &b->e[b->openspace];
@@ -163,21 +168,39 @@ enum icgcb_alloc_result zhe_icgcb_alloc(void ** const ptr, struct icgcb * const
         e->size = UNIT + size;
         e->ref = ref;
         *ptr = e + 1;
+        if (sizeA >= b->need) {
+            /* presumably the retry of the one that failed */
+            b->need = 0;
+        }
         res = IAR_OK;
     }
     check(b);
     return res;
 }
 
+uripos_t zhe_icgcb_garbage(struct icgcb const * const b)
+{
+    return b->freespace - b->e[b->openspace].size;
+}
+
+uripos_t zhe_icgcb_openspace(struct icgcb const * const b)
+{
+    return (b->e[b->openspace].size < UNIT) ? 0 : b->e[b->openspace].size - UNIT;
+}
+
 void zhe_icgcb_gc(struct icgcb * const b, void (*move_cb)(uripos_t ref, void *newptr, void *arg), void *arg)
 {
-    uripos_t blocks = 0, bytes = 0;
 #if URIPOS_MAX <= MAX_BYTES
-#define BYTES_WITHIN_LIMIT(bytes) true
+    (void)zhe_icgcb_gc_budget(b, MAX_BLOCKS, URIPOS_MAX, move_cb, arg);
 #else
-#define BYTES_WITHIN_LIMIT(bytes) ((bytes) < MAX_BYTES)
+    (void)zhe_icgcb_gc_budget(b, MAX_BLOCKS, MAX_BYTES, move_cb, arg);
 #endif
-    while (b->firstfree != b->openspace && blocks++ < MAX_BLOCKS && BYTES_WITHIN_LIMIT(bytes)) {
+}
+
+uripos_t zhe_icgcb_gc_budget(struct icgcb * const b, uripos_t maxblocks, uripos_t maxbytes, void (*move_cb)(uripos_t ref, void *newptr, void *arg), void *arg)
+{
+    uripos_t blocks = 0, bytes = 0;
+    while (b->firstfree != b->openspace && blocks++ < maxblocks && bytes < maxbytes) {
         struct icgcb_hdr * const e = &b->e[b->firstfree];
         struct icgcb_hdr * const ne = e + e->size / UNIT;
         if (ne->ref != URIPOS_INVALID) {
@@ -194,10 +217,14 @@ void zhe_icgcb_gc(struct icgcb * const b, void (*move_cb)(uripos_t ref, void *ne
             e->size += ne->size;
             if (ne == &b->e[b->openspace]) {
                 b->openspace = b->firstfree;
+                if (b->need <= e->size) {
+                    b->need = 0;
+                }
             }
         }
         check(b);
     }
+    return bytes;
 }
 
 #endif /* ZHE_NEED_ICGCB */
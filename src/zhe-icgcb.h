@@ -26,7 +26,7 @@ struct icgcb_hdr {
 
 struct icgcb {
     uripos_t size;
-    uripos_t pad;
+    uripos_t need;      /* largest allocation (incl. header) that failed with IAR_AGAIN and hasn't fit since, 0 if none */
     uripos_t freespace; /* total free space, that is, buf size - allocated (incl. headers) - 1 header */
     uripos_t firstfree; /* index in e[], first free block, GC starts here */
     uripos_t openspace; /* index in e[], nothing to the end of the buffer, allocations happen here */
@@ -44,6 +44,14 @@ void zhe_icgcb_init(struct icgcb * const b, uripos_t size);
 void zhe_icgcb_free(struct icgcb * const b, void * const ptr);
 enum icgcb_alloc_result zhe_icgcb_alloc(void ** const ptr, struct icgcb * const b, uripos_t size, uripos_t ref);
 void zhe_icgcb_gc(struct icgcb * const b, void (*move_cb)(uripos_t ref, void *newptr, void *arg), void *arg);
+/* Collects garbage until there is none left, MAXBLOCKS blocks have been inspected or at least
+   MAXBYTES bytes have been moved; returns the number of bytes moved. Open space only grows when
+   the last of the garbage is collected. */
+uripos_t zhe_icgcb_gc_budget(struct icgcb * const b, uripos_t maxblocks, uripos_t maxbytes, void (*move_cb)(uripos_t ref, void *newptr, void *arg), void *arg);
+/* Free space not at the end of the buffer, that is, the space GC can still recover */
+uripos_t zhe_icgcb_garbage(struct icgcb const * const b);
+/* Size of the largest allocation that can currently succeed */
+uripos_t zhe_icgcb_openspace(struct icgcb const * const b);
 uripos_t zhe_icgcb_getsize(struct icgcb const * const b, const void *ptr);
 
 #endif /* ZHE_NEED_ICGCB */
@@ -11,6 +11,16 @@
 #define INFIX_WITH_SIZE1(name, size, suf) name##size##suf
 #define INFIX_WITH_SIZE(name, size, suf) INFIX_WITH_SIZE1(name, size, suf)
 
+#if ENABLE_STATS
+#include "zhe-stats.h"
+extern struct zhe_stats zhe_gstats;
+extern unsigned zhe_synch_sent;
+void zhe_note_hist_decls_done(peeridx_t peeridx, zhe_time_t tnow);
+#define ZSTAT(stmt) do { stmt; } while (0)
+#else
+#define ZSTAT(stmt) do { } while (0)
+#endif
+
 struct out_conduit;
 struct out_mconduit;
 struct in_conduit;
@@ -21,6 +31,8 @@ struct peerid {
 };
 
 bool zhe_established_peer(peeridx_t peeridx);
+peeridx_t zhe_established_peers_first(void);
+peeridx_t zhe_established_peers_next(peeridx_t peeridx);
 int zhe_compare_peer_ids_for_peeridx(peeridx_t a, peeridx_t b);
 int zhe_xmitw_hasspace(const struct out_conduit *c, zhe_paysize_t sz);
 void zhe_pack_reserve(zhe_address_t *dst, struct out_conduit *oc, zhe_paysize_t cnt, zhe_time_t tnow);
@@ -31,8 +43,13 @@ uint16_t zhe_pack_locs_calcsize(void);
 void zhe_pack_locs(void);
 void zhe_oc_hit_full_window(struct out_conduit *c, zhe_time_t tnow);
 int zhe_oc_am_draining_window(const struct out_conduit *c);
+/* Sequence number of the next reliable message, and whether all messages before SEQ have been
+   acknowledged (by all peers in the case of a multicast conduit) */
+seq_t zhe_oc_next_seq(const struct out_conduit *c);
+bool zhe_oc_acked_upto(const struct out_conduit *c, seq_t seq);
 bool zhe_out_conduit_is_connected(cid_t cid);
 void zhe_pack_msend(zhe_time_t tnow);
+void zhe_pack_latency_budget(zhe_time_t budget, zhe_time_t tnow);
 zhe_msgsize_t zhe_oc_pack_payload_msgprep(seq_t *s, struct out_conduit *c, int relflag, zhe_paysize_t sz, zhe_time_t tnow);
 void zhe_oc_pack_copyrel(struct out_conduit *c, zhe_msgsize_t from);
 void zhe_oc_pack_payload(struct out_conduit *c, int relflag, zhe_paysize_t sz, const void *vdata);
@@ -13,7 +13,7 @@
 #define MSDATA              7
 #define MBDATA              8 /* FIXME: NIY */
 #define MWDATA              9
-#define MQUERY             10 /* FIXME: NIY */
+#define MQUERY             10
 #define MPULL              11 /* FIXME: NIY */
 #define MPING              12
 #define MPONG              13
@@ -27,6 +27,7 @@
 #define MSDDATA            21 /* FIXME: NIY */
 #define MBDDATA            22 /* FIXME: NIY */
 #define MWDDATA            23 /* FIXME: NIY */
+#define MREPLY             24 /* zhe extension: reply to MQUERY */
 
 #define MKIND            0x1f
 
@@ -39,6 +40,7 @@
 #define MZFLAG            128
 #define MAFLAG            128
 #define MUFLAG            128
+#define MFFLAG            128
 
 #define DRESOURCE           1
 #define DPUB                2
@@ -72,6 +74,7 @@
 #define PROP_COMMITMODE    10
 #define PROP_AUTHDATA      12
 #define PROP_CLIENTHASH    14
+#define PROP_SUBFILTER     16
 
 #define MSCOUT_BROKER       1
 #define MSCOUT_DURABILITY   2
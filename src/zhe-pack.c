@@ -309,11 +309,16 @@ void zhe_pack_mkeepalive(zhe_address_t *dst, const struct peerid *ownid, zhe_tim
     zhe_pack_vec(ownid->len, ownid->id);
 }
 
-int zhe_oc_pack_msdata(struct out_conduit *c, int relflag, zhe_rid_t rid, zhe_paysize_t payloadlen, zhe_time_t tnow)
+zhe_paysize_t zhe_msdata_size(zhe_rid_t rid, zhe_paysize_t payloadlen)
 {
     /* Use worst-case number of bytes for sequence number, instead of getting the sequence number
        earlier than as an output of oc_pack_payload_msgprep and using the exact value */
-    const zhe_paysize_t sz = 1 + WORST_CASE_SEQ_SIZE + zhe_pack_ridreq(rid) + zhe_pack_vle16req(payloadlen) + payloadlen;
+    return 1 + WORST_CASE_SEQ_SIZE + zhe_pack_ridreq(rid) + zhe_pack_vle16req(payloadlen) + payloadlen;
+}
+
+int zhe_oc_pack_msdata(struct out_conduit *c, int relflag, zhe_rid_t rid, zhe_paysize_t payloadlen, zhe_time_t tnow)
+{
+    const zhe_paysize_t sz = zhe_msdata_size(rid, payloadlen);
     const uint8_t hdr = MSDATA | (relflag ? MRFLAG : 0);
     zhe_msgsize_t from;
     seq_t s;
@@ -381,6 +386,65 @@ void zhe_oc_pack_mwdata_done(struct out_conduit *c, int relflag, zhe_time_t tnow
     zhe_oc_pack_msdata_done(c, relflag, tnow);
 }
 
+int zhe_oc_pack_mquery(struct out_conduit *c, uint16_t qid, zhe_paysize_t urisz, const void *uri, zhe_time_t tnow)
+{
+    const zhe_paysize_t sz = 1 + WORST_CASE_SEQ_SIZE + zhe_pack_vle16req(qid) + zhe_pack_vle16req(urisz) + urisz;
+    zhe_msgsize_t from;
+    seq_t s;
+    if (!zhe_xmitw_hasspace(c, sz)) {
+        zhe_oc_hit_full_window(c, tnow);
+        return 0;
+    }
+    from = zhe_oc_pack_payload_msgprep(&s, c, 1, sz, tnow);
+    zhe_pack1(MQUERY | MRFLAG);
+    zhe_pack_seq(s);
+    zhe_pack_vle16(qid);
+    zhe_pack_vec(urisz, uri);
+    zhe_oc_pack_copyrel(c, from);
+    zhe_oc_pack_payload_done(c, 1, tnow);
+    return 1;
+}
+
+int zhe_oc_pack_mreply(struct out_conduit *c, const struct peerid *qpid, uint16_t qid, zhe_rid_t rid, zhe_paysize_t payloadlen, zhe_time_t tnow)
+{
+    /* RID = 0 is the final reply, which has neither a RID nor a payload */
+    const zhe_paysize_t sz = 1 + WORST_CASE_SEQ_SIZE + zhe_pack_vle16req(qpid->len) + qpid->len + zhe_pack_vle16req(qid) + ((rid == 0) ? 0 : zhe_pack_ridreq(rid) + zhe_pack_vle16req(payloadlen) + payloadlen);
+    zhe_msgsize_t from;
+    seq_t s;
+    if (!zhe_xmitw_hasspace(c, sz)) {
+        zhe_oc_hit_full_window(c, tnow);
+        return 0;
+    }
+    from = zhe_oc_pack_payload_msgprep(&s, c, 1, sz, tnow);
+    zhe_pack1(MREPLY | MRFLAG | ((rid == 0) ? MFFLAG : 0));
+    zhe_pack_seq(s);
+    zhe_pack_vec(qpid->len, qpid->id);
+    zhe_pack_vle16(qid);
+    if (rid != 0) {
+        zhe_pack_rid(rid);
+        zhe_pack_vle16(payloadlen);
+    }
+    zhe_oc_pack_copyrel(c, from);
+    return 1;
+}
+
+void zhe_oc_pack_mreply_payload(struct out_conduit *c, zhe_paysize_t sz, const void *vdata)
+{
+    zhe_oc_pack_payload(c, 1, sz, vdata);
+}
+
+void zhe_oc_pack_mreply_done(struct out_conduit *c, zhe_time_t tnow)
+{
+    zhe_oc_pack_payload_done(c, 1, tnow);
+}
+
+bool zhe_oc_mdeclare_fits(const struct out_conduit *c, uint8_t ndecls, size_t decllen)
+{
+    /* at most 2 bytes for the conduit id preceding it (see zhe_pack_mconduit_reqsize) */
+    const size_t sz = 1 + WORST_CASE_SEQ_SIZE + zhe_pack_vle16req(ndecls) + decllen;
+    return sz <= TRANSPORT_MTU - 2 && zhe_xmitw_hasspace(c, (zhe_paysize_t)sz);
+}
+
 int zhe_oc_pack_mdeclare(struct out_conduit *c, bool committed, uint8_t ndecls, zhe_paysize_t decllen, zhe_msgsize_t *from, zhe_time_t tnow)
 {
     const zhe_paysize_t sz = 1 + WORST_CASE_SEQ_SIZE + zhe_pack_vle16req(ndecls) + decllen;
@@ -390,6 +454,7 @@ int zhe_oc_pack_mdeclare(struct out_conduit *c, bool committed, uint8_t ndecls,
         return 0;
     }
     *from = zhe_oc_pack_payload_msgprep(&s, c, 1, sz, tnow);
+    ZSTAT(zhe_gstats.decls_out += ndecls);
     zhe_pack1(MDECLARE | (committed ? MCFLAG : 0));
     zhe_pack_seq(s);
     zhe_pack_vle16(ndecls);
@@ -400,6 +465,11 @@ void zhe_oc_pack_mdeclare_done(struct out_conduit *c, zhe_msgsize_t from, zhe_ti
 {
     zhe_oc_pack_copyrel(c, from);
     zhe_oc_pack_payload_done(c, 1, tnow);
+#if LATENCY_BUDGET != 0
+    /* declarations are sent in batches from housekeeping, don't send one packet per declaration
+       when data is sent without packing */
+    zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
+#endif
 }
 
 void zhe_pack_dresource(zhe_rid_t rid, zhe_paysize_t urisz, const uint8_t *res)
@@ -415,11 +485,35 @@ void zhe_pack_dpub(zhe_rid_t rid)
     zhe_pack_rid(rid);
 }
 
-void zhe_pack_dsub(zhe_rid_t rid)
+void zhe_pack_dsub(zhe_rid_t rid, const struct zhe_subfilter *filter)
 {
-    zhe_pack1(DSUB);
+    zhe_pack1(DSUB | (filter ? DPFLAG : 0));
     zhe_pack_rid(rid);
     zhe_pack1(SUBMODE_PUSH); /* FIXME: should be a parameter */
+    if (filter) {
+        /* single property: op, offset, value */
+        zhe_assert(filter->len >= 1 && filter->len <= ZHE_SUBFILTER_MAXLEN);
+        zhe_pack_vle16(1);
+        zhe_pack1(PROP_SUBFILTER);
+        zhe_pack_vle16((uint16_t)(1 + zhe_pack_vle16req(filter->offset) + filter->len));
+        zhe_pack1((uint8_t)filter->op);
+        zhe_pack_vle16(filter->offset);
+        for (uint8_t i = 0; i < filter->len; i++) {
+            zhe_pack1(filter->value[i]);
+        }
+    }
+}
+
+void zhe_pack_dfpub(zhe_rid_t rid)
+{
+    zhe_pack1(DFPUB);
+    zhe_pack_rid(rid);
+}
+
+void zhe_pack_dfsub(zhe_rid_t rid)
+{
+    zhe_pack1(DFSUB);
+    zhe_pack_rid(rid);
 }
 
 void zhe_pack_dcommit(uint8_t commitid)
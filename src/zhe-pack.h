@@ -6,6 +6,7 @@
 
 struct out_conduit;
 struct peerid;
+struct zhe_subfilter;
 
 void zhe_pack_vle8(uint8_t x);
 zhe_paysize_t zhe_pack_vle8req(uint8_t x);
@@ -31,17 +32,30 @@ void zhe_pack_macknack(zhe_address_t *dst, cid_t cid, seq_t seq, uint32_t mask,
 void zhe_pack_mping(zhe_address_t *dst, uint16_t hash, zhe_time_t tnow);
 void zhe_pack_mpong(zhe_address_t *dst, uint16_t hash, zhe_time_t tnow);
 void zhe_pack_mkeepalive(zhe_address_t *dst, const struct peerid *ownid, zhe_time_t tnow);
+/* Size of an MSDATA message for RID with PAYLOADLEN bytes of data, as stored in a transmit window
+   (not counting the preceding length) */
+zhe_paysize_t zhe_msdata_size(zhe_rid_t rid, zhe_paysize_t payloadlen);
 int zhe_oc_pack_msdata(struct out_conduit *c, int relflag, zhe_rid_t rid, zhe_paysize_t payloadlen, zhe_time_t tnow);
 void zhe_oc_pack_msdata_payload(struct out_conduit *c, int relflag, zhe_paysize_t sz, const void *vdata);
 void zhe_oc_pack_msdata_done(struct out_conduit *c, int relflag, zhe_time_t tnow);
 int zhe_oc_pack_mwdata(struct out_conduit *c, int relflag, zhe_paysize_t urisz, const void *uri, zhe_paysize_t payloadlen, zhe_time_t tnow);
 void zhe_oc_pack_mwdata_payload(struct out_conduit *c, int relflag, zhe_paysize_t sz, const void *vdata);
 void zhe_oc_pack_mwdata_done(struct out_conduit *c, int relflag, zhe_time_t tnow);
+int zhe_oc_pack_mquery(struct out_conduit *c, uint16_t qid, zhe_paysize_t urisz, const void *uri, zhe_time_t tnow);
+/* A reply for RID = 0 is the final one and must be followed directly by mreply_done */
+int zhe_oc_pack_mreply(struct out_conduit *c, const struct peerid *qpid, uint16_t qid, zhe_rid_t rid, zhe_paysize_t payloadlen, zhe_time_t tnow);
+void zhe_oc_pack_mreply_payload(struct out_conduit *c, zhe_paysize_t sz, const void *vdata);
+void zhe_oc_pack_mreply_done(struct out_conduit *c, zhe_time_t tnow);
+/* Whether a DECLARE message with NDECLS declarations totalling DECLLEN bytes fits in a packet and
+   in the transmit window of C, i.e., whether zhe_oc_pack_mdeclare will succeed */
+bool zhe_oc_mdeclare_fits(const struct out_conduit *c, uint8_t ndecls, size_t decllen);
 int zhe_oc_pack_mdeclare(struct out_conduit *c, bool committed, uint8_t ndecls, zhe_paysize_t decllen, zhe_msgsize_t *from, zhe_time_t tnow);
 void zhe_oc_pack_mdeclare_done(struct out_conduit *c, zhe_msgsize_t from, zhe_time_t tnow);
 void zhe_pack_dresource(zhe_rid_t rid, zhe_paysize_t urisz, const uint8_t *uri);
 void zhe_pack_dpub(zhe_rid_t rid);
-void zhe_pack_dsub(zhe_rid_t rid);
+void zhe_pack_dsub(zhe_rid_t rid, const struct zhe_subfilter *filter);
+void zhe_pack_dfpub(zhe_rid_t rid);
+void zhe_pack_dfsub(zhe_rid_t rid);
 void zhe_pack_dcommit(uint8_t commitid);
 void zhe_pack_dresult(uint8_t commitid, uint8_t status, zhe_rid_t rid);
 
@@ -34,6 +34,11 @@ size_t zhe_platform_addr2string(const struct zhe_platform *pf, char *str, size_t
  fatal errors. Should be non-blocking. */
 int zhe_platform_send(struct zhe_platform *pf, const void *buf, size_t size, const struct zhe_address *dst);
 
+/* Only for platforms with TRANSPORT_BATCHING set: called whenever zhe has no further packets to
+ send for the time being, i.e., at the end of zhe_flush, zhe_housekeeping and zhe_input and for
+ messages with a latency budget of 0, and must then send any packets it is still holding. */
+void zhe_platform_flush(struct zhe_platform *pf);
+
 /* Return true if the source address of outgoing packets has changed since last call, false if not. Returning true when nothing changed will cause unnecessary keepalives to be sent, returning false when in fact it did change causes trouble. Called periodically (SCOUT_INTERVAL) so it should be cheap. */
 bool zhe_platform_needs_keepalive(struct zhe_platform *pf);
 
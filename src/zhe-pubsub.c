@@ -14,6 +14,7 @@
 #include "zhe-uri.h"
 #include "zhe-simpleset.h"
 #include "zhe-arylist.h"
+#include "zhe-subqueue.h"
 
 /* The "xmitcid/xmitneed" guard on a subscription can't really deal with unicast conduits, unless there can be at most one peer. */
 #if MAX_PEERS_1 == 1
@@ -35,34 +36,78 @@ struct subtable {
     /* */
     void *arg;
     zhe_subhandler_t handler;
+    zhe_subbatchhandler_t bhandler; /* non-NULL: called instead of handler */
+#if ENABLE_SUBFILTERS
+    bool hasfilter;
+    struct zhe_subfilter filter;
+#endif
 };
 static struct subtable subs[ZHE_MAX_SUBSCRIPTIONS];
 typedef struct rid2subtable {
     zhe_rid_t rid;
     zhe_subidx_t subidx;
 } rid2subtable_t;
-/* FIXME: should support deleting pubs, subs, &c., and then a we need a linked list instead of a simple maximum; also use max_subidx for number of entries in use also fails at that point*/
-static zhe_subidx_t max_subidx;
+
+/* Publication and subscription slots are on either the free or the in-use list, threaded through
+   the prev/next arrays, so that creating and deleting them is O(1) and iterating over them
+   doesn't visit unused slots */
+enum slotlist {
+    SLOTLIST_FREE,
+    SLOTLIST_INUSE
+};
+#define SUBIDX_NONE ((zhe_subidx_inner_t)ZHE_MAX_SUBSCRIPTIONS)
+static zhe_subidx_inner_t sublist_head[2];
+static zhe_subidx_inner_t sublist_prev[ZHE_MAX_SUBSCRIPTIONS];
+static zhe_subidx_inner_t sublist_next[ZHE_MAX_SUBSCRIPTIONS];
 
 #define RID2SUB_RID_CMP(key, elem) ((key) == (elem) ? 0 : ((key) < (elem) ? -1 : 1))
 #define RID2SUB_RID(elem) ((elem).rid)
 MAKE_PACKAGE_SPEC(SIMPLESET, (static, zhe_rid2sub, zhe_rid_t, struct rid2subtable, zhe_subidx_t, ZHE_MAX_SUBSCRIPTIONS), type)
-MAKE_PACKAGE_BODY(SIMPLESET, (static, zhe_rid2sub, zhe_rid_t, struct rid2subtable, zhe_subidx_t, .idx, RID2SUB_RID_CMP, RID2SUB_RID, ZHE_MAX_SUBSCRIPTIONS), init, search, insert)
+MAKE_PACKAGE_BODY(SIMPLESET, (static, zhe_rid2sub, zhe_rid_t, struct rid2subtable, zhe_subidx_t, .idx, RID2SUB_RID_CMP, RID2SUB_RID, ZHE_MAX_SUBSCRIPTIONS), init, search, insert, delete)
 static zhe_rid2sub_t rid2sub;
 
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
 MAKE_PACKAGE_SPEC(ARYLIST, (static, zhe_residx2sub, zhe_subidx_t, zhe_subidx_t, ZHE_MAX_SUBSCRIPTIONS), type, iter_type)
-MAKE_PACKAGE_BODY(ARYLIST, (static, zhe_residx2sub, zhe_subidx_t, zhe_subidx_t, .idx, ZHE_MAX_SUBSCRIPTIONS), init, insert, count, iter_first, iter_next)
+MAKE_PACKAGE_BODY(ARYLIST, (static, zhe_residx2sub, zhe_subidx_t, zhe_subidx_t, .idx, ZHE_MAX_SUBSCRIPTIONS), init, insert, delete, count, iter_first, iter_next)
 static zhe_residx2sub_t residx2sub[ZHE_MAX_RESOURCES];
 #endif
 
 struct pubtable {
     cid_t cid;
     zhe_rid_t rid;
+    zhe_time_t latency_budget;
+#if HAVE_AUTO_UNICAST
+    /* CURCID is the conduit currently used, AUTOCID the one to use given the remote subscriptions
+       as of generation AUTOGEN; if UNACKED, reliable samples up to LASTSEQ went out over CURCID and
+       it can't be abandoned until those have been acknowledged; MAXSZ is the size of the largest
+       reliable sample written so far */
+    cid_t curcid;
+    cid_t autocid;
+    uint32_t autogen;
+    bool unacked;
+    seq_t lastseq;
+    zhe_paysize_t maxsz;
+#endif
+#if ENABLE_STATS
+    struct zhe_pub_stats stats;
+#endif
 };
 static struct pubtable pubs[ZHE_MAX_PUBLICATIONS];
-/* FIXME: should support deleting pubs, subs, &c., and then a we need a linked list instead of a simple maximum */
-static zhe_pubidx_t max_pubidx;
+#define PUBIDX_NONE ((zhe_pubidx_inner_t)ZHE_MAX_PUBLICATIONS)
+static zhe_pubidx_inner_t publist_head[2];
+static zhe_pubidx_inner_t publist_prev[ZHE_MAX_PUBLICATIONS];
+static zhe_pubidx_inner_t publist_next[ZHE_MAX_PUBLICATIONS];
+
+/* RIDs of which the last local subscription (in client mode also: publication) has been deleted,
+   to be undeclared along with the fresh declarations; an entry is cleared when the RID is
+   subscribed to (published) again before the undeclaration went out, and the queue is emptied
+   once all fresh declarations have been sent */
+static zhe_rid_t forget_subs[ZHE_MAX_SUBSCRIPTIONS];
+static zhe_subidx_inner_t n_forget_subs;
+#if MAX_PEERS == 0
+static zhe_rid_t forget_pubs[ZHE_MAX_PUBLICATIONS];
+static zhe_pubidx_inner_t n_forget_pubs;
+#endif
 
 /* FIXME: should switch from publisher determines reliability to subscriber determines
  reliability, i.e., publisher reliability bit gets set to
@@ -91,6 +136,21 @@ static zhe_rsubcount_t pubs_rsubcounts[ZHE_MAX_PUBLICATIONS];
 static DECL_BITSET(pubs_rsubs, ZHE_MAX_PUBLICATIONS);
 #endif /* ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0 */
 
+#if HAVE_TRANSIENT_CACHE
+/* Last-value cache: the latest sample of (at most ZHE_MAX_TRANSIENT) transient resources, written
+   locally or received, with the peers that subscribed to a matching resource since it was last
+   pushed to them. Entries are never released, a full cache simply doesn't take new resources. */
+struct lvc_entry {
+    zhe_rid_t rid; /* 0: unused */
+    zhe_paysize_t size;
+    DECL_BITSET(push, MAX_PEERS);
+    uint8_t data[ZHE_MAX_TRANSIENT_PAYLOAD];
+};
+static struct lvc_entry lvc[ZHE_MAX_TRANSIENT];
+static bool lvc_push_pending;
+static DECL_BITSET(pubs_istransient, ZHE_MAX_PUBLICATIONS);
+#endif
+
 #if MAX_PEERS > 0
 typedef struct {
 #if ZHE_MAX_SUBSCRIPTIONS_PER_PEER <= UINT8_MAX
@@ -106,19 +166,24 @@ typedef struct {
 #define RID_CMP(key, elem) ((key) == (elem) ? 0 : ((key) < (elem) ? -1 : 1))
 #define RID_RID(elem) ((elem))
 MAKE_PACKAGE_SPEC(SIMPLESET, (static, zhe_ridtable, zhe_rid_t, zhe_rid_t, zhe_rsubidx_t, ZHE_MAX_SUBSCRIPTIONS_PER_PEER), type, iter_type)
-MAKE_PACKAGE_BODY(SIMPLESET, (static, zhe_ridtable, zhe_rid_t, zhe_rid_t, zhe_rsubidx_t, .rididx, RID_CMP, RID_RID, ZHE_MAX_SUBSCRIPTIONS_PER_PEER), search, count, insert, iter_first, iter_next)
-#if ZHE_MAX_URISPACE == 0
+MAKE_PACKAGE_BODY(SIMPLESET, (static, zhe_ridtable, zhe_rid_t, zhe_rid_t, zhe_rsubidx_t, .rididx, RID_CMP, RID_RID, ZHE_MAX_SUBSCRIPTIONS_PER_PEER), search, count, insert, delete, iter_first, iter_next)
+#if ZHE_MAX_URISPACE == 0 || HAVE_RSUB_FILTERS
 MAKE_PACKAGE_BODY(SIMPLESET, (static, zhe_ridtable, zhe_rid_t, zhe_rid_t, zhe_rsubidx_t, .rididx, RID_CMP, RID_RID, ZHE_MAX_SUBSCRIPTIONS_PER_PEER), contains)
 #endif
 #endif
 
 /* FIXME: at some point #rsubs in precommit + #rsubs in peers_rsubs get added and limited, but as overlap between the two sets is allowed, it can reject a valid declaration */
 
+/* Subscriptions deleted in a transaction (rforgets) are kept apart from those added (rsubs), the
+   two sets are disjoint and the last declaration for a RID in the transaction is the one that
+   counts */
 struct precommit {
 #if MAX_PEERS == 0
     DECL_BITSET(rsubs, ZHE_MAX_PUBLICATIONS);
+    DECL_BITSET(rforgets, ZHE_MAX_PUBLICATIONS);
 #else
     zhe_ridtable_t rsubs; /* FIXME: this should be limited by accepting a limited transaction size */
+    zhe_ridtable_t rforgets;
 #endif
     uint8_t result;
     zhe_rid_t invalid_rid;
@@ -134,6 +199,12 @@ static struct peer_rsubs peers_rsubs[MAX_PEERS];
 static struct precommit precommit[MAX_PEERS_1];
 static struct precommit precommit_curpkt;
 
+#if HAVE_AUTO_UNICAST
+/* Incremented whenever the set of remote subscriptions changes, so a publication need only work
+   out again which conduit to use when it is different from the one it last looked at */
+static uint32_t rsubs_gen;
+#endif
+
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
 static bool pub_sub_match(zhe_rid_t a, zhe_rid_t b)
 {
@@ -152,10 +223,320 @@ static bool pub_sub_match(zhe_rid_t a, zhe_rid_t b)
 }
 #endif
 
+#if ENABLE_SUBFILTERS
+static bool subfilter_valid(const struct zhe_subfilter *f)
+{
+    return (unsigned)f->op <= (unsigned)ZHE_SUBFILTER_GE && f->len >= 1 && f->len <= ZHE_SUBFILTER_MAXLEN;
+}
+
+static bool subfilter_equal(const struct zhe_subfilter *a, const struct zhe_subfilter *b)
+{
+    return a->op == b->op && a->offset == b->offset && a->len == b->len && memcmp(a->value, b->value, a->len) == 0;
+}
+
+static bool subfilter_match(const struct zhe_subfilter *f, zhe_paysize_t sz, const void *data)
+{
+    if (f->offset > sz || sz - f->offset < f->len) {
+        return false;
+    }
+    const int c = memcmp((const uint8_t *)data + f->offset, f->value, f->len);
+    switch (f->op) {
+        case ZHE_SUBFILTER_EQ: return c == 0;
+        case ZHE_SUBFILTER_NE: return c != 0;
+        case ZHE_SUBFILTER_LT: return c < 0;
+        case ZHE_SUBFILTER_LE: return c <= 0;
+        case ZHE_SUBFILTER_GT: return c > 0;
+        case ZHE_SUBFILTER_GE: return c >= 0;
+    }
+    return true;
+}
+#endif
+
+#if HAVE_RSUB_FILTERS
+/* Filters of remote subscriptions, one entry per (peer, RID) with a filtered subscription, for
+   which PUBS caches the matching local publications. A peer may declare the same RID several
+   times; once it has done so without a filter or with a different one, the entry is marked
+   UNFILTERED. A subscription for which no entry could be created is simply unfiltered. */
+struct rsubfilter {
+    zhe_rid_t rid; /* 0: unused */
+    peeridx_t peeridx;
+    bool unfiltered;
+    struct zhe_subfilter filter;
+    DECL_BITSET(pubs, ZHE_MAX_PUBLICATIONS);
+};
+static struct rsubfilter rsubfilters[ZHE_MAX_RSUB_FILTERS];
+
+static struct rsubfilter *rsubfilter_find(peeridx_t peeridx, zhe_rid_t rid)
+{
+    for (size_t i = 0; i < ZHE_MAX_RSUB_FILTERS; i++) {
+        if (rsubfilters[i].rid == rid && rsubfilters[i].peeridx == peeridx) {
+            return &rsubfilters[i];
+        }
+    }
+    return NULL;
+}
+
+void zhe_rsub_note_filter(peeridx_t peeridx, zhe_rid_t rid, const struct zhe_subfilter *filter)
+{
+    struct rsubfilter *e;
+    if ((e = rsubfilter_find(peeridx, rid)) != NULL) {
+        if (!e->unfiltered && (filter == NULL || !subfilter_equal(&e->filter, filter))) {
+            ZT(PUBSUB, "rsub_note_filter peeridx %u rid %ju - now unfiltered", peeridx, (uintmax_t)rid);
+            e->unfiltered = true;
+        }
+    } else if (filter == NULL || zhe_ridtable_contains(&peers_rsubs[peeridx].rsubs, rid)) {
+        /* not filtered or already subscribed to without one */
+    } else if ((e = rsubfilter_find(PEERIDX_INVALID, 0)) == NULL) {
+        ZT(PUBSUB, "rsub_note_filter peeridx %u rid %ju - no space", peeridx, (uintmax_t)rid);
+    } else {
+        ZT(PUBSUB, "rsub_note_filter peeridx %u rid %ju - entry %u", peeridx, (uintmax_t)rid, (unsigned)(e - rsubfilters));
+        e->rid = rid;
+        e->peeridx = peeridx;
+        e->unfiltered = false;
+        e->filter = *filter;
+        memset(e->pubs, 0, sizeof(e->pubs));
+        for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
+            if (pub_sub_match(pubs[pubidx.idx].rid, rid)) {
+                zhe_bitset_set(e->pubs, pubidx.idx);
+            }
+        }
+    }
+}
+
+/* Drops the entry for (PEERIDX, RID), or all entries of PEERIDX if RID = 0 */
+static void rsubfilter_drop(peeridx_t peeridx, zhe_rid_t rid)
+{
+    for (size_t i = 0; i < ZHE_MAX_RSUB_FILTERS; i++) {
+        if (rsubfilters[i].rid != 0 && rsubfilters[i].peeridx == peeridx && (rid == 0 || rsubfilters[i].rid == rid)) {
+            memset(&rsubfilters[i], 0, sizeof(rsubfilters[i]));
+            rsubfilters[i].peeridx = PEERIDX_INVALID;
+        }
+    }
+}
+
+/* Whether the filters of all remote subscriptions matching PUBIDX reject the sample: every
+   remote subscription counted in pubs_rsubcounts that is filtered has exactly one entry */
+static bool rsubfilters_reject(zhe_pubidx_t pubidx, zhe_paysize_t sz, const void *data)
+{
+    zhe_rsubcount_t nreject = 0;
+    for (size_t i = 0; i < ZHE_MAX_RSUB_FILTERS; i++) {
+        const struct rsubfilter * const e = &rsubfilters[i];
+        if (e->rid == 0 || !zhe_bitset_test(e->pubs, pubidx.idx) || !zhe_ridtable_contains(&peers_rsubs[e->peeridx].rsubs, e->rid)) {
+            continue;
+        } else if (e->unfiltered || subfilter_match(&e->filter, sz, data)) {
+            return false;
+        }
+        nreject++;
+    }
+    return nreject == pubs_rsubcounts[pubidx.idx];
+}
+#endif
+
+#if HAVE_MCPARTITIONS
+/* Table mapping resources to multicast conduits (see struct zhe_mcpartition), so that samples only
+   go to the multicast group of the conduit and only the peers that joined it receive them */
+struct mcpartition {
+    const uint8_t *uriprefix; /* NULL: match on RID range */
+    size_t uriprefixsz;
+    zhe_rid_t ridmin, ridmax;
+    cid_t cid;
+};
+static struct mcpartition mcpartitions[ZHE_MAX_MCPARTITIONS];
+static size_t n_mcpartitions;
+
+bool zhe_mcpartitions_init(size_t n, const struct zhe_mcpartition *ps)
+{
+    if (n > ZHE_MAX_MCPARTITIONS) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (ps[i].cid >= N_OUT_MCONDUITS) {
+            return false;
+        } else if (ps[i].uriprefix == NULL) {
+            if (ps[i].ridmin > ps[i].ridmax) {
+                return false;
+            }
+        } else if (ZHE_MAX_URISPACE == 0 || strlen(ps[i].uriprefix) > ZHE_MAX_URILENGTH) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        struct mcpartition * const p = &mcpartitions[i];
+        p->uriprefix = (const uint8_t *)ps[i].uriprefix;
+        p->uriprefixsz = (p->uriprefix == NULL) ? 0 : strlen(ps[i].uriprefix);
+        p->ridmin = ps[i].ridmin;
+        p->ridmax = ps[i].ridmax;
+        p->cid = (cid_t)ps[i].cid;
+    }
+    n_mcpartitions = n;
+    return true;
+}
+
+/* Conduit to use for a resource with id RID (0 if none) and URI (URISZ = 0 if none), CID if it
+   isn't covered by the table */
+static cid_t mcpartition_cid(zhe_rid_t rid, zhe_paysize_t urisz, const uint8_t *uri, cid_t cid)
+{
+    for (size_t i = 0; i < n_mcpartitions; i++) {
+        const struct mcpartition * const p = &mcpartitions[i];
+        if (p->uriprefix == NULL ? (rid != 0 && p->ridmin <= rid && rid <= p->ridmax) : (urisz >= p->uriprefixsz && memcmp(uri, p->uriprefix, p->uriprefixsz) == 0)) {
+            return p->cid;
+        }
+    }
+    return cid;
+}
+#endif
+
+#if HAVE_TRANSIENT_CACHE
+static void lvc_store(zhe_rid_t rid, zhe_paysize_t sz, const void *data)
+{
+    struct lvc_entry *e = NULL;
+    for (size_t i = 0; i < ZHE_MAX_TRANSIENT; i++) {
+        if (lvc[i].rid == rid) {
+            e = &lvc[i];
+            break;
+        } else if (lvc[i].rid == 0 && e == NULL) {
+            e = &lvc[i];
+        }
+    }
+    if (e == NULL) {
+        ZT(PUBSUB, "lvc_store: rid %ju - cache full", (uintmax_t)rid);
+    } else if (sz > ZHE_MAX_TRANSIENT_PAYLOAD) {
+        /* better no value than a stale one */
+        ZT(PUBSUB, "lvc_store: rid %ju - too large (%u)", (uintmax_t)rid, (unsigned)sz);
+        if (e->rid == rid) {
+            memset(e, 0, sizeof(*e));
+        }
+    } else {
+        if (e->rid != rid) {
+            ZT(PUBSUB, "lvc_store: rid %ju - new entry %u", (uintmax_t)rid, (unsigned)(e - lvc));
+            memset(e->push, 0, sizeof(e->push));
+            e->rid = rid;
+        }
+        e->size = sz;
+        memcpy(e->data, data, sz);
+    }
+}
+
+/* Schedules pushing the cached values matching RID to PEERIDX, called when it subscribes to RID */
+static void lvc_sched_push(peeridx_t peeridx, zhe_rid_t rid)
+{
+    for (size_t i = 0; i < ZHE_MAX_TRANSIENT; i++) {
+        if (lvc[i].rid != 0 && pub_sub_match(lvc[i].rid, rid)) {
+            ZT(PUBSUB, "lvc_sched_push: peeridx %u rid %ju - entry %u rid %ju", peeridx, (uintmax_t)rid, (unsigned)i, (uintmax_t)lvc[i].rid);
+            zhe_bitset_set(lvc[i].push, peeridx);
+            lvc_push_pending = true;
+        }
+    }
+}
+
+void zhe_lvc_push(zhe_time_t tnow)
+{
+    if (!lvc_push_pending) {
+        return;
+    }
+    for (size_t i = 0; i < ZHE_MAX_TRANSIENT; i++) {
+        struct lvc_entry * const e = &lvc[i];
+        if (e->rid == 0) {
+            continue;
+        }
+        for (peeridx_t peeridx = 0; peeridx < MAX_PEERS; peeridx++) {
+            if (!zhe_bitset_test(e->push, peeridx)) {
+                continue;
+            }
+#if HAVE_UNICAST_CONDUIT
+            const cid_t cid = -(cid_t)peeridx-1;
+#else
+            const cid_t cid = 0;
+#endif
+            struct out_conduit * const oc = zhe_out_conduit_from_cid(cid);
+            if (!zhe_out_conduit_is_connected(cid)) {
+                zhe_bitset_clear(e->push, peeridx);
+                continue;
+            } else if (zhe_oc_am_draining_window(oc) || !zhe_oc_pack_msdata(oc, 1, e->rid, e->size, tnow)) {
+                /* try again on the next call */
+                return;
+            }
+            ZT(PUBSUB, "lvc_push: peeridx %u rid %ju", peeridx, (uintmax_t)e->rid);
+            zhe_oc_pack_msdata_payload(oc, 1, e->size, e->data);
+            zhe_oc_pack_msdata_done(oc, 1, tnow);
+            zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
+            ZSTAT(zhe_gstats.transient_pushed++);
+#if HAVE_UNICAST_CONDUIT
+            zhe_bitset_clear(e->push, peeridx);
+#else
+            /* sent over multicast, so every peer waiting for it gets it */
+            memset(e->push, 0, sizeof(e->push));
+            break;
+#endif
+        }
+    }
+    lvc_push_pending = false;
+}
+#endif
+
+static void sublist_init(void)
+{
+    /* all slots free, in order of increasing index so the first subscriptions get the lowest ones */
+    sublist_head[SLOTLIST_FREE] = 0;
+    sublist_head[SLOTLIST_INUSE] = SUBIDX_NONE;
+    for (zhe_subidx_inner_t i = 0; i < ZHE_MAX_SUBSCRIPTIONS; i++) {
+        sublist_prev[i] = (i == 0) ? SUBIDX_NONE : (zhe_subidx_inner_t)(i - 1);
+        sublist_next[i] = (i == ZHE_MAX_SUBSCRIPTIONS - 1) ? SUBIDX_NONE : (zhe_subidx_inner_t)(i + 1);
+    }
+}
+
+static void sublist_move(zhe_subidx_inner_t idx, enum slotlist from, enum slotlist to)
+{
+    if (sublist_prev[idx] == SUBIDX_NONE) {
+        zhe_assert(sublist_head[from] == idx);
+        sublist_head[from] = sublist_next[idx];
+    } else {
+        sublist_next[sublist_prev[idx]] = sublist_next[idx];
+    }
+    if (sublist_next[idx] != SUBIDX_NONE) {
+        sublist_prev[sublist_next[idx]] = sublist_prev[idx];
+    }
+    sublist_prev[idx] = SUBIDX_NONE;
+    sublist_next[idx] = sublist_head[to];
+    if (sublist_head[to] != SUBIDX_NONE) {
+        sublist_prev[sublist_head[to]] = idx;
+    }
+    sublist_head[to] = idx;
+}
+
+static void publist_init(void)
+{
+    publist_head[SLOTLIST_FREE] = 0;
+    publist_head[SLOTLIST_INUSE] = PUBIDX_NONE;
+    for (zhe_pubidx_inner_t i = 0; i < ZHE_MAX_PUBLICATIONS; i++) {
+        publist_prev[i] = (i == 0) ? PUBIDX_NONE : (zhe_pubidx_inner_t)(i - 1);
+        publist_next[i] = (i == ZHE_MAX_PUBLICATIONS - 1) ? PUBIDX_NONE : (zhe_pubidx_inner_t)(i + 1);
+    }
+}
+
+static void publist_move(zhe_pubidx_inner_t idx, enum slotlist from, enum slotlist to)
+{
+    if (publist_prev[idx] == PUBIDX_NONE) {
+        zhe_assert(publist_head[from] == idx);
+        publist_head[from] = publist_next[idx];
+    } else {
+        publist_next[publist_prev[idx]] = publist_next[idx];
+    }
+    if (publist_next[idx] != PUBIDX_NONE) {
+        publist_prev[publist_next[idx]] = publist_prev[idx];
+    }
+    publist_prev[idx] = PUBIDX_NONE;
+    publist_next[idx] = publist_head[to];
+    if (publist_head[to] != PUBIDX_NONE) {
+        publist_prev[publist_head[to]] = idx;
+    }
+    publist_head[to] = idx;
+}
+
 void zhe_pubsub_init(void)
 {
     memset(subs, 0, sizeof(subs));
-    max_subidx.idx = 0;
+    sublist_init();
     zhe_rid2sub_init(&rid2sub);
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
     for (zhe_residx_t i = 0; i < ZHE_MAX_RESOURCES; i++) {
@@ -163,7 +544,7 @@ void zhe_pubsub_init(void)
     }
 #endif
     memset(pubs, 0, sizeof(pubs));
-    max_pubidx.idx = 0;
+    publist_init();
     memset(pubs_isrel, 0, sizeof(pubs_isrel));
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
     memset(pubs_rsubcounts, 0, sizeof(pubs_rsubcounts));
@@ -172,9 +553,24 @@ void zhe_pubsub_init(void)
 #endif
 #if MAX_PEERS > 0
     memset(peers_rsubs, 0, sizeof(peers_rsubs));
+#endif
+#if HAVE_RSUB_FILTERS
+    memset(rsubfilters, 0, sizeof(rsubfilters));
+    for (size_t i = 0; i < ZHE_MAX_RSUB_FILTERS; i++) {
+        rsubfilters[i].peeridx = PEERIDX_INVALID;
+    }
+#endif
+#if HAVE_TRANSIENT_CACHE
+    memset(lvc, 0, sizeof(lvc));
+    lvc_push_pending = false;
+    memset(pubs_istransient, 0, sizeof(pubs_istransient));
 #endif
     memset(&precommit_curpkt, 0, sizeof(precommit_curpkt));
     memset(precommit, 0, sizeof(precommit));
+    n_forget_subs = 0;
+#if MAX_PEERS == 0
+    n_forget_pubs = 0;
+#endif
 }
 
 void zhe_decl_note_error_curpkt(enum zhe_declstatus status, zhe_rid_t rid)
@@ -203,14 +599,14 @@ static void rsub_register_committed(peeridx_t peeridx, zhe_rid_t rid, uint8_t su
 #if MAX_PEERS == 0
     zhe_pubidx_t pubidx;
     zhe_assert(rid != 0);
-    for (pubidx.idx = 0; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+    for (pubidx.idx = publist_head[SLOTLIST_INUSE]; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
         if (pubs[pubidx.idx].rid == rid) {
             break;
         }
     }
     if (submode != SUBMODE_PUSH) {
         zhe_decl_note_error_curpkt(ZHE_DECL_UNSUPPORTED, rid);
-    } else if (pubidx.idx >= ZHE_MAX_PUBLICATIONS) {
+    } else if (pubidx.idx == PUBIDX_NONE) {
         zhe_decl_note_error_curpkt(ZHE_DECL_INVALID, rid);
     } else {
         zhe_bitset_set(pubs_rsubs, pubidx.idx);
@@ -230,7 +626,13 @@ static void rsub_register_committed(peeridx_t peeridx, zhe_rid_t rid, uint8_t su
                 break;
             case SSIR_SUCCESS:
                 ZT(PUBSUB, "zhe_rsub_register_committed rid %ju - adding", (uintmax_t)rid);
-                for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ 0 }; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+#if HAVE_AUTO_UNICAST
+                rsubs_gen++;
+#endif
+#if HAVE_TRANSIENT_CACHE
+                lvc_sched_push(peeridx, rid);
+#endif
+                for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
                     /* FIXME: can/should cache URI for "rid" */
 #if ZHE_MAX_URISPACE == 0
                     if (pubs[pubidx.idx].rid == rid) {
@@ -262,16 +664,17 @@ static void rsub_register_tentative(peeridx_t peeridx, zhe_rid_t rid, uint8_t su
 #if MAX_PEERS == 0
     zhe_pubidx_t pubidx;
     zhe_assert(rid != 0);
-    for (pubidx.idx = 0; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+    for (pubidx.idx = publist_head[SLOTLIST_INUSE]; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
         if (pubs[pubidx.idx].rid == rid) {
             break;
         }
     }
     if (submode != SUBMODE_PUSH) {
         zhe_decl_note_error_curpkt(ZHE_DECL_UNSUPPORTED, rid);
-    } else if (pubidx.idx >= ZHE_MAX_PUBLICATIONS) {
+    } else if (pubidx.idx == PUBIDX_NONE) {
         zhe_decl_note_error_curpkt(ZHE_DECL_INVALID, rid);
     } else {
+        zhe_bitset_clear(precommit_curpkt.rforgets, pubidx.idx);
         zhe_bitset_set(precommit_curpkt.rsubs, pubidx.idx);
     }
 #else
@@ -280,6 +683,7 @@ static void rsub_register_tentative(peeridx_t peeridx, zhe_rid_t rid, uint8_t su
     } else if (rid >= ZHE_MAX_RID) {
         zhe_decl_note_error_curpkt(ZHE_DECL_INVALID, rid);
     } else {
+        (void)zhe_ridtable_delete(&precommit_curpkt.rforgets, rid);
         switch (zhe_ridtable_insert(&precommit_curpkt.rsubs, rid)) {
             case SSIR_EXISTS:
             case SSIR_SUCCESS:
@@ -301,6 +705,86 @@ void zhe_rsub_register(peeridx_t peeridx, zhe_rid_t rid, uint8_t submode, bool t
     }
 }
 
+static void rsub_unregister_committed(peeridx_t peeridx, zhe_rid_t rid)
+{
+    ZT(PUBSUB, "rsub_unregister_committed peeridx %u rid %ju", peeridx, (uintmax_t)rid);
+#if MAX_PEERS == 0
+    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
+        if (pubs[pubidx.idx].rid == rid) {
+            zhe_bitset_clear(pubs_rsubs, pubidx.idx);
+        }
+    }
+#else
+    if (!zhe_ridtable_delete(&peers_rsubs[peeridx].rsubs, rid)) {
+        ZT(PUBSUB, "rsub_unregister_committed rid %ju - not known", (uintmax_t)rid);
+        return;
+    }
+#if HAVE_AUTO_UNICAST
+    rsubs_gen++;
+#endif
+#if HAVE_RSUB_FILTERS
+    rsubfilter_drop(peeridx, rid);
+#endif
+    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
+#if ZHE_MAX_URISPACE == 0
+        if (pubs[pubidx.idx].rid == rid && zhe_bitset_test(pubs_rsubs, pubidx.idx)) {
+            peeridx_t i;
+            for (i = zhe_established_peers_first(); i != PEERIDX_INVALID; i = zhe_established_peers_next(i)) {
+                if (zhe_ridtable_contains(&peers_rsubs[i].rsubs, rid)) {
+                    break;
+                }
+            }
+            if (i == PEERIDX_INVALID) {
+                ZT(PUBSUB, "pub %u rid %ju: no more remote subs", (unsigned)pubidx.idx, (uintmax_t)rid);
+                zhe_bitset_clear(pubs_rsubs, pubidx.idx);
+            }
+        }
+#else
+        if (pub_sub_match(pubs[pubidx.idx].rid, rid)) {
+            pubs_rsubcounts[pubidx.idx]--;
+            if (pubs_rsubcounts[pubidx.idx] == 0) {
+                ZT(PUBSUB, "pub %u rid %ju: no more remote subs", (unsigned)pubidx.idx, (uintmax_t)pubs[pubidx.idx].rid);
+            }
+            ZT(DEBUG, "rsub_unregister_committed: pub %u rid %ju: rsubcount now %u (rid %ju)", (unsigned)pubidx.idx, (uintmax_t)pubs[pubidx.idx].rid, (unsigned)pubs_rsubcounts[pubidx.idx], (uintmax_t)rid);
+        }
+#endif
+    }
+#endif
+}
+
+static void rsub_unregister_tentative(peeridx_t peeridx, zhe_rid_t rid)
+{
+    ZT(PUBSUB, "rsub_unregister_tentative peeridx %u rid %ju", peeridx, (uintmax_t)rid);
+#if MAX_PEERS == 0
+    /* forgetting a subscription to something not published (any more) is fine */
+    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
+        if (pubs[pubidx.idx].rid == rid) {
+            zhe_bitset_clear(precommit_curpkt.rsubs, pubidx.idx);
+            zhe_bitset_set(precommit_curpkt.rforgets, pubidx.idx);
+        }
+    }
+#else
+    (void)zhe_ridtable_delete(&precommit_curpkt.rsubs, rid);
+    switch (zhe_ridtable_insert(&precommit_curpkt.rforgets, rid)) {
+        case SSIR_EXISTS:
+        case SSIR_SUCCESS:
+            break;
+        case SSIR_NOSPACE:
+            zhe_decl_note_error_curpkt(ZHE_DECL_NOSPACE, rid);
+            break;
+    }
+#endif
+}
+
+void zhe_rsub_unregister(peeridx_t peeridx, zhe_rid_t rid, bool tentative)
+{
+    if (tentative) {
+        rsub_unregister_tentative(peeridx, rid);
+    } else {
+        rsub_unregister_committed(peeridx, rid);
+    }
+}
+
 uint8_t zhe_rsub_precommit_status_for_Cflag(peeridx_t peeridx, zhe_rid_t *err_rid)
 {
     zhe_assert (precommit_curpkt.result == 0);
@@ -348,7 +832,7 @@ void zhe_rsub_commit(peeridx_t peeridx)
     zhe_assert(precommit[peeridx].result == 0);
 #if MAX_PEERS == 0
     for (size_t i = 0; i < sizeof(pubs_rsubs); i++) {
-        pubs_rsubs[i] |= precommit[peeridx].rsubs[i];
+        pubs_rsubs[i] = (uint8_t)((pubs_rsubs[i] | precommit[peeridx].rsubs[i]) & ~precommit[peeridx].rforgets[i]);
     }
 #else
     zhe_ridtable_iter_t it;
@@ -365,7 +849,13 @@ void zhe_rsub_commit(peeridx_t peeridx)
                     break;
                 case SSIR_SUCCESS:
                     ZT(PUBSUB, "zhe_rsub_commit rid %ju - adding", (uintmax_t)rid);
-                    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ 0 }; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+#if HAVE_AUTO_UNICAST
+                    rsubs_gen++;
+#endif
+#if HAVE_TRANSIENT_CACHE
+                    lvc_sched_push(peeridx, rid);
+#endif
+                    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
                         /* FIXME: can/should cache URI for "rid" */
 #if ZHE_MAX_URISPACE == 0
                         if (pubs[pubidx.idx].rid == rid) {
@@ -388,6 +878,11 @@ void zhe_rsub_commit(peeridx_t peeridx)
             }
         } while (zhe_ridtable_iter_next(&it, &rid));
     }
+    if (zhe_ridtable_iter_first(&it, &precommit[peeridx].rforgets, &rid)) {
+        do {
+            rsub_unregister_committed(peeridx, rid);
+        } while (zhe_ridtable_iter_next(&it, &rid));
+    }
 #endif
     zhe_rsub_precommit_curpkt_abort(peeridx);
 }
@@ -396,7 +891,8 @@ void zhe_rsub_precommit_curpkt_done(peeridx_t peeridx)
 {
 #if MAX_PEERS == 0
     for (size_t i = 0; i < sizeof(precommit[peeridx].rsubs); i++) {
-        precommit[peeridx].rsubs[i] |= precommit_curpkt.rsubs[i];
+        precommit[peeridx].rsubs[i] = (uint8_t)((precommit[peeridx].rsubs[i] & ~precommit_curpkt.rforgets[i]) | precommit_curpkt.rsubs[i]);
+        precommit[peeridx].rforgets[i] = (uint8_t)((precommit[peeridx].rforgets[i] & ~precommit_curpkt.rsubs[i]) | precommit_curpkt.rforgets[i]);
     }
 #else
     /* FIXME: this can be done FAR MORE EFFICIENTLY without any trouble; then again, perhaps one shouldn't even treat the curpkt as a special thing in this manner */
@@ -404,6 +900,7 @@ void zhe_rsub_precommit_curpkt_done(peeridx_t peeridx)
     zhe_rid_t rid;
     if (zhe_ridtable_iter_first(&it, &precommit_curpkt.rsubs, &rid)) {
         do {
+            (void)zhe_ridtable_delete(&precommit[peeridx].rforgets, rid);
             switch (zhe_ridtable_insert(&precommit[peeridx].rsubs, rid)) {
                 case SSIR_EXISTS:
                 case SSIR_SUCCESS:
@@ -415,6 +912,19 @@ void zhe_rsub_precommit_curpkt_done(peeridx_t peeridx)
             }
         } while (zhe_ridtable_iter_next(&it, &rid));
     }
+    if (zhe_ridtable_iter_first(&it, &precommit_curpkt.rforgets, &rid)) {
+        do {
+            (void)zhe_ridtable_delete(&precommit[peeridx].rsubs, rid);
+            switch (zhe_ridtable_insert(&precommit[peeridx].rforgets, rid)) {
+                case SSIR_EXISTS:
+                case SSIR_SUCCESS:
+                    break;
+                case SSIR_NOSPACE:
+                    zhe_decl_note_error_curpkt(ZHE_DECL_NOSPACE, rid);
+                    break;
+            }
+        } while (zhe_ridtable_iter_next(&it, &rid));
+    }
 #endif
     if (precommit_curpkt.result != (uint8_t)ZHE_DECL_OK) {
         zhe_decl_note_error_somepeer(peeridx, precommit_curpkt.result, precommit_curpkt.invalid_rid);
@@ -429,17 +939,17 @@ void zhe_reset_peer_rsubs(peeridx_t peeridx)
 #elif ZHE_MAX_URISPACE == 0
     memset(&peers_rsubs[peeridx], 0, sizeof(peers_rsubs[peeridx]));
     zhe_pubidx_t pubidx;
-    for (pubidx.idx = 0; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+    for (pubidx.idx = publist_head[SLOTLIST_INUSE]; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
         const zhe_rid_t rid = pubs[pubidx.idx].rid;
         zhe_assert(rid <= ZHE_MAX_RID);
         if (rid != 0 && zhe_bitset_test(pubs_rsubs, pubidx.idx)) {
             peeridx_t i;
-            for (i = 0; i < MAX_PEERS_1; i++) {
+            for (i = zhe_established_peers_first(); i != PEERIDX_INVALID; i = zhe_established_peers_next(i)) {
                 if (zhe_ridtable_contains(&peers_rsubs[i].rsubs, rid)) {
                     break;
                 }
             }
-            if (i == MAX_PEERS_1) {
+            if (i == PEERIDX_INVALID) {
                 ZT(PUBSUB, "pub %u rid %ju: no more remote subs", (unsigned)pubidx.idx, (uintmax_t)rid);
                 zhe_bitset_clear(pubs_rsubs, pubidx.idx);
             }
@@ -451,7 +961,7 @@ void zhe_reset_peer_rsubs(peeridx_t peeridx)
     if (zhe_ridtable_iter_first(&it, &peers_rsubs[peeridx].rsubs, &rid)) {
         do {
             zhe_pubidx_t pubidx;
-            for (pubidx.idx = 0; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+            for (pubidx.idx = publist_head[SLOTLIST_INUSE]; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
                 /* FIXME: can/should cache URI for "rid" */
                 if (pub_sub_match(pubs[pubidx.idx].rid, rid)) {
                     pubs_rsubcounts[pubidx.idx]--;
@@ -464,6 +974,24 @@ void zhe_reset_peer_rsubs(peeridx_t peeridx)
         } while (zhe_ridtable_iter_next(&it, &rid));
     }
     memset(&peers_rsubs[peeridx], 0, sizeof(peers_rsubs[peeridx]));
+#endif
+#if HAVE_RSUB_FILTERS
+    rsubfilter_drop(peeridx, 0);
+#endif
+#if HAVE_AUTO_UNICAST
+    /* whatever went out over the unicast conduit to this peer is gone and needn't be waited for */
+    rsubs_gen++;
+    /* not using the list of publications: this also gets called before it is initialised */
+    for (size_t i = 0; i < ZHE_MAX_PUBLICATIONS; i++) {
+        if (pubs[i].rid != 0 && pubs[i].curcid == -(cid_t)peeridx-1) {
+            pubs[i].unacked = false;
+        }
+    }
+#endif
+#if HAVE_TRANSIENT_CACHE
+    for (size_t i = 0; i < ZHE_MAX_TRANSIENT; i++) {
+        zhe_bitset_clear(lvc[i].push, peeridx);
+    }
 #endif
     memset(&precommit[peeridx], 0, sizeof(precommit[peeridx]));
     zhe_rsub_precommit_curpkt_abort(peeridx);
@@ -471,6 +999,79 @@ void zhe_reset_peer_rsubs(peeridx_t peeridx)
 
 /////////////////////////////////////////////////////////////////////////////
 
+/* Consecutive samples for one resource are delivered as a batch if possible, which requires that
+   all subscriptions can take the whole batch at once: a handler that is called per sample and
+   needs space in a transmit window could fill it halfway through the batch, and a queued
+   subscription that refuses samples may only have room for some of them. Then just the first
+   sample is delivered, exactly as if there had been no batching at all. */
+struct deliver_check {
+    zhe_paysize_t xmitneed[N_XMITCID_CONDUITS];
+    unsigned n;
+    bool batchable;
+};
+
+static void deliver_check_init(struct deliver_check *dc, unsigned n)
+{
+    memset(dc->xmitneed, 0, sizeof(dc->xmitneed));
+    dc->n = n;
+    dc->batchable = true;
+}
+
+/* False if S can't take a sample now, which is only the case for a queued subscription that
+   refuses samples when its queue is full */
+static bool deliver_check_add(struct deliver_check *dc, const struct subtable *s)
+{
+#if HAVE_SUBQUEUES
+    if (s->handler == zhe_subqueue_put) {
+        if (!zhe_subqueue_accepts(s->arg, 1)) {
+#if ENABLE_STATS
+            zhe_subqueue_note_refused(s->arg);
+#endif
+            return false;
+        } else if (dc->n > 1 && !zhe_subqueue_accepts(s->arg, dc->n)) {
+            dc->batchable = false;
+        }
+    }
+#endif
+    if (s->xmitneed > 0) {
+        zhe_assert(s->xmitcid >= 0 && s->xmitcid < N_XMITCID_CONDUITS);
+        /* Do note that "xmitneed" had better include overhead! */
+        dc->xmitneed[s->xmitcid] += s->xmitneed;
+        if (s->bhandler == NULL) {
+            dc->batchable = false;
+        }
+    }
+    return true;
+}
+
+/* Number of samples that may be delivered: 0 if there is insufficient space in some transmit
+   window, else all of them or only the first */
+static unsigned deliver_check_done(const struct deliver_check *dc)
+{
+    for (cid_t cid = 0; cid < N_XMITCID_CONDUITS; cid++) {
+        if (dc->xmitneed[cid] > 0 && !zhe_xmitw_hasspace(zhe_out_conduit_from_cid(cid), dc->xmitneed[cid])) {
+            return 0;
+        }
+    }
+    return dc->batchable ? dc->n : 1;
+}
+
+static void sub_deliver(const struct subtable *s, zhe_rid_t rid, unsigned n, const struct zhe_sample *samples)
+{
+    if (s->bhandler != NULL) {
+        s->bhandler(rid, n, samples, s->arg);
+    } else {
+        for (unsigned i = 0; i < n; i++) {
+#if ENABLE_SUBFILTERS
+            if (s->hasfilter && !subfilter_match(&s->filter, samples[i].size, samples[i].payload)) {
+                continue;
+            }
+#endif
+            s->handler(rid, samples[i].payload, samples[i].size, s->arg);
+        }
+    }
+}
+
 #if ZHE_MAX_URISPACE > 0
 /* A WriteData should be delivered to all matching subscriptions or to none (and then retried later) -- delivering to some but not all seems like a really bad idea! -- but that means we first need to check the the available space in transmit windows.  Obviously doing the URI matching more often than strictly necessary is not a good idea -- indeed it is bad enough with caching ... perhaps so bad that it would be best to handle this as part of housekeeping, bit by bit ...  FIXME: for now, let's just cache. */
 static zhe_subidx_t zhe_handle_mwdata_matches[ZHE_MAX_SUBSCRIPTIONS];
@@ -478,7 +1079,7 @@ static zhe_subidx_t zhe_handle_mwdata_matches[ZHE_MAX_SUBSCRIPTIONS];
 int zhe_handle_mwdata_deliver(zhe_paysize_t urisz, const uint8_t *uri, zhe_paysize_t paysz, const void *pay)
 {
     zhe_subidx_t nm = { 0 };
-    for (zhe_subidx_t k = { 0 }; k.idx < ZHE_MAX_SUBSCRIPTIONS; k.idx++) {
+    for (zhe_subidx_t k = { sublist_head[SLOTLIST_INUSE] }; k.idx != SUBIDX_NONE; k.idx = sublist_next[k.idx]) {
         const struct subtable * const s = &subs[k.idx];
         zhe_paysize_t suburisz;
         const uint8_t *suburi;
@@ -487,108 +1088,90 @@ int zhe_handle_mwdata_deliver(zhe_paysize_t urisz, const uint8_t *uri, zhe_paysi
         }
     }
     /* FIXME: perhaps should speed things up in the trivial cases */
-    zhe_paysize_t xmitneed[N_XMITCID_CONDUITS];
-    memset(xmitneed, 0, sizeof(xmitneed));
+    struct deliver_check dc;
+    deliver_check_init(&dc, 1);
     for (zhe_subidx_t k = { 0 }; k.idx < nm.idx; k.idx++) {
-        const struct subtable *s = &subs[k.idx];
-        if (s->xmitneed > 0) {
-            zhe_assert(s->xmitcid >= 0 && s->xmitcid < N_XMITCID_CONDUITS);
-            xmitneed[s->xmitcid] += s->xmitneed;
-        }
-    }
-    for (cid_t cid = 0; cid < N_XMITCID_CONDUITS; cid++) {
-        if (xmitneed[cid] > 0 && !zhe_xmitw_hasspace(zhe_out_conduit_from_cid(cid), xmitneed[cid])) {
+        if (!deliver_check_add(&dc, &subs[zhe_handle_mwdata_matches[k.idx].idx])) {
             return 0;
         }
     }
+    if (deliver_check_done(&dc) == 0) {
+        return 0;
+    }
+    const struct zhe_sample sample = { .payload = pay, .size = paysz };
     for (zhe_subidx_t k = { 0 }; k.idx < nm.idx; k.idx++) {
-        const struct subtable *s = &subs[k.idx];
         /* 0 is not a valid resource id, so that's kinda reasonable */
-        s->handler(0, pay, paysz, s->arg);
+        sub_deliver(&subs[zhe_handle_mwdata_matches[k.idx].idx], 0, 1, &sample);
     }
     return 1;
 }
 #endif
 
-static int zhe_handle_msdata_deliver_anon(zhe_rid_t prid, zhe_paysize_t paysz, const void *pay)
+static unsigned zhe_handle_msdata_deliver_anon(zhe_rid_t prid, unsigned n, const struct zhe_sample *samples)
 {
     zhe_subidx_t rid2subidx;
     if (!zhe_rid2sub_search(&rid2sub, prid, &rid2subidx)) {
-        return 1;
+        return n;
     }
-    const zhe_subidx_t subidx = rid2sub.elems[rid2subidx.idx].subidx;
-    const struct subtable *s = &subs[subidx.idx];
-    if (s->next.idx == subidx.idx) {
-        if (s->xmitneed == 0 || zhe_xmitw_hasspace(zhe_out_conduit_from_cid(s->xmitcid), s->xmitneed)) {
-            /* Do note that "xmitneed" had better include overhead! */
-            s->handler(prid, pay, paysz, s->arg);
-            return 1;
-        } else {
+    const struct subtable * const s = &subs[rid2sub.elems[rid2subidx.idx].subidx.idx];
+    const struct subtable *t;
+    struct deliver_check dc;
+    deliver_check_init(&dc, n);
+    t = s;
+    do {
+        if (!deliver_check_add(&dc, t)) {
             return 0;
         }
-    } else {
-        zhe_paysize_t xmitneed[N_XMITCID_CONDUITS];
-        memset(xmitneed, 0, sizeof(xmitneed));
-        const struct subtable *t;
-        t = s;
-        do {
-            if (t->xmitneed > 0) {
-                zhe_assert(t->xmitcid >= 0 && t->xmitcid < N_XMITCID_CONDUITS);
-                xmitneed[t->xmitcid] += t->xmitneed;
-            }
-            t = &subs[t->next.idx];
-        } while (t != s);
-        for (cid_t cid = 0; cid < N_XMITCID_CONDUITS; cid++) {
-            if (xmitneed[cid] > 0 && !zhe_xmitw_hasspace(zhe_out_conduit_from_cid(cid), xmitneed[cid])) {
-                return 0;
-            }
-        }
-        t = s;
-        do {
-            t->handler(prid, pay, paysz, s->arg);
-            t = &subs[t->next.idx];
-        } while (t != s);
-        return 1;
+        t = &subs[t->next.idx];
+    } while (t != s);
+    if ((n = deliver_check_done(&dc)) == 0) {
+        return 0;
     }
+    t = s;
+    do {
+        sub_deliver(t, prid, n, samples);
+        t = &subs[t->next.idx];
+    } while (t != s);
+    return n;
 }
 
-int zhe_handle_msdata_deliver(zhe_rid_t prid, zhe_paysize_t paysz, const void *pay)
+unsigned zhe_handle_msdata_deliver(zhe_rid_t prid, unsigned n, const struct zhe_sample *samples)
 {
+    zhe_assert(n > 0);
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
     /* FIXME: perhaps should speed things up in the trivial cases */
     zhe_residx_t prid_idx;
     if (!zhe_uristore_getidx_for_rid(prid, &prid_idx)) {
-        return zhe_handle_msdata_deliver_anon(prid, paysz, pay);
+        return zhe_handle_msdata_deliver_anon(prid, n, samples);
     } else {
-        zhe_paysize_t xmitneed[N_XMITCID_CONDUITS];
+        struct deliver_check dc;
         zhe_residx2sub_iter_t it;
         zhe_subidx_t subidx;
-        memset(xmitneed, 0, sizeof(xmitneed));
+        deliver_check_init(&dc, n);
         if (zhe_residx2sub_iter_first(&it, &residx2sub[prid_idx], &subidx)) {
             do {
-                const struct subtable *s = &subs[subidx.idx];
-                if (s->xmitneed > 0) {
-                    zhe_assert(s->xmitcid >= 0 && s->xmitcid < N_XMITCID_CONDUITS);
-                    xmitneed[s->xmitcid] += s->xmitneed;
+                if (!deliver_check_add(&dc, &subs[subidx.idx])) {
+                    return 0;
                 }
             } while (zhe_residx2sub_iter_next(&it, &subidx));
         }
-        for (cid_t cid = 0; cid < N_XMITCID_CONDUITS; cid++) {
-            if (xmitneed[cid] > 0 && !zhe_xmitw_hasspace(zhe_out_conduit_from_cid(cid), xmitneed[cid])) {
-                return 0;
-            }
+        if ((n = deliver_check_done(&dc)) == 0) {
+            return 0;
         }
         if (zhe_residx2sub_iter_first(&it, &residx2sub[prid_idx], &subidx)) {
             do {
-                const struct subtable *s = &subs[subidx.idx];
-                /* 0 is not a valid resource id, so that's kinda reasonable */
-                s->handler(prid, pay, paysz, s->arg);
+                sub_deliver(&subs[subidx.idx], prid, n, samples);
             } while (zhe_residx2sub_iter_next(&it, &subidx));
         }
-        return 1;
+#if HAVE_TRANSIENT_CACHE
+        if (zhe_uristore_transient_for_idx(prid_idx)) {
+            lvc_store(prid, samples[n-1].size, samples[n-1].payload);
+        }
+#endif
+        return n;
     }
 #else
-    return zhe_handle_msdata_deliver_anon(prid, paysz, pay);
+    return zhe_handle_msdata_deliver_anon(prid, n, samples);
 #endif
 }
 
@@ -624,14 +1207,20 @@ enum declitem_kind {
     DIK_RESOURCE,
 #endif
     DIK_PUBLICATION,
-    DIK_SUBSCRIPTION
+    DIK_SUBSCRIPTION,
+#if MAX_PEERS == 0
+    DIK_FORGET_PUBLICATION,
+#endif
+    DIK_FORGET_SUBSCRIPTION
 };
 #if ZHE_MAX_URISPACE > 0
 #define DECLITEM_KIND_FIRST DIK_RESOURCE
 #else
 #define DECLITEM_KIND_FIRST DIK_PUBLICATION
 #endif
-#define DECLITEM_KIND_LAST DIK_SUBSCRIPTION
+#define DECLITEM_KIND_LAST DIK_FORGET_SUBSCRIPTION
+/* undeclarations are only ever sent along with fresh declarations, a new peer has nothing to forget */
+#define DECLITEM_KIND_IS_FORGET(kind_) ((kind_) > DIK_SUBSCRIPTION)
 #define N_DECLITEM_KINDS ((int)DECLITEM_KIND_LAST + 1)
 
 typedef peeridx_t cursoridx_t;
@@ -673,7 +1262,11 @@ void zhe_accept_peer_sched_hist_decls(peeridx_t peeridx)
 #endif
     enum declitem_kind kind = DECLITEM_KIND_FIRST;
     do {
-        pending_decls.cursor[cursoridx][kind] = 0;
+        if (cursoridx != MULTICAST_CURSORIDX && DECLITEM_KIND_IS_FORGET(kind)) {
+            pending_decls.cursor[cursoridx][kind] = DECLITEM_IDX_INVALID;
+        } else {
+            pending_decls.cursor[cursoridx][kind] = 0;
+        }
     } while(kind++ != DECLITEM_KIND_LAST);
 }
 
@@ -711,9 +1304,9 @@ static void sched_fresh_declare(enum declitem_kind kind, declitem_idx_t itemidx)
         pending_decls.peers[pending_decls.cnt++] = MULTICAST_CURSORIDX;
     }
     /* if current fresh declarations have progressed past itemidx, restart from itemidx - which
-     means that any declarations with a higher index will be repeated, so once deleting of local
-     resources, publications or subscriptions is actually implemented, duplicate declarations
-     will be the result */
+     means that any declarations with a higher index will be repeated; deleted items are skipped
+     and undeclarations only remain queued while the item hasn't been declared again, so the
+     repeated ones are merely redundant */
     if (pending_decls.cursor[MULTICAST_CURSORIDX][kind] > itemidx) {
         pending_decls.cursor[MULTICAST_CURSORIDX][kind] = itemidx;
     }
@@ -721,71 +1314,177 @@ static void sched_fresh_declare(enum declitem_kind kind, declitem_idx_t itemidx)
 
 /////////////////////////////////////////////////////////////////////////////////////
 
-#if ZHE_MAX_URISPACE > 0
-static void send_declare_resource(struct out_conduit *oc, declitem_idx_t *cursor, bool committed, zhe_time_t tnow)
+/* Maximum number of declarations in a DECLARE message, so the count always fits in a byte */
+#define DECLARE_MAX_DECLS 127
+
+/* Number of slots of KIND that the cursor walks through before it becomes invalid */
+static declitem_idx_t declitem_nslots(enum declitem_kind kind)
 {
-    zhe_paysize_t urisz;
-    const uint8_t *uri;
-    zhe_rid_t rid;
-    bool islocal;
-    if (*cursor == ZHE_MAX_RESOURCES) {
-        *cursor = DECLITEM_IDX_INVALID;
-    } else if (!zhe_uristore_geturi_for_idx((zhe_residx_t)*cursor, &rid, &urisz, &uri, &islocal) || !islocal) {
-        (*cursor)++;
-    } else {
-        const zhe_paysize_t declsz = 1 + zhe_pack_ridreq(rid) + zhe_pack_vle16req(urisz) + urisz;
-        zhe_msgsize_t from;
-        if (zhe_oc_pack_mdeclare(oc, committed, 1, declsz, &from, tnow)) {
-            ZT(PUBSUB, "sending dres %ju rid %ju %*.*s", (uintmax_t)*cursor, (uintmax_t)rid, (int)urisz, (int)urisz, (char*)uri);
-            zhe_pack_dresource(rid, urisz, uri);
-            zhe_oc_pack_mdeclare_done(oc, from, tnow);
-            (*cursor)++;
-        } else {
-            ZT(PUBSUB, "postponing dres %ju rid %ju %*.*s", (uintmax_t)*cursor, (uintmax_t)rid, (int)urisz, (int)urisz, (char*)uri);
-        }
+    switch (kind) {
+#if ZHE_MAX_URISPACE > 0
+        case DIK_RESOURCE: return ZHE_MAX_RESOURCES;
+#endif
+#if MAX_PEERS == 0
+        case DIK_PUBLICATION: return ZHE_MAX_PUBLICATIONS;
+#else
+        case DIK_PUBLICATION: return 0; /* Currently not pushing publication declarations in peer mode */
+#endif
+        case DIK_SUBSCRIPTION: return ZHE_MAX_SUBSCRIPTIONS;
+#if MAX_PEERS == 0
+        case DIK_FORGET_PUBLICATION: return n_forget_pubs;
+#endif
+        case DIK_FORGET_SUBSCRIPTION: return n_forget_subs;
     }
+    return 0;
 }
+
+/* Size of the declaration for slot IDX of KIND, or 0 if there is nothing to declare (a free slot,
+   a resource defined by a peer) */
+/* The filter to declare for subscription IDX, which is only the case if all local subscriptions
+   to its RID have the same filter, because a remote publisher only keeps one per RID */
+static const struct zhe_subfilter *sub_declared_filter(declitem_idx_t idx)
+{
+#if ENABLE_SUBFILTERS
+    const struct subtable * const s = &subs[idx];
+    const struct subtable *t = s;
+    do {
+        if (!t->hasfilter || !subfilter_equal(&t->filter, &s->filter)) {
+            return NULL;
+        }
+        t = &subs[t->next.idx];
+    } while (t != s);
+    return &s->filter;
+#else
+    (void)idx;
+    return NULL;
 #endif
+}
 
-static void send_declare_pub(struct out_conduit *oc, declitem_idx_t *cursor, bool committed, zhe_time_t tnow)
+static zhe_paysize_t declitem_size(enum declitem_kind kind, declitem_idx_t idx)
 {
-    /* Currently not pushing publication declarations in peer mode */
+    switch (kind) {
+#if ZHE_MAX_URISPACE > 0
+        case DIK_RESOURCE: {
+            zhe_paysize_t urisz;
+            const uint8_t *uri;
+            zhe_rid_t rid;
+            bool islocal;
+            if (!zhe_uristore_geturi_for_idx((zhe_residx_t)idx, &rid, &urisz, &uri, &islocal) || !islocal) {
+                return 0;
+            }
+            return (zhe_paysize_t)(1 + zhe_pack_ridreq(rid) + zhe_pack_vle16req(urisz) + urisz);
+        }
+#endif
+        case DIK_PUBLICATION: return (pubs[idx].rid != 0) ? WC_DPUB_SIZE : 0;
+        case DIK_SUBSCRIPTION: return (subs[idx].rid == 0) ? 0 : (sub_declared_filter(idx) != NULL) ? WC_DSUB_SIZE + WC_DSUBFILTER_SIZE : WC_DSUB_SIZE;
 #if MAX_PEERS == 0
-    declitem_idx_t pub = *cursor;
-    zhe_msgsize_t from;
-    if (*cursor == ZHE_MAX_PUBLICATIONS) {
-        *cursor = DECLITEM_IDX_INVALID;
-    } else if (pubs[pub].rid == 0) {
-        (*cursor)++;
-    } else if (zhe_oc_pack_mdeclare(oc, committed, 1, WC_DPUB_SIZE, &from, tnow)) {
-        ZT(PUBSUB, "sending dpub %ju rid %ju", (uintmax_t)pub, (uintmax_t)pubs[pub].rid);
-        zhe_pack_dpub(pubs[pub].rid);
-        zhe_oc_pack_mdeclare_done(oc, from, tnow);
-        (*cursor)++;
-    } else {
-        ZT(PUBSUB, "postponing dpub %ju rid %ju", (uintmax_t)pub, (uintmax_t)pubs[pub].rid);
+        case DIK_FORGET_PUBLICATION: return (forget_pubs[idx] != 0) ? WC_DFPUB_SIZE : 0;
+#endif
+        case DIK_FORGET_SUBSCRIPTION: return (forget_subs[idx] != 0) ? WC_DFSUB_SIZE : 0;
     }
-#else
-    (*cursor)++;
+    return 0;
+}
+
+static void declitem_pack(enum declitem_kind kind, declitem_idx_t idx)
+{
+    switch (kind) {
+#if ZHE_MAX_URISPACE > 0
+        case DIK_RESOURCE: {
+            zhe_paysize_t urisz;
+            const uint8_t *uri;
+            zhe_rid_t rid;
+            bool islocal;
+            (void)zhe_uristore_geturi_for_idx((zhe_residx_t)idx, &rid, &urisz, &uri, &islocal);
+            ZT(PUBSUB, "sending dres %ju rid %ju %*.*s", (uintmax_t)idx, (uintmax_t)rid, (int)urisz, (int)urisz, (char*)uri);
+            zhe_pack_dresource(rid, urisz, uri);
+            break;
+        }
 #endif
+        case DIK_PUBLICATION:
+            ZT(PUBSUB, "sending dpub %ju rid %ju", (uintmax_t)idx, (uintmax_t)pubs[idx].rid);
+            zhe_pack_dpub(pubs[idx].rid);
+            break;
+        case DIK_SUBSCRIPTION:
+            ZT(PUBSUB, "sending dsub %ju rid %ju", (uintmax_t)idx, (uintmax_t)subs[idx].rid);
+            zhe_pack_dsub(subs[idx].rid, sub_declared_filter(idx));
+            break;
+#if MAX_PEERS == 0
+        case DIK_FORGET_PUBLICATION:
+            ZT(PUBSUB, "sending dfpub rid %ju", (uintmax_t)forget_pubs[idx]);
+            zhe_pack_dfpub(forget_pubs[idx]);
+            break;
+#endif
+        case DIK_FORGET_SUBSCRIPTION:
+            ZT(PUBSUB, "sending dfsub rid %ju", (uintmax_t)forget_subs[idx]);
+            zhe_pack_dfsub(forget_subs[idx]);
+            break;
+    }
 }
 
-static void send_declare_sub(struct out_conduit *oc, declitem_idx_t *cursor, bool committed, zhe_time_t tnow)
+/* Packs as many of the pending declarations of CURSOR as fit in a packet and in the transmit
+   window of OC into a single DECLARE message, in the order of the kinds, so resources precede the
+   subscriptions that may refer to them. The first pass determines how far each cursor gets, the
+   second packs the non-empty slots in between. */
+static uint8_t send_declares_batch(struct out_conduit *oc, declitem_idx_t *cursor, bool committed, zhe_time_t tnow)
 {
-    declitem_idx_t sub = *cursor;
+    declitem_idx_t end[N_DECLITEM_KINDS];
+    size_t declsz = 0;
+    uint8_t ndecls = 0;
+    bool full = false;
+    enum declitem_kind kind = DECLITEM_KIND_FIRST;
+    do {
+        const declitem_idx_t n = declitem_nslots(kind);
+        declitem_idx_t i = cursor[kind];
+        while (!full && i != DECLITEM_IDX_INVALID) {
+            zhe_paysize_t sz;
+            if (i >= n) {
+                i = DECLITEM_IDX_INVALID;
+            } else if ((sz = declitem_size(kind, i)) == 0) {
+                i++;
+            } else if (ndecls < DECLARE_MAX_DECLS && zhe_oc_mdeclare_fits(oc, (uint8_t)(ndecls + 1), declsz + sz)) {
+                declsz += sz;
+                ndecls++;
+                i++;
+            } else {
+                full = true;
+            }
+        }
+        end[kind] = i;
+    } while (kind++ != DECLITEM_KIND_LAST);
+
     zhe_msgsize_t from;
-    if (*cursor == ZHE_MAX_SUBSCRIPTIONS) {
-        *cursor = DECLITEM_IDX_INVALID;
-    } else if (subs[sub].rid == 0) {
-        (*cursor)++;
-    } else if (zhe_oc_pack_mdeclare(oc, committed, 1, WC_DSUB_SIZE, &from, tnow)) {
-        ZT(PUBSUB, "sending dsub %ju rid %ju", (uintmax_t)sub, (uintmax_t)subs[sub].rid);
-        zhe_pack_dsub(subs[sub].rid);
+    if (ndecls > 0) {
+        if (!zhe_oc_pack_mdeclare(oc, committed, ndecls, (zhe_paysize_t)declsz, &from, tnow)) {
+            zhe_assert(0);
+            return 0;
+        }
+        kind = DECLITEM_KIND_FIRST;
+        do {
+            const declitem_idx_t stop = (end[kind] == DECLITEM_IDX_INVALID) ? declitem_nslots(kind) : end[kind];
+            for (declitem_idx_t i = cursor[kind]; i < stop; i++) {
+                if (declitem_size(kind, i) > 0) {
+                    declitem_pack(kind, i);
+                }
+            }
+        } while (kind++ != DECLITEM_KIND_LAST);
         zhe_oc_pack_mdeclare_done(oc, from, tnow);
-        (*cursor)++;
-    } else {
-        ZT(PUBSUB, "postponing dsub %ju rid %ju", (uintmax_t)sub, (uintmax_t)subs[sub].rid);
     }
+    if (full) {
+        ZT(PUBSUB, "postponing declarations after %u", (unsigned)ndecls);
+    }
+    memcpy(cursor, end, sizeof(end));
+    return ndecls;
+}
+
+static bool declares_done(const declitem_idx_t *cursor)
+{
+    enum declitem_kind kind = DECLITEM_KIND_FIRST;
+    do {
+        if (cursor[kind] != DECLITEM_IDX_INVALID) {
+            return false;
+        }
+    } while (kind++ != DECLITEM_KIND_LAST);
+    return true;
 }
 
 static int send_declare_commit(struct out_conduit *oc, uint8_t commitid, zhe_time_t tnow)
@@ -829,25 +1528,15 @@ static bool zhe_send_declares1(zhe_time_t tnow, const cursoridx_t cursoridx, str
         *commit_oc = NULL;
         return true;
     } else {
-        int done = 0;
-        enum declitem_kind kind;
-        kind = DECLITEM_KIND_FIRST;
-        do {
-            declitem_idx_t *idx = &pending_decls.cursor[cursoridx][kind];
-            if (*idx == DECLITEM_IDX_INVALID) {
-                done++;
-            } else {
-                switch (kind) {
-#if ZHE_MAX_URISPACE > 0
-                    case DIK_RESOURCE:     send_declare_resource(oc, idx, committed, tnow); break;
-#endif
-                    case DIK_PUBLICATION:  send_declare_pub(oc, idx, committed, tnow); break;
-                    case DIK_SUBSCRIPTION: send_declare_sub(oc, idx, committed, tnow); break;
-                }
-            }
-        } while (kind++ != DECLITEM_KIND_LAST);
+        /* Keep going while the transmit window has room, so that a new peer gets the existing
+           declarations at the rate the window allows rather than at one message per call */
+        declitem_idx_t * const cursor = pending_decls.cursor[cursoridx];
+        unsigned nmsgs = 0;
+        while (send_declares_batch(oc, cursor, committed, tnow) > 0 && !declares_done(cursor) && ++nmsgs < DECLARE_BURST) {
+            /* next batch */
+        }
         *commit_oc = oc;
-        return (done == N_DECLITEM_KINDS);
+        return declares_done(cursor);
     }
 }
 
@@ -875,15 +1564,30 @@ void zhe_send_declares(zhe_time_t tnow)
                     pending_decls.pos = 0;
                 }
             } else {
+                const cursoridx_t cursoridx = pending_decls.peers[pending_decls.pos];
+                ZT(PUBSUB, "declarations for cursor %u done", (unsigned)cursoridx);
+#if ENABLE_STATS
+                if (cursoridx != MULTICAST_CURSORIDX) {
+                    zhe_note_hist_decls_done(cursoridx, tnow);
+                } else if (MULTICAST_CURSORIDX == 0) {
+                    /* all peers share the cursor */
+                    for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
+                        zhe_note_hist_decls_done(peeridx, tnow);
+                    }
+                }
+#endif
                 if (fresh) {
-                    for (peeridx_t peeridx = 0; peeridx < MAX_PEERS_1; peeridx++) {
-                        if (zhe_established_peer(peeridx)) {
-                            zhe_bitset_set(decl_results.waiting, peeridx);
-                        }
+                    for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
+                        zhe_bitset_set(decl_results.waiting, peeridx);
                     }
                     if (commit_oc != NULL) {
                         gcommitid++;
                     }
+                    /* all undeclarations went out (or there was no one to send them to) */
+                    n_forget_subs = 0;
+#if MAX_PEERS == 0
+                    n_forget_pubs = 0;
+#endif
                 }
                 pending_decls.peers[pending_decls.pos] = pending_decls.peers[--pending_decls.cnt];
                 if (pending_decls.pos == pending_decls.cnt) {
@@ -931,15 +1635,14 @@ bool zhe_rid_in_use_anonymously(zhe_rid_t rid)
 {
     zhe_paysize_t dummysz;
     const uint8_t *dummyuri;
-    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){0}; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
+    zhe_subidx_t dummypos;
+    for (zhe_pubidx_t pubidx = (zhe_pubidx_t){ publist_head[SLOTLIST_INUSE] }; pubidx.idx != PUBIDX_NONE; pubidx.idx = publist_next[pubidx.idx]) {
         if (pubs[pubidx.idx].rid == rid) {
             return !zhe_uristore_geturi_for_rid(rid, &dummysz, &dummyuri);
         }
     }
-    for (zhe_subidx_t subidx = (zhe_subidx_t){0}; subidx.idx < ZHE_MAX_SUBSCRIPTIONS; subidx.idx++) {
-        if (subs[subidx.idx].rid == rid) {
-            return !zhe_uristore_geturi_for_rid(rid, &dummysz, &dummyuri);
-        }
+    if (zhe_rid2sub_search(&rid2sub, rid, &dummypos)) {
+        return !zhe_uristore_geturi_for_rid(rid, &dummysz, &dummyuri);
     }
     return false;
 }
@@ -954,15 +1657,13 @@ void zhe_update_subs_for_resource_decl(zhe_rid_t rid)
     ZT(PUBSUB, "zhe_update_subs_for_resource_decl rid %ju", (uintmax_t)rid);
     zhe_uristore_geturi_for_rid(rid, &itsz, &ituri);
     zhe_uristore_getidx_for_rid(rid, &residx);
-    for (zhe_subidx_t subidx = (zhe_subidx_t){0}; subidx.idx <= max_subidx.idx; subidx.idx++) {
+    for (zhe_subidx_t subidx = (zhe_subidx_t){ sublist_head[SLOTLIST_INUSE] }; subidx.idx != SUBIDX_NONE; subidx.idx = sublist_next[subidx.idx]) {
         const zhe_rid_t subrid = subs[subidx.idx].rid;
-        if (subrid != 0) {
-            zhe_paysize_t subsz;
-            const uint8_t *suburi;
-            if (zhe_uristore_geturi_for_rid(subrid, &subsz, &suburi) && zhe_urimatch(suburi, subsz, ituri, itsz)) {
-                (void)zhe_residx2sub_insert(&residx2sub[residx], subidx);
-                ZT(PUBSUB, "zhe_update_subs_for_resource_decl rid %ju: add sub %u (now #%u)", (uintmax_t)rid, subidx.idx, (unsigned)zhe_residx2sub_count(&residx2sub[residx]).idx);
-            }
+        zhe_paysize_t subsz;
+        const uint8_t *suburi;
+        if (zhe_uristore_geturi_for_rid(subrid, &subsz, &suburi) && zhe_urimatch(suburi, subsz, ituri, itsz)) {
+            (void)zhe_residx2sub_insert(&residx2sub[residx], subidx);
+            ZT(PUBSUB, "zhe_update_subs_for_resource_decl rid %ju: add sub %u (now #%u)", (uintmax_t)rid, subidx.idx, (unsigned)zhe_residx2sub_count(&residx2sub[residx]).idx);
         }
     }
 }
@@ -990,6 +1691,31 @@ static void zhe_update_subs_for_sub_decl(zhe_rid_t rid, zhe_subidx_t subidx)
 }
 #endif
 
+/* Position in QUEUE (N entries used, room for MAX) to use for an undeclaration of RID: that of a
+   pending one for RID, else the first cleared entry, else N; MAX if the queue is full */
+static size_t forget_queue_pos(const zhe_rid_t *queue, size_t n, size_t max, zhe_rid_t rid)
+{
+    size_t pos = n;
+    for (size_t i = 0; i < n; i++) {
+        if (queue[i] == rid) {
+            return i;
+        } else if (queue[i] == 0 && pos == n) {
+            pos = i;
+        }
+    }
+    return (pos < max) ? pos : max;
+}
+
+static void forget_queue_cancel(zhe_rid_t *queue, size_t n, zhe_rid_t rid)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (queue[i] == rid) {
+            queue[i] = 0;
+            break;
+        }
+    }
+}
+
 bool zhe_declare_resource(zhe_rid_t rid, const char *uri)
 {
 #if ZHE_MAX_URISPACE > 0
@@ -1031,25 +1757,50 @@ zhe_pubidx_t zhe_publish(zhe_rid_t rid, unsigned cid, int reliable)
      to send a reliable message when the transmit window is full.  */
     zhe_pubidx_t pubidx;
     zhe_assert(rid > 0 && rid <= ZHE_MAX_RID);
-    for (pubidx.idx = 0; pubidx.idx < ZHE_MAX_PUBLICATIONS; pubidx.idx++) {
-        if (pubs[pubidx.idx].rid == 0) {
-            break;
-        }
-    }
-    zhe_assert(pubidx.idx < ZHE_MAX_PUBLICATIONS);
+    zhe_assert(publist_head[SLOTLIST_FREE] != PUBIDX_NONE);
+    pubidx.idx = publist_head[SLOTLIST_FREE];
+    publist_move(pubidx.idx, SLOTLIST_FREE, SLOTLIST_INUSE);
     zhe_assert(!zhe_bitset_test(pubs_isrel, pubidx.idx));
     zhe_assert(cid < N_XMITCID_CONDUITS);
     pubs[pubidx.idx].rid = rid;
+#if HAVE_MCPARTITIONS
+    {
+        zhe_paysize_t urisz = 0;
+        const uint8_t *uri = NULL;
+#if ZHE_MAX_URISPACE > 0
+        (void)zhe_uristore_geturi_for_rid(rid, &urisz, &uri);
+#endif
+        pubs[pubidx.idx].cid = mcpartition_cid(rid, urisz, uri, (cid_t)cid);
+    }
+#else
     pubs[pubidx.idx].cid = (cid_t)cid;
-    max_pubidx = pubidx;
+#endif
+    pubs[pubidx.idx].latency_budget = LATENCY_BUDGET;
+#if HAVE_AUTO_UNICAST
+    pubs[pubidx.idx].curcid = pubs[pubidx.idx].cid;
+    pubs[pubidx.idx].autocid = pubs[pubidx.idx].cid;
+    pubs[pubidx.idx].autogen = rsubs_gen - 1;
+    pubs[pubidx.idx].unacked = false;
+    pubs[pubidx.idx].maxsz = 0;
+#endif
+#if ENABLE_STATS
+    memset(&pubs[pubidx.idx].stats, 0, sizeof(pubs[pubidx.idx].stats));
+#endif
     if (reliable) {
         zhe_bitset_set(pubs_isrel, pubidx.idx);
     }
-    ZT(PUBSUB, "publish: %u rid %ju (%s)", pubidx.idx, (uintmax_t)rid, reliable ? "reliable" : "unreliable");
+#if HAVE_TRANSIENT_CACHE
+    zhe_residx_t residx;
+    if (zhe_uristore_getidx_for_rid(rid, &residx) && zhe_uristore_transient_for_idx(residx)) {
+        zhe_bitset_set(pubs_istransient, pubidx.idx);
+    }
+#endif
+    ZT(PUBSUB, "publish: %u rid %ju cid %d (%s)", pubidx.idx, (uintmax_t)rid, (int)pubs[pubidx.idx].cid, reliable ? "reliable" : "unreliable");
 #if MAX_PEERS == 0
+    forget_queue_cancel(forget_pubs, n_forget_pubs, rid);
     sched_fresh_declare(DIK_PUBLICATION, pubidx.idx);
 #elif ZHE_MAX_URISPACE == 0
-    for (peeridx_t peeridx = 0; peeridx < MAX_PEERS_1; peeridx++) {
+    for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
         if (zhe_ridtable_contains(&peers_rsubs[peeridx].rsubs, rid)) {
             ZT(PUBSUB, "publish: %u rid %ju has remote subs", pubidx.idx, (uintmax_t)rid);
             zhe_bitset_set(pubs_rsubs, pubidx.idx);
@@ -1057,10 +1808,7 @@ zhe_pubidx_t zhe_publish(zhe_rid_t rid, unsigned cid, int reliable)
         }
     }
 #else
-    for (peeridx_t peeridx = 0; peeridx < MAX_PEERS_1; peeridx++) {
-        if (!zhe_established_peer(peeridx)) {
-            continue;
-        }
+    for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
         zhe_ridtable_iter_t it;
         zhe_rid_t subrid;
         if (zhe_ridtable_iter_first(&it, &peers_rsubs[peeridx].rsubs, &subrid)) {
@@ -1076,38 +1824,43 @@ zhe_pubidx_t zhe_publish(zhe_rid_t rid, unsigned cid, int reliable)
             } while (zhe_ridtable_iter_next(&it, &subrid));
         }
     }
+#endif
+#if HAVE_RSUB_FILTERS
+    for (size_t i = 0; i < ZHE_MAX_RSUB_FILTERS; i++) {
+        if (rsubfilters[i].rid != 0 && pub_sub_match(rid, rsubfilters[i].rid)) {
+            zhe_bitset_set(rsubfilters[i].pubs, pubidx.idx);
+        } else {
+            zhe_bitset_clear(rsubfilters[i].pubs, pubidx.idx);
+        }
+    }
 #endif
     return pubidx;
 }
 
-zhe_subidx_t zhe_subscribe(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, void *arg)
+static zhe_subidx_t subscribe_common(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, zhe_subbatchhandler_t bhandler, void *arg)
 {
-    zhe_subidx_t subidx;
+    zhe_subidx_t subidx, pos;
     zhe_assert(rid > 0 && rid <= ZHE_MAX_RID);
     zhe_assert(cid < N_XMITCID_CONDUITS);
-    zhe_assert(max_subidx.idx < ZHE_MAX_SUBSCRIPTIONS);
-    if (subs[max_subidx.idx].rid == 0) {
-        subidx = max_subidx;
-    } else {
-        subidx = max_subidx; /* FIXME: all this "no delete possible" is no good */
-        subidx.idx++;
-    }
-    zhe_subidx_t nextidx;
-    if (zhe_rid2sub_search(&rid2sub, rid, &nextidx)) {
-        nextidx = rid2sub.elems[nextidx.idx].subidx;
-    } else {
-        nextidx = subidx;
-    }
-    zhe_assert(subidx.idx < ZHE_MAX_SUBSCRIPTIONS);
+    zhe_assert(sublist_head[SLOTLIST_FREE] != SUBIDX_NONE);
+    subidx.idx = sublist_head[SLOTLIST_FREE];
+    sublist_move(subidx.idx, SLOTLIST_FREE, SLOTLIST_INUSE);
     subs[subidx.idx].rid = rid;
-    subs[subidx.idx].next = nextidx;
     subs[subidx.idx].xmitneed = xmitneed;
     subs[subidx.idx].xmitcid = (cid_t)cid;
     subs[subidx.idx].handler = handler;
+    subs[subidx.idx].bhandler = bhandler;
     subs[subidx.idx].arg = arg;
-    /* FIXME: this fails badly when we can delete subscriptions */
-    max_subidx = subidx;
-    (void)zhe_rid2sub_insert(&rid2sub, (rid2subtable_t){ .rid = rid, .subidx = subidx });
+    if (zhe_rid2sub_search(&rid2sub, rid, &pos)) {
+        /* add it to the circular list of subscriptions for this RID */
+        const zhe_subidx_t first = rid2sub.elems[pos.idx].subidx;
+        subs[subidx.idx].next = subs[first.idx].next;
+        subs[first.idx].next = subidx;
+    } else {
+        subs[subidx.idx].next = subidx;
+        (void)zhe_rid2sub_insert(&rid2sub, (rid2subtable_t){ .rid = rid, .subidx = subidx });
+        forget_queue_cancel(forget_subs, n_forget_subs, rid);
+    }
 #if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
     zhe_update_subs_for_sub_decl(rid, subidx);
 #endif
@@ -1117,51 +1870,296 @@ zhe_subidx_t zhe_subscribe(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid,
     return subidx;
 }
 
+zhe_subidx_t zhe_subscribe(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, void *arg)
+{
+    zhe_assert(handler != NULL);
+    return subscribe_common(rid, xmitneed, cid, handler, NULL, arg);
+}
+
+bool zhe_subscribe_filtered(zhe_rid_t rid, const struct zhe_subfilter *filter, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, void *arg, zhe_subidx_t *subidx)
+{
+#if ENABLE_SUBFILTERS
+    zhe_assert(handler != NULL);
+    if (!subfilter_valid(filter)) {
+        return false;
+    }
+    /* the filter must be in place before the declaration gets sent from housekeeping */
+    *subidx = subscribe_common(rid, xmitneed, cid, handler, NULL, arg);
+    subs[subidx->idx].hasfilter = true;
+    subs[subidx->idx].filter = *filter;
+    return true;
+#else
+    (void)rid; (void)filter; (void)xmitneed; (void)cid; (void)handler; (void)arg; (void)subidx;
+    return false;
+#endif
+}
+
+zhe_subidx_t zhe_subscribe_batch(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subbatchhandler_t handler, void *arg)
+{
+    zhe_assert(handler != NULL);
+    return subscribe_common(rid, xmitneed, cid, NULL, handler, arg);
+}
+
+bool zhe_unsubscribe(zhe_subidx_t subidx)
+{
+    zhe_subidx_t pos;
+    zhe_assert(subidx.idx < ZHE_MAX_SUBSCRIPTIONS && subs[subidx.idx].rid != 0);
+    const zhe_rid_t rid = subs[subidx.idx].rid;
+    if (!zhe_rid2sub_search(&rid2sub, rid, &pos)) {
+        zhe_assert(0);
+        return false;
+    }
+    if (subs[subidx.idx].next.idx == subidx.idx) {
+        /* last subscription for RID: peers are told to forget it */
+        const size_t fpos = forget_queue_pos(forget_subs, n_forget_subs, ZHE_MAX_SUBSCRIPTIONS, rid);
+        if (fpos == ZHE_MAX_SUBSCRIPTIONS) {
+            ZT(PUBSUB, "unsubscribe: %u rid %ju - too many pending undeclarations", subidx.idx, (uintmax_t)rid);
+            return false;
+        }
+        forget_subs[fpos] = rid;
+        if (fpos == n_forget_subs) {
+            n_forget_subs++;
+        }
+        (void)zhe_rid2sub_delete(&rid2sub, rid2sub.elems[pos.idx]);
+        sched_fresh_declare(DIK_FORGET_SUBSCRIPTION, (declitem_idx_t)fpos);
+    } else {
+        zhe_subidx_t prev = subidx;
+        while (subs[prev.idx].next.idx != subidx.idx) {
+            prev = subs[prev.idx].next;
+        }
+        subs[prev.idx].next = subs[subidx.idx].next;
+        if (rid2sub.elems[pos.idx].subidx.idx == subidx.idx) {
+            rid2sub.elems[pos.idx].subidx = subs[subidx.idx].next;
+        }
+    }
+#if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
+    for (zhe_residx_t i = 0; i < ZHE_MAX_RESOURCES; i++) {
+        (void)zhe_residx2sub_delete(&residx2sub[i], subidx);
+    }
+#endif
+#if HAVE_SUBQUEUES
+    if (subs[subidx.idx].handler == zhe_subqueue_put) {
+        zhe_subqueue_release(subs[subidx.idx].arg);
+    }
+#endif
+    memset(&subs[subidx.idx], 0, sizeof(subs[subidx.idx]));
+    sublist_move(subidx.idx, SLOTLIST_INUSE, SLOTLIST_FREE);
+    ZT(PUBSUB, "unsubscribe: %u rid %ju", subidx.idx, (uintmax_t)rid);
+    return true;
+}
+
+bool zhe_unpublish(zhe_pubidx_t pubidx)
+{
+    zhe_assert(pubidx.idx < ZHE_MAX_PUBLICATIONS && pubs[pubidx.idx].rid != 0);
+    const zhe_rid_t rid = pubs[pubidx.idx].rid;
+#if MAX_PEERS == 0
+    zhe_pubidx_t other;
+    for (other.idx = publist_head[SLOTLIST_INUSE]; other.idx != PUBIDX_NONE; other.idx = publist_next[other.idx]) {
+        if (other.idx != pubidx.idx && pubs[other.idx].rid == rid) {
+            break;
+        }
+    }
+    if (other.idx == PUBIDX_NONE) {
+        /* last publication for RID: the broker is told to forget it */
+        const size_t fpos = forget_queue_pos(forget_pubs, n_forget_pubs, ZHE_MAX_PUBLICATIONS, rid);
+        if (fpos == ZHE_MAX_PUBLICATIONS) {
+            ZT(PUBSUB, "unpublish: %u rid %ju - too many pending undeclarations", pubidx.idx, (uintmax_t)rid);
+            return false;
+        }
+        forget_pubs[fpos] = rid;
+        if (fpos == n_forget_pubs) {
+            n_forget_pubs++;
+        }
+        sched_fresh_declare(DIK_FORGET_PUBLICATION, (declitem_idx_t)fpos);
+    }
+#endif
+    memset(&pubs[pubidx.idx], 0, sizeof(pubs[pubidx.idx]));
+    zhe_bitset_clear(pubs_isrel, pubidx.idx);
+#if HAVE_TRANSIENT_CACHE
+    zhe_bitset_clear(pubs_istransient, pubidx.idx);
+#endif
+#if ZHE_MAX_URISPACE > 0 && MAX_PEERS > 0
+    pubs_rsubcounts[pubidx.idx] = 0;
+#else
+    zhe_bitset_clear(pubs_rsubs, pubidx.idx);
+#endif
+    publist_move(pubidx.idx, SLOTLIST_INUSE, SLOTLIST_FREE);
+    ZT(PUBSUB, "unpublish: %u rid %ju", pubidx.idx, (uintmax_t)rid);
+    return true;
+}
+
+void zhe_set_latency_budget(zhe_pubidx_t pubidx, zhe_time_t budget)
+{
+    zhe_assert(pubs[pubidx.idx].rid != 0);
+    zhe_assert(budget == ZHE_LATENCY_BUDGET_INF || budget <= ZHE_TIMEDIFF_MAX);
+    pubs[pubidx.idx].latency_budget = (budget == ZHE_LATENCY_BUDGET_INF) ? LATENCY_BUDGET_INF : budget;
+    ZT(PUBSUB, "set_latency_budget: %u budget %"PRIu32, pubidx.idx, (uint32_t)budget);
+}
+
+#if HAVE_AUTO_UNICAST
+/* The unicast conduit of the only peer with a matching subscription, else the configured one */
+static cid_t pub_select_cid(zhe_pubidx_t pubidx)
+{
+    const zhe_rid_t rid = pubs[pubidx.idx].rid;
+    peeridx_t found = PEERIDX_INVALID;
+    for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
+#if ZHE_MAX_URISPACE == 0
+        const bool match = zhe_ridtable_contains(&peers_rsubs[peeridx].rsubs, rid);
+#else
+        bool match = false;
+        zhe_ridtable_iter_t it;
+        zhe_rid_t subrid;
+        if (zhe_ridtable_iter_first(&it, &peers_rsubs[peeridx].rsubs, &subrid)) {
+            do {
+                match = pub_sub_match(rid, subrid);
+            } while (!match && zhe_ridtable_iter_next(&it, &subrid));
+        }
+#endif
+        if (!match) {
+            continue;
+        } else if (found != PEERIDX_INVALID) {
+            return pubs[pubidx.idx].cid;
+        }
+        found = peeridx;
+    }
+    return (found == PEERIDX_INVALID) ? pubs[pubidx.idx].cid : -(cid_t)found-1;
+}
+
+/* Whether a reliable sample of SZ bytes for RID fits in the transmit window of a unicast conduit */
+static bool unicast_fits(zhe_rid_t rid, zhe_paysize_t sz)
+{
+    return sizeof(zhe_msgsize_t) + (size_t)zhe_msdata_size(rid, sz) <= XMITW_BYTES_UNICAST;
+}
+
+/* Sets *CID to the conduit to write the next sample of PUBIDX to, or returns false if it is
+   switching conduits and must wait until the reliable samples written to the old one have been
+   acknowledged: otherwise a sample written to the new one could be delivered before them.
+   Switching from multicast to unicast could continue over multicast in the meantime, but then
+   a steady stream of samples would prevent it from ever switching. A reliable publication that
+   has written a sample that doesn't fit the unicast window stays on the configured conduit from
+   then on, rather than switching back and forth with the sample size. */
+static bool pub_conduit(zhe_pubidx_t pubidx, int relflag, zhe_paysize_t sz, cid_t *cid)
+{
+    struct pubtable * const p = &pubs[pubidx.idx];
+    cid_t want;
+    if (p->autogen != rsubs_gen) {
+        p->autocid = pub_select_cid(pubidx);
+        p->autogen = rsubs_gen;
+    }
+    if (relflag && sz > p->maxsz) {
+        p->maxsz = sz;
+    }
+    want = p->autocid;
+    if (want < 0 && relflag && !unicast_fits(p->rid, p->maxsz)) {
+        want = p->cid;
+    }
+    if (want != p->curcid) {
+        if (p->unacked && zhe_out_conduit_is_connected(p->curcid) && !zhe_oc_acked_upto(zhe_out_conduit_from_cid(p->curcid), p->lastseq)) {
+            return false;
+        }
+        ZT(PUBSUB, "pub %u rid %ju: switching from conduit %d to %d", (unsigned)pubidx.idx, (uintmax_t)p->rid, (int)p->curcid, (int)want);
+        p->curcid = want;
+        p->unacked = false;
+    }
+    *cid = p->curcid;
+    return true;
+}
+#endif
+
 int zhe_write(zhe_pubidx_t pubidx, const void *data, zhe_paysize_t sz, zhe_time_t tnow)
 {
     /* returns 0 on failure and 1 on success; the only defined failure case is a full transmit
      window for reliable pulication while remote subscribers exist */
-    struct out_conduit * const oc = zhe_out_conduit_from_cid(pubs[pubidx.idx].cid);
+    struct out_conduit *oc;
     int relflag;
     zhe_assert(pubs[pubidx.idx].rid != 0);
+    ZT_SETTIME(tnow);
+#if HAVE_TRANSIENT_CACHE
+    if (zhe_bitset_test(pubs_istransient, pubidx.idx)) {
+        /* also without subscribers: that's the point */
+        lvc_store(pubs[pubidx.idx].rid, sz, data);
+    }
+#endif
 #if ZHE_MAX_URISPACE == 0 || MAX_PEERS == 0
     if (!zhe_bitset_test(pubs_rsubs, pubidx.idx)) {
         /* success is assured if there are no subscribers */
+        ZSTAT(pubs[pubidx.idx].stats.nosubs++);
         return 1;
     }
 #else
     if (pubs_rsubcounts[pubidx.idx] == 0) {
         /* success is assured if there are no subscribers */
+        ZSTAT(pubs[pubidx.idx].stats.nosubs++);
+        return 1;
+    }
+#endif
+#if HAVE_RSUB_FILTERS
+    if (rsubfilters_reject(pubidx, sz, data)) {
+        /* nor if none of them wants it */
+        ZSTAT(pubs[pubidx.idx].stats.filtered++);
         return 1;
     }
 #endif
 
     relflag = zhe_bitset_test(pubs_isrel, pubidx.idx);
 
-    if (zhe_oc_am_draining_window(oc)) {
-        return !relflag;
-    } else if (!zhe_oc_pack_msdata(oc, relflag, pubs[pubidx.idx].rid, sz, tnow)) {
+#if HAVE_AUTO_UNICAST
+    cid_t cid;
+    if (!pub_conduit(pubidx, relflag, sz, &cid)) {
+        /* treated like a full window, only reliable publications ever have to wait */
+        ZSTAT(pubs[pubidx.idx].stats.rejected++);
+        return 0;
+    }
+    oc = zhe_out_conduit_from_cid(cid);
+#else
+    oc = zhe_out_conduit_from_cid(pubs[pubidx.idx].cid);
+#endif
+    if (zhe_oc_am_draining_window(oc) || !zhe_oc_pack_msdata(oc, relflag, pubs[pubidx.idx].rid, sz, tnow)) {
         /* for reliable, a full window means failure; for unreliable it is a non-issue */
+        ZSTAT(pubs[pubidx.idx].stats.rejected += (relflag != 0));
         return !relflag;
     } else {
         zhe_oc_pack_msdata_payload(oc, relflag, sz, data);
         zhe_oc_pack_msdata_done(oc, relflag, tnow);
-#if LATENCY_BUDGET == 0
-        zhe_pack_msend(tnow);
+        zhe_pack_latency_budget(pubs[pubidx.idx].latency_budget, tnow);
+#if HAVE_AUTO_UNICAST
+        if (relflag) {
+            pubs[pubidx.idx].unacked = true;
+            pubs[pubidx.idx].lastseq = zhe_oc_next_seq(oc);
+        }
+        ZSTAT(pubs[pubidx.idx].stats.unicast += (cid < 0));
 #endif
+        ZSTAT(pubs[pubidx.idx].stats.samples++);
+        ZSTAT(pubs[pubidx.idx].stats.bytes += sz);
         return 1;
     }
 }
 
+#if ENABLE_STATS
+int zhe_get_pub_stats(zhe_pubidx_t pubidx, struct zhe_pub_stats *st)
+{
+    if (pubidx.idx >= ZHE_MAX_PUBLICATIONS || pubs[pubidx.idx].rid == 0) {
+        return 0;
+    }
+    *st = pubs[pubidx.idx].stats;
+    return 1;
+}
+#endif
+
 int zhe_write_uri(const char *uri, const void *data, zhe_paysize_t sz, zhe_time_t tnow)
 {
     size_t urisz = strlen(uri);
+#if HAVE_MCPARTITIONS
+    const cid_t cid = mcpartition_cid(0, (zhe_paysize_t)urisz, (const uint8_t *)uri, 0);
+#else
+    const cid_t cid = 0;
+#endif
     if (!zhe_urivalid((const uint8_t *)uri, urisz)) {
         return -1;
-    } else if (!zhe_out_conduit_is_connected(0)) {
+    } else if (!zhe_out_conduit_is_connected(cid)) {
         return 1;
     } else {
-        struct out_conduit * const oc = zhe_out_conduit_from_cid(0);
+        struct out_conduit * const oc = zhe_out_conduit_from_cid(cid);
         if (zhe_oc_am_draining_window(oc)) {
             return 0;
         } else if (!zhe_oc_pack_mwdata(oc, 1, (zhe_paysize_t)urisz, uri, sz, tnow)) {
@@ -1169,9 +2167,7 @@ int zhe_write_uri(const char *uri, const void *data, zhe_paysize_t sz, zhe_time_
         } else {
             zhe_oc_pack_msdata_payload(oc, 1, sz, data);
             zhe_oc_pack_msdata_done(oc, 1, tnow);
-#if LATENCY_BUDGET == 0
-            zhe_pack_msend(tnow);
-#endif
+            zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
             return 1;
         }
     }
@@ -25,25 +25,44 @@
 #define WC_DCOMMIT_SIZE     (2) /* commit: header, commitid */
 #define WC_DPUB_SIZE        (1 + WC_RID_SIZE) /* pub: header, rid (not using properties) */
 #define WC_DSUB_SIZE        (2 + WC_RID_SIZE) /* sub: header, rid, mode (neither properties nor periodic modes) */
+#define WC_DSUBFILTER_SIZE  (7 + ZHE_SUBFILTER_MAXLEN) /* sub filter property: count, propid, length, op, offset, value */
+#define WC_DFPUB_SIZE       (1 + WC_RID_SIZE) /* forget pub: header, rid */
+#define WC_DFSUB_SIZE       (1 + WC_RID_SIZE) /* forget sub: header, rid */
 
 void zhe_decl_note_error_curpkt(enum zhe_declstatus status, zhe_rid_t rid);
 void zhe_decl_note_error_somepeer(peeridx_t peeridx, enum zhe_declstatus status, zhe_rid_t rid);
-int zhe_handle_msdata_deliver(zhe_rid_t prid, zhe_paysize_t paysz, const void *pay);
+/* Delivers N consecutive samples for PRID, returning how many were delivered: N, or if they
+   can't be delivered as a batch, 1 or 0 as for a single sample (0 meaning it must be retried) */
+unsigned zhe_handle_msdata_deliver(zhe_rid_t prid, unsigned n, const struct zhe_sample *samples);
 #if ZHE_MAX_URISPACE > 0
 int zhe_handle_mwdata_deliver(zhe_paysize_t urisz, const uint8_t *uri, zhe_paysize_t paysz, const void *pay);
 #endif
 
 void zhe_pubsub_init(void);
+#if HAVE_MCPARTITIONS
+/* Sets the table mapping resources to multicast conduits, false if it is invalid */
+bool zhe_mcpartitions_init(size_t n, const struct zhe_mcpartition *ps);
+#endif
 
 void zhe_rsub_register(peeridx_t peeridx, zhe_rid_t rid, uint8_t submode, bool tentative);
+void zhe_rsub_unregister(peeridx_t peeridx, zhe_rid_t rid, bool tentative);
 uint8_t zhe_rsub_precommit_status_for_Cflag(peeridx_t peeridx, zhe_rid_t *err_rid);
 uint8_t zhe_rsub_precommit(peeridx_t peeridx, zhe_rid_t *err_rid);
 void zhe_rsub_commit(peeridx_t peeridx);
 void zhe_rsub_precommit_curpkt_abort(peeridx_t peeridx);
 void zhe_reset_peer_rsubs(peeridx_t peeridx);
+#if HAVE_RSUB_FILTERS
+/* Notes the filter (NULL: none) in a declaration of a subscription to RID by PEERIDX, to be
+   called before registering the subscription */
+void zhe_rsub_note_filter(peeridx_t peeridx, zhe_rid_t rid, const struct zhe_subfilter *filter);
+#endif
 void zhe_rsub_precommit_curpkt_done(peeridx_t peeridx);
 
 void zhe_send_declares(zhe_time_t tnow);
+#if HAVE_TRANSIENT_CACHE
+/* Sends cached values of transient resources to peers that subscribed to them */
+void zhe_lvc_push(zhe_time_t tnow);
+#endif
 void zhe_note_declstatus(peeridx_t peeridx, uint8_t status, zhe_rid_t rid);
 void zhe_reset_peer_declstatus(peeridx_t peeridx);
 
@@ -0,0 +1,289 @@
+/* -*- mode: c; c-basic-offset: 4; fill-column: 95; -*- */
+#include <string.h>
+
+#include "zhe-config-deriv.h"
+#include "zhe-tracing.h"
+#include "zhe-assert.h"
+#include "zhe-int.h"
+#include "zhe-pack.h"
+#include "zhe-bitset.h"
+#include "zhe-query.h"
+
+#if HAVE_QUERY
+#include "zhe-uristore.h"
+#include "zhe-uri.h"
+
+/* Queries issued locally, complete once all peers that were established when it was sent have
+   sent their final reply (or have gone), or once QUERY_TIMEOUT has passed */
+struct outquery {
+    zhe_replyhandler_t handler; /* NULL: unused */
+    void *arg;
+    uint16_t qid;
+    zhe_time_t tdeadline;
+    DECL_BITSET(waiting, MAX_PEERS_1);
+};
+static struct outquery outqueries[ZHE_MAX_QUERIES];
+static uint16_t next_qid;
+
+/* Queries received from peers that still need (some of) their replies sent; CURSOR is the index
+   of the next stored sample to consider, with ZHE_MAX_STORED_SAMPLES meaning only the final reply
+   remains. A query with URISZ = 0 (one with a URI longer than we can store) matches nothing. */
+struct inquery {
+    peeridx_t peeridx; /* PEERIDX_INVALID: unused */
+    uint16_t qid;
+    struct peerid qpid;
+    size_t cursor;
+    zhe_paysize_t urisz;
+    uint8_t uri[ZHE_MAX_URILENGTH];
+};
+static struct inquery inqueries[ZHE_MAX_QUERIES];
+
+#if HAVE_STORAGE
+/* Sample store shared by all storages: the latest sample of at most ZHE_MAX_STORED_SAMPLES
+   resources, replacing the least recently updated one when full. Samples are filed under the
+   resource id, so data written using zhe_write_uri can't be stored. */
+struct stored_sample {
+    zhe_rid_t rid; /* 0: unused */
+    uint32_t tstamp;
+    zhe_paysize_t size;
+    uint8_t data[ZHE_MAX_STORED_PAYLOAD];
+};
+static struct stored_sample stored[ZHE_MAX_STORED_SAMPLES];
+static uint32_t stored_clock;
+#endif
+
+void zhe_query_init(void)
+{
+    memset(outqueries, 0, sizeof(outqueries));
+    next_qid = 0;
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        inqueries[i].peeridx = PEERIDX_INVALID;
+    }
+#if HAVE_STORAGE
+    memset(stored, 0, sizeof(stored));
+    stored_clock = 0;
+#endif
+}
+
+#if HAVE_STORAGE
+static bool stored_sample_matches(const struct stored_sample *e, zhe_paysize_t urisz, const uint8_t *uri)
+{
+    zhe_paysize_t sz;
+    const uint8_t *u;
+    return e->rid != 0 && urisz > 0 && zhe_uristore_geturi_for_rid(e->rid, &sz, &u) && zhe_urimatch(uri, urisz, u, sz);
+}
+
+static void storage_handler(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg)
+{
+    struct stored_sample *e = NULL;
+    (void)arg;
+    if (rid == 0) {
+        return;
+    }
+    for (size_t i = 0; i < ZHE_MAX_STORED_SAMPLES; i++) {
+        if (stored[i].rid == rid) {
+            e = &stored[i];
+            break;
+        } else if (e == NULL || (e->rid != 0 && (stored[i].rid == 0 || (int32_t)(stored[i].tstamp - e->tstamp) < 0))) {
+            e = &stored[i];
+        }
+    }
+    if (size > ZHE_MAX_STORED_PAYLOAD) {
+        /* better no value than a stale one */
+        ZT(PUBSUB, "storage: rid %ju - too large (%u)", (uintmax_t)rid, (unsigned)size);
+        if (e->rid == rid) {
+            memset(e, 0, sizeof(*e));
+        }
+        return;
+    }
+    if (e->rid != rid) {
+        ZT(PUBSUB, "storage: rid %ju - entry %u (was rid %ju)", (uintmax_t)rid, (unsigned)(e - stored), (uintmax_t)e->rid);
+        e->rid = rid;
+    }
+    e->tstamp = stored_clock++;
+    e->size = size;
+    memcpy(e->data, payload, size);
+}
+#endif
+
+static void complete_outquery(struct outquery *q)
+{
+    /* the slot is free before calling the handler, so that it may issue a new query */
+    const zhe_replyhandler_t handler = q->handler;
+    ZT(PUBSUB, "query %u: complete", (unsigned)q->qid);
+    q->handler = NULL;
+    handler(0, NULL, 0, q->arg);
+}
+
+int zhe_handle_mquery_deliver(peeridx_t peeridx, const struct peerid *qpid, uint16_t qid, zhe_paysize_t urisz, const uint8_t *uri)
+{
+    struct inquery *q = NULL;
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        if (inqueries[i].peeridx == PEERIDX_INVALID) {
+            q = &inqueries[i];
+            break;
+        }
+    }
+    if (q == NULL) {
+        ZT(PUBSUB, "handle_mquery: peeridx %u qid %u - no space", peeridx, (unsigned)qid);
+        return 0;
+    }
+    ZT(PUBSUB, "handle_mquery: peeridx %u qid %u - slot %u", peeridx, (unsigned)qid, (unsigned)(q - inqueries));
+    q->peeridx = peeridx;
+    q->qid = qid;
+    q->qpid = *qpid;
+    q->cursor = 0;
+    if (urisz <= ZHE_MAX_URILENGTH) {
+        q->urisz = urisz;
+        memcpy(q->uri, uri, urisz);
+    } else {
+        q->urisz = 0;
+    }
+    return 1;
+}
+
+void zhe_handle_mreply_deliver(peeridx_t peeridx, uint16_t qid, bool final, zhe_rid_t rid, zhe_paysize_t paysz, const void *pay)
+{
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        struct outquery * const q = &outqueries[i];
+        if (q->handler == NULL || q->qid != qid) {
+            continue;
+        } else if (!final) {
+            ZSTAT(zhe_gstats.replies_in++);
+            q->handler(rid, pay, paysz, q->arg);
+        } else {
+            zhe_bitset_clear(q->waiting, peeridx);
+            if (zhe_bitset_count(q->waiting, MAX_PEERS_1) == 0) {
+                complete_outquery(q);
+            }
+        }
+        return;
+    }
+    /* late reply to a query that timed out */
+}
+
+void zhe_reset_peer_queries(peeridx_t peeridx)
+{
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        if (inqueries[i].peeridx == peeridx) {
+            inqueries[i].peeridx = PEERIDX_INVALID;
+        }
+        /* completing the query is left to housekeeping, as this may be called while handling
+           input */
+        zhe_bitset_clear(outqueries[i].waiting, peeridx);
+    }
+}
+
+static bool send_replies(struct inquery *q, zhe_time_t tnow)
+{
+#if HAVE_UNICAST_CONDUIT
+    const cid_t cid = -(cid_t)q->peeridx-1;
+#else
+    const cid_t cid = 0;
+#endif
+    struct out_conduit * const oc = zhe_out_conduit_from_cid(cid);
+    if (!zhe_out_conduit_is_connected(cid)) {
+        return true;
+    } else if (zhe_oc_am_draining_window(oc)) {
+        return false;
+    }
+#if HAVE_STORAGE
+    for (; q->cursor < ZHE_MAX_STORED_SAMPLES; q->cursor++) {
+        const struct stored_sample * const e = &stored[q->cursor];
+        if (!stored_sample_matches(e, q->urisz, q->uri)) {
+            continue;
+        } else if (!zhe_oc_pack_mreply(oc, &q->qpid, q->qid, e->rid, e->size, tnow)) {
+            return false;
+        }
+        ZT(PUBSUB, "send_replies: peeridx %u qid %u rid %ju", q->peeridx, (unsigned)q->qid, (uintmax_t)e->rid);
+        zhe_oc_pack_mreply_payload(oc, e->size, e->data);
+        zhe_oc_pack_mreply_done(oc, tnow);
+        zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
+        ZSTAT(zhe_gstats.replies_out++);
+    }
+#endif
+    if (!zhe_oc_pack_mreply(oc, &q->qpid, q->qid, 0, 0, tnow)) {
+        return false;
+    }
+    ZT(PUBSUB, "send_replies: peeridx %u qid %u final", q->peeridx, (unsigned)q->qid);
+    zhe_oc_pack_mreply_done(oc, tnow);
+    zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
+    return true;
+}
+
+void zhe_query_housekeeping(zhe_time_t tnow)
+{
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        if (inqueries[i].peeridx != PEERIDX_INVALID && send_replies(&inqueries[i], tnow)) {
+            inqueries[i].peeridx = PEERIDX_INVALID;
+        }
+    }
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        struct outquery * const q = &outqueries[i];
+        if (q->handler != NULL && (zhe_bitset_count(q->waiting, MAX_PEERS_1) == 0 || (zhe_timediff_t)(tnow - q->tdeadline) >= 0)) {
+            complete_outquery(q);
+        }
+    }
+}
+#endif /* HAVE_QUERY */
+
+bool zhe_register_storage(zhe_rid_t rid, zhe_subidx_t *subidx)
+{
+#if HAVE_STORAGE
+    *subidx = zhe_subscribe(rid, 0, 0, storage_handler, NULL);
+    ZT(PUBSUB, "register_storage: rid %ju sub %u", (uintmax_t)rid, (unsigned)subidx->idx);
+    return true;
+#else
+    (void)rid; (void)subidx;
+    return false;
+#endif
+}
+
+int zhe_query(const char *uri, zhe_replyhandler_t handler, void *arg, zhe_time_t tnow)
+{
+#if HAVE_QUERY
+    const size_t urisz = strlen(uri);
+    struct outquery *q = NULL;
+    if (urisz > ZHE_MAX_URILENGTH || !zhe_urivalid((const uint8_t *)uri, urisz)) {
+        return -1;
+    }
+    for (size_t i = 0; i < ZHE_MAX_QUERIES; i++) {
+        if (outqueries[i].handler == NULL) {
+            q = &outqueries[i];
+            break;
+        }
+    }
+    if (q == NULL) {
+        return 0;
+    }
+    ZT_SETTIME(tnow);
+    memset(q->waiting, 0, sizeof(q->waiting));
+    if (zhe_out_conduit_is_connected(0)) {
+        struct out_conduit * const oc = zhe_out_conduit_from_cid(0);
+        if (zhe_oc_am_draining_window(oc) || !zhe_oc_pack_mquery(oc, next_qid, (zhe_paysize_t)urisz, uri, tnow)) {
+            return 0;
+        }
+        zhe_pack_latency_budget(LATENCY_BUDGET, tnow);
+        for (peeridx_t peeridx = zhe_established_peers_first(); peeridx != PEERIDX_INVALID; peeridx = zhe_established_peers_next(peeridx)) {
+            zhe_bitset_set(q->waiting, peeridx);
+        }
+        ZSTAT(zhe_gstats.queries_out++);
+    }
+    ZT(PUBSUB, "query %u: %s", (unsigned)next_qid, uri);
+    q->handler = handler;
+    q->arg = arg;
+    q->qid = next_qid++;
+    q->tdeadline = tnow + QUERY_TIMEOUT;
+#if HAVE_STORAGE
+    for (size_t i = 0; i < ZHE_MAX_STORED_SAMPLES; i++) {
+        if (stored_sample_matches(&stored[i], (zhe_paysize_t)urisz, (const uint8_t *)uri)) {
+            handler(stored[i].rid, stored[i].data, stored[i].size, arg);
+        }
+    }
+#endif
+    return 1;
+#else
+    (void)uri; (void)handler; (void)arg; (void)tnow;
+    return -1;
+#endif
+}
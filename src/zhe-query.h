@@ -0,0 +1,19 @@
+#ifndef ZHE_QUERY_H
+#define ZHE_QUERY_H
+
+#include "zhe-config-deriv.h"
+
+#if HAVE_QUERY
+struct peerid;
+
+void zhe_query_init(void);
+/* Queues a query from PEERIDX for answering by zhe_query_housekeeping, 0 if there is no room
+   (the MQUERY must then be retransmitted) */
+int zhe_handle_mquery_deliver(peeridx_t peeridx, const struct peerid *qpid, uint16_t qid, zhe_paysize_t urisz, const uint8_t *uri);
+void zhe_handle_mreply_deliver(peeridx_t peeridx, uint16_t qid, bool final, zhe_rid_t rid, zhe_paysize_t paysz, const void *pay);
+void zhe_reset_peer_queries(peeridx_t peeridx);
+/* Sends the replies to queued queries and completes the local queries that timed out */
+void zhe_query_housekeeping(zhe_time_t tnow);
+#endif
+
+#endif
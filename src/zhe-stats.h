@@ -0,0 +1,120 @@
+#ifndef ZHE_STATS_H
+#define ZHE_STATS_H
+
+#include "zhe.h"
+#include "zhe-config-deriv.h"
+
+#if ENABLE_STATS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* All counters are unsigned 32-bit integers that simply wrap around; they are only maintained if
+   ENABLE_STATS is set in the configuration. */
+
+struct zhe_stats {
+    uint32_t pkts_in;             /* number of calls to zhe_input */
+    uint32_t bytes_in;            /* number of bytes consumed by zhe_input */
+    uint32_t pkts_out;            /* number of packets accepted by zhe_platform_send */
+    uint32_t bytes_out;           /* total size of those packets */
+    uint32_t pkts_out_dropped;    /* number of packets zhe_platform_send failed to send */
+    uint32_t delivered;           /* reliable samples delivered */
+    uint32_t discarded;           /* reliable samples discarded because out-of-order or duplicate */
+    uint32_t synchs_out;          /* number of SYNCH messages sent */
+    uint32_t decls_out;           /* number of declarations sent (excluding retransmits) */
+    uint32_t decls_in;            /* number of declarations accepted from peers */
+    uint32_t transient_pushed;    /* cached samples of transient resources pushed to new subscribers */
+    uint32_t queries_out;         /* queries sent */
+    uint32_t replies_in;          /* replies received for our queries (excluding final ones) */
+    uint32_t replies_out;         /* replies sent from the local storages (excluding final ones) */
+};
+
+struct zhe_peer_stats {
+    zhe_paysize_t idlen;          /* length of peer id */
+    uint8_t id[PEERID_SIZE];      /* peer id */
+    uint32_t pkts_in;             /* packets received from this peer */
+    uint32_t bytes_in;
+    uint32_t pkts_out;            /* packets unicast to this peer */
+    uint32_t bytes_out;
+    uint32_t delivered;           /* reliable samples from this peer delivered */
+    uint32_t discarded;           /* reliable samples from this peer discarded */
+    uint32_t decls_in;            /* declarations accepted from this peer */
+    uint32_t acks_out;            /* ACKNACKs without retransmit request sent to this peer */
+    uint32_t nacks_out;           /* ACKNACKs requesting retransmits sent to this peer */
+    uint32_t acks_in;             /* ACKNACKs without retransmit request received from this peer */
+    uint32_t nacks_in;            /* ACKNACKs requesting retransmits received from this peer */
+    uint32_t hist_decls_done;     /* 1 once all existing declarations have been sent to this peer */
+    zhe_time_t hist_decls_time;   /* ... and the time that took since the session was established */
+};
+
+struct zhe_conduit_stats {
+    uint32_t pkts_out;            /* packets sent to the conduit's address */
+    uint32_t bytes_out;
+    uint32_t samples_out;         /* samples (data & declarations) written, reliable or not */
+    uint32_t rexmits;             /* samples retransmitted */
+    uint32_t nacks_in;            /* retransmit requests received */
+    uint32_t full_window;         /* number of times a reliable write found the transmit window full */
+    uint32_t xmitw_bytes_hwm;     /* high-water mark of transmit window occupancy in bytes */
+    uint32_t xmitw_samples_hwm;   /* high-water mark of transmit window occupancy in samples */
+    zhe_time_t draining_time;     /* total time spent draining a full transmit window */
+    zhe_time_t ack_latency_max;   /* max time from oldest unack'd sample (or previous ACK) to ACK */
+    zhe_time_t ack_latency_sum;   /* sum of ACK latencies, ... */
+    uint32_t ack_latency_count;   /* ... and their number, to allow computing an average */
+};
+
+struct zhe_pub_stats {
+    uint32_t samples;             /* samples written while remote subscribers exist */
+    uint32_t bytes;               /* payload bytes of those samples */
+    uint32_t nosubs;              /* samples not sent because there were no remote subscribers */
+    uint32_t rejected;            /* reliable samples rejected because of a full transmit window */
+    uint32_t filtered;            /* samples not sent because the filters of all remote subscribers rejected them */
+    uint32_t unicast;             /* samples sent over the unicast conduit of the only remote subscriber */
+};
+
+struct zhe_uristore_stats {
+    uint32_t free;                /* free bytes in the URI store (including allocator overhead) */
+    uint32_t garbage;             /* free bytes not yet collected by the GC, so garbage/free is the fragmentation */
+    uint32_t open;                /* size of the largest URI that can be stored without running the GC */
+    uint32_t gc_steps;            /* number of times the GC did some work */
+    uint32_t gc_urgent;           /* ... of which for a pending store (larger budget) or zhe_compact (all garbage) */
+    uint32_t gc_bytes_moved;      /* bytes moved by the GC */
+    uint32_t store_again;         /* stores that failed until the GC has run (IAR_AGAIN) */
+    uint32_t store_nospace;       /* stores that failed for lack of space */
+};
+
+struct zhe_subqueue_stats {
+    uint32_t depth;               /* number of samples currently in the queue */
+    uint32_t depth_max;           /* high-water mark of the depth */
+    uint32_t enqueued;            /* samples added to the queue */
+    uint32_t dropped;             /* samples discarded because of a full queue or for being too large */
+    uint32_t refused;             /* deliveries refused because of a full queue (ZHE_SUBQ_REFUSE) */
+};
+
+void zhe_get_stats(struct zhe_stats *st);
+
+/* Returns 0 if URIs are not supported (ZHE_MAX_URISPACE = 0) */
+int zhe_get_uristore_stats(struct zhe_uristore_stats *st);
+
+/* Returns 0 if PEERIDX (in [0,MAX_PEERS_1-1]) is not an established session, else fills *st. The
+   counters of a peer start from 0 when the session is established. */
+int zhe_get_peer_stats(unsigned peeridx, struct zhe_peer_stats *st);
+
+/* CID >= 0 is a multicast conduit, CID < 0 is the unicast conduit to peer -CID-1 (or, in client
+   mode, 0 is the unicast conduit to the broker). Returns 0 if the conduit doesn't exist. The
+   counters for a unicast conduit start from 0 when the session is established. */
+int zhe_get_conduit_stats(int cid, struct zhe_conduit_stats *st);
+
+/* Returns 0 if PUBIDX is not a publication */
+int zhe_get_pub_stats(zhe_pubidx_t pubidx, struct zhe_pub_stats *st);
+
+/* Returns 0 if SUBIDX is not a queued subscription */
+int zhe_get_subqueue_stats(zhe_subidx_t subidx, struct zhe_subqueue_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ENABLE_STATS */
+
+#endif
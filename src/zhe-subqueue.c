@@ -0,0 +1,200 @@
+/* -*- mode: c; c-basic-offset: 4; fill-column: 95; -*- */
+#include <string.h>
+
+#include "zhe-config-deriv.h"
+#include "zhe-tracing.h"
+#include "zhe-assert.h"
+#include "zhe-int.h"
+#include "zhe-subqueue.h"
+
+#if HAVE_SUBQUEUES
+
+#if (SUBQUEUE_DEPTH & (SUBQUEUE_DEPTH - 1)) != 0
+#  error "SUBQUEUE_DEPTH must be a power of 2"
+#endif
+#if ZHE_MAX_SUBQUEUES >= UINT8_MAX
+#  error "ZHE_MAX_SUBQUEUES must be < 255"
+#endif
+
+/* The ring indices are shared between the thread calling zhe_input (the producer) and the one
+   calling zhe_subqueue_take (the consumer). Without the GCC/Clang atomic builtins, the queues can
+   only be used from a single thread. */
+#if defined __GNUC__
+#define SQ_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SQ_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SQ_CAS(p, expp, v) __atomic_compare_exchange_n((p), (expp), (v), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define SQ_LOAD(p) (*(p))
+#define SQ_STORE(p, v) (*(p) = (v))
+static bool sq_cas(uint32_t *p, uint32_t *expp, uint32_t v)
+{
+    if (*p == *expp) {
+        *p = v;
+        return true;
+    } else {
+        *expp = *p;
+        return false;
+    }
+}
+#define SQ_CAS(p, expp, v) sq_cas((p), (expp), (v))
+#endif
+
+struct subqueue_slot {
+    zhe_rid_t rid;
+    zhe_paysize_t size;
+    uint8_t data[SUBQUEUE_PAYLOAD];
+};
+
+/* Single-producer, single-consumer ring with free-running indices: HEAD is only written by the
+   producer, TAIL is advanced by the consumer and, for DROP_OLDEST, also by the producer when it
+   discards the oldest sample. Either one only advances it using a compare-and-swap, so a consumer
+   that was copying a sample the producer has meanwhile overwritten notices and tries again. */
+struct subqueue {
+    bool inuse;
+    enum zhe_subqueue_policy policy;
+    uint32_t head;
+    uint32_t tail;
+#if ENABLE_STATS
+    struct zhe_subqueue_stats stats;
+#endif
+    struct subqueue_slot slots[SUBQUEUE_DEPTH];
+};
+static struct subqueue subqueues[ZHE_MAX_SUBQUEUES];
+
+/* Queue index for each subscription (ZHE_MAX_SUBQUEUES if not queued), so the consumer never
+   looks at anything but the queue it is draining */
+#define SUBQUEUE_NONE ((uint8_t)ZHE_MAX_SUBQUEUES)
+static uint8_t sub2queue[ZHE_MAX_SUBSCRIPTIONS];
+
+void zhe_subqueue_init(void)
+{
+    memset(subqueues, 0, sizeof(subqueues));
+    memset(sub2queue, SUBQUEUE_NONE, sizeof(sub2queue));
+}
+
+bool zhe_subqueue_accepts(const void *arg, unsigned n)
+{
+    const struct subqueue * const q = arg;
+    return q->policy != ZHE_SUBQ_REFUSE || q->head - SQ_LOAD(&q->tail) + n <= SUBQUEUE_DEPTH;
+}
+
+void zhe_subqueue_put(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg)
+{
+    struct subqueue * const q = arg;
+    const uint32_t head = q->head;
+    uint32_t tail = SQ_LOAD(&q->tail);
+    if (size > SUBQUEUE_PAYLOAD) {
+        ZT(PUBSUB, "subqueue %u: rid %ju - too large (%u)", (unsigned)(q - subqueues), (uintmax_t)rid, (unsigned)size);
+        ZSTAT(q->stats.dropped++);
+        return;
+    }
+    if (head - tail == SUBQUEUE_DEPTH) {
+        /* REFUSE is checked before delivering, but a sample that matches several times would
+           find it full after all */
+        if (q->policy != ZHE_SUBQ_DROP_OLDEST) {
+            ZSTAT(q->stats.dropped++);
+            return;
+        } else if (SQ_CAS(&q->tail, &tail, tail + 1)) {
+            ZSTAT(q->stats.dropped++);
+        } else {
+            /* the consumer just took the oldest one, so there is room */
+        }
+    }
+    struct subqueue_slot * const s = &q->slots[head % SUBQUEUE_DEPTH];
+    s->rid = rid;
+    s->size = size;
+    memcpy(s->data, payload, size);
+    SQ_STORE(&q->head, head + 1);
+#if ENABLE_STATS
+    const uint32_t depth = head + 1 - SQ_LOAD(&q->tail);
+    q->stats.enqueued++;
+    if (depth > q->stats.depth_max) {
+        q->stats.depth_max = depth;
+    }
+#endif
+}
+
+void zhe_subqueue_release(void *arg)
+{
+    struct subqueue * const q = arg;
+    zhe_assert(q->inuse);
+    for (size_t i = 0; i < ZHE_MAX_SUBSCRIPTIONS; i++) {
+        if (sub2queue[i] == (uint8_t)(q - subqueues)) {
+            sub2queue[i] = SUBQUEUE_NONE;
+        }
+    }
+    q->inuse = false;
+}
+
+#if ENABLE_STATS
+void zhe_subqueue_note_refused(const void *arg)
+{
+    struct subqueue * const q = (struct subqueue *)arg;
+    q->stats.refused++;
+}
+
+int zhe_get_subqueue_stats(zhe_subidx_t subidx, struct zhe_subqueue_stats *st)
+{
+    if (subidx.idx >= ZHE_MAX_SUBSCRIPTIONS || sub2queue[subidx.idx] == SUBQUEUE_NONE) {
+        return 0;
+    }
+    const struct subqueue * const q = &subqueues[sub2queue[subidx.idx]];
+    *st = q->stats;
+    st->depth = q->head - SQ_LOAD(&q->tail);
+    return 1;
+}
+#endif
+#endif /* HAVE_SUBQUEUES */
+
+bool zhe_subscribe_queued(zhe_rid_t rid, enum zhe_subqueue_policy policy, zhe_subidx_t *subidx)
+{
+#if HAVE_SUBQUEUES
+    struct subqueue *q = NULL;
+    for (size_t i = 0; i < ZHE_MAX_SUBQUEUES; i++) {
+        if (!subqueues[i].inuse) {
+            q = &subqueues[i];
+            break;
+        }
+    }
+    if (q == NULL) {
+        return false;
+    }
+    memset(q, 0, offsetof(struct subqueue, slots));
+    q->inuse = true;
+    q->policy = policy;
+    *subidx = zhe_subscribe(rid, 0, 0, zhe_subqueue_put, q);
+    sub2queue[subidx->idx] = (uint8_t)(q - subqueues);
+    ZT(PUBSUB, "subscribe_queued: %u rid %ju queue %u policy %d", subidx->idx, (uintmax_t)rid, (unsigned)(q - subqueues), (int)policy);
+    return true;
+#else
+    (void)rid; (void)policy; (void)subidx;
+    return false;
+#endif
+}
+
+bool zhe_subqueue_take(zhe_subidx_t subidx, zhe_rid_t *rid, void *buf, zhe_paysize_t bufsz, zhe_paysize_t *size)
+{
+#if HAVE_SUBQUEUES
+    zhe_assert(subidx.idx < ZHE_MAX_SUBSCRIPTIONS && sub2queue[subidx.idx] != SUBQUEUE_NONE);
+    struct subqueue * const q = &subqueues[sub2queue[subidx.idx]];
+    uint32_t tail = SQ_LOAD(&q->tail);
+    do {
+        if (tail == SQ_LOAD(&q->head)) {
+            return false;
+        }
+        const struct subqueue_slot * const s = &q->slots[tail % SUBQUEUE_DEPTH];
+        zhe_paysize_t n = s->size;
+        *rid = s->rid;
+        *size = n;
+        /* a size torn by a concurrent overwrite must not overrun anything, the CAS fails anyway */
+        if (n > SUBQUEUE_PAYLOAD) {
+            n = SUBQUEUE_PAYLOAD;
+        }
+        memcpy(buf, s->data, (n <= bufsz) ? n : bufsz);
+    } while (!SQ_CAS(&q->tail, &tail, tail + 1));
+    return true;
+#else
+    (void)subidx; (void)rid; (void)buf; (void)bufsz; (void)size;
+    return false;
+#endif
+}
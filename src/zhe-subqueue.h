@@ -0,0 +1,20 @@
+#ifndef ZHE_SUBQUEUE_H
+#define ZHE_SUBQUEUE_H
+
+#include "zhe-config-deriv.h"
+
+#if HAVE_SUBQUEUES
+void zhe_subqueue_init(void);
+/* Subscription handler of a queued subscription, ARG is its queue */
+void zhe_subqueue_put(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg);
+/* False if the queue has no room for N samples and its policy is to refuse new samples, which the
+   caller must then treat like a full transmit window: not delivering them so they get
+   retransmitted */
+bool zhe_subqueue_accepts(const void *arg, unsigned n);
+void zhe_subqueue_release(void *arg);
+#if ENABLE_STATS
+void zhe_subqueue_note_refused(const void *arg);
+#endif
+#endif
+
+#endif
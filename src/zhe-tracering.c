@@ -0,0 +1,98 @@
+#include <string.h>
+#include "zhe-config-deriv.h"
+#include "zhe-tracing.h"
+
+#if ENABLE_TRACING && TRACE_RING_SIZE > 0
+
+#if (TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) != 0
+#  error "TRACE_RING_SIZE must be a power of 2"
+#endif
+
+/* Dump format (all integers little-endian):
+
+     header: "ZTRC" version:u8 maxargs:u8 0:u16 timebase:u32
+     record: seq:u32 t:u32 cat:u8 nargs:u8 fmtref:u32 [fmtlen:u16 fmt:fmtlen] args:u32*nargs
+
+   where timebase is ZHE_TIMEBASE, the number of nanoseconds in one unit of t, and the format
+   string is included only if fmtref = seq, otherwise it refers to the (earlier) record with
+   sequence number fmtref. */
+#define ZTRING_DUMP_VERSION 1
+
+struct trace_rec {
+    zhe_time_t t;
+    const char *fmt;
+    uint8_t cat;
+    uint8_t nargs;
+    uint32_t args[ZTRING_MAXARGS];
+};
+
+static struct trace_rec trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_ring_seq; /* sequence number of next record, index is seq % TRACE_RING_SIZE */
+zhe_time_t zhe_trace_tnow;
+
+void zhe_trace_ring_record(unsigned cat, const char *fmt, unsigned nargs, const uint32_t *args)
+{
+    struct trace_rec * const r = &trace_ring[trace_ring_seq % TRACE_RING_SIZE];
+    r->t = zhe_trace_tnow;
+    r->fmt = fmt;
+    r->cat = (uint8_t)cat;
+    r->nargs = (uint8_t)nargs;
+    if (nargs > 0) {
+        memcpy(r->args, args, nargs * sizeof(*args));
+    }
+    trace_ring_seq++;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t x)
+{
+    *p++ = (uint8_t)x;
+    *p++ = (uint8_t)(x >> 8);
+    return p;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t x)
+{
+    p = put_u16(p, (uint16_t)x);
+    return put_u16(p, (uint16_t)(x >> 16));
+}
+
+void zhe_trace_ring_dump(void (*out)(void *arg, const void *buf, size_t sz), void *arg)
+{
+    const uint32_t end = trace_ring_seq;
+    const uint32_t start = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+    uint8_t buf[16 + 4 * ZTRING_MAXARGS], *p;
+
+    memcpy(buf, "ZTRC", 4);
+    buf[4] = ZTRING_DUMP_VERSION;
+    buf[5] = ZTRING_MAXARGS;
+    p = put_u16(buf + 6, 0);
+    p = put_u32(p, ZHE_TIMEBASE);
+    out(arg, buf, (size_t)(p - buf));
+
+    for (uint32_t seq = start; seq != end; seq++) {
+        const struct trace_rec * const r = &trace_ring[seq % TRACE_RING_SIZE];
+        /* Quadratic, but dumping is rare and the number of distinct format strings is small */
+        uint32_t fmtref = start;
+        while (trace_ring[fmtref % TRACE_RING_SIZE].fmt != r->fmt) {
+            fmtref++;
+        }
+        p = put_u32(buf, seq);
+        p = put_u32(p, (uint32_t)r->t);
+        *p++ = r->cat;
+        *p++ = r->nargs;
+        p = put_u32(p, fmtref);
+        if (fmtref == seq) {
+            const size_t len = strlen(r->fmt);
+            p = put_u16(p, (uint16_t)len);
+            out(arg, buf, (size_t)(p - buf));
+            out(arg, r->fmt, (uint16_t)len);
+            p = buf;
+        }
+        for (uint8_t i = 0; i < r->nargs; i++) {
+            p = put_u32(p, r->args[i]);
+        }
+        out(arg, buf, (size_t)(p - buf));
+    }
+}
+
+#endif
@@ -16,11 +16,55 @@ extern unsigned zhe_trace_cats;
 extern struct zhe_platform *zhe_platform;
 
 #define ZTT(catsimple_) (zhe_trace_cats & ZTCAT_##catsimple_)
+
+#if TRACE_RING_SIZE > 0
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary tracing: instead of formatting the message, ZT stores the category, the address of the
+   format string, the time of the latest call into zhe (zhe_input, zhe_housekeeping, &c.) and up to
+   ZTRING_MAXARGS arguments truncated to 32-bit integers in a ring buffer of TRACE_RING_SIZE
+   records.  The buffer can be written out using zhe_trace_ring_dump and then be turned into text
+   using the decoder in example/tracedec.  Strings can't be recovered that way. */
+#define ZTRING_MAXARGS 8
+
+extern zhe_time_t zhe_trace_tnow;
+void zhe_trace_ring_record(unsigned cat, const char *fmt, unsigned nargs, const uint32_t *args);
+
+/* Writes the contents of the ring buffer, oldest record first, by calling OUT one or more times;
+   like every other zhe function it must not be called concurrently with zhe */
+void zhe_trace_ring_dump(void (*out)(void *arg, const void *buf, size_t sz), void *arg);
+
+#define ZT_SETTIME(tnow_) (zhe_trace_tnow = (tnow_))
+
+#define ZT_A_(x) ((uint32_t)(uintptr_t)(x))
+#define ZT_N_(...) ZT_N1_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define ZT_N1_(f, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define ZT_REC_(cat, n, ...) ZT_REC1_(cat, n, __VA_ARGS__)
+#define ZT_REC1_(cat, n, ...) ZT_REC_##n(cat, __VA_ARGS__)
+#define ZT_REC_0(c, f) zhe_trace_ring_record(c, f, 0, NULL)
+#define ZT_REC_1(c, f, a) zhe_trace_ring_record(c, f, 1, (const uint32_t[]){ ZT_A_(a) })
+#define ZT_REC_2(c, f, a, b) zhe_trace_ring_record(c, f, 2, (const uint32_t[]){ ZT_A_(a), ZT_A_(b) })
+#define ZT_REC_3(c, f, a, b, d) zhe_trace_ring_record(c, f, 3, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d) })
+#define ZT_REC_4(c, f, a, b, d, e) zhe_trace_ring_record(c, f, 4, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d), ZT_A_(e) })
+#define ZT_REC_5(c, f, a, b, d, e, g) zhe_trace_ring_record(c, f, 5, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d), ZT_A_(e), ZT_A_(g) })
+#define ZT_REC_6(c, f, a, b, d, e, g, h) zhe_trace_ring_record(c, f, 6, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d), ZT_A_(e), ZT_A_(g), ZT_A_(h) })
+#define ZT_REC_7(c, f, a, b, d, e, g, h, i) zhe_trace_ring_record(c, f, 7, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d), ZT_A_(e), ZT_A_(g), ZT_A_(h), ZT_A_(i) })
+#define ZT_REC_8(c, f, a, b, d, e, g, h, i, j) zhe_trace_ring_record(c, f, 8, (const uint32_t[]){ ZT_A_(a), ZT_A_(b), ZT_A_(d), ZT_A_(e), ZT_A_(g), ZT_A_(h), ZT_A_(i), ZT_A_(j) })
+
+#define ZT(catsimple_, ...) ((zhe_trace_cats & ZTCAT_##catsimple_) ? ZT_REC_(ZTCAT_##catsimple_, ZT_N_(__VA_ARGS__), __VA_ARGS__) : (void)0)
+
+#else
+
+#define ZT_SETTIME(tnow_) ((void)0)
 #define ZT(catsimple_, ...) ((zhe_trace_cats & ZTCAT_##catsimple_) ? zhe_platform_trace(zhe_platform, __VA_ARGS__) : (void)0)
 
+#endif
+
 #else
 
 #define ZTT(catsimple_) (0)
+#define ZT_SETTIME(tnow_) ((void)0)
 #define ZT(catsimple_, ...) ((void)0)
 
 #endif
@@ -1,3 +1,4 @@
+#include <string.h>
 #include <limits.h>
 #include "zhe-assert.h"
 #include "zhe-int.h"
@@ -326,3 +327,20 @@ int zhe_unpack_props_iter(struct unpack_props_iter *it, uint8_t *propid, zhe_pay
     }
     return 0;
 }
+
+bool zhe_unpack_subfilter(zhe_paysize_t sz, const uint8_t *data, struct zhe_subfilter *filter)
+{
+    const uint8_t * const end = data + sz;
+    uint8_t op;
+    uint16_t offset;
+    if (zhe_unpack_byte(end, &data, &op) != ZUR_OK || op > (uint8_t)ZHE_SUBFILTER_GE ||
+        zhe_unpack_vle16(end, &data, &offset) != ZUR_OK ||
+        end - data < 1 || end - data > ZHE_SUBFILTER_MAXLEN) {
+        return false;
+    }
+    filter->op = (enum zhe_subfilter_op)op;
+    filter->offset = offset;
+    filter->len = (uint8_t)(end - data);
+    memcpy(filter->value, data, filter->len);
+    return true;
+}
@@ -32,6 +32,8 @@ struct unpack_props_iter {
 
 zhe_unpack_result_t zhe_unpack_props(uint8_t const * const end, uint8_t const * * const data, struct unpack_props_iter *it) ZHE_NONNULL_ALL;
 int zhe_unpack_props_iter(struct unpack_props_iter *it, uint8_t *propid, zhe_paysize_t *sz, const uint8_t **data) ZHE_NONNULL_ALL;
+/* Interprets the value of a PROP_SUBFILTER property, false if it isn't a valid filter */
+bool zhe_unpack_subfilter(zhe_paysize_t sz, const uint8_t *data, struct zhe_subfilter *filter) ZHE_NONNULL_ALL;
 
 struct unpack_locs_iter {
     uint16_t n;
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <string.h>
 #include "zhe-uri.h"
 
 static bool juststars(size_t sz, const uint8_t *x)
@@ -11,7 +12,14 @@ static bool juststars(size_t sz, const uint8_t *x)
     return true;
 }
 
-bool zhe_urimatch(const uint8_t *a, size_t asz, const uint8_t *b, size_t bsz)
+/* Length of the path, i.e., without the resource properties that may follow a # */
+static size_t uripathlen(const uint8_t *a, size_t asz)
+{
+    const uint8_t *hash = memchr(a, '#', asz);
+    return (hash == NULL) ? asz : (size_t)(hash - a);
+}
+
+static bool urimatch1(const uint8_t *a, size_t asz, const uint8_t *b, size_t bsz)
 {
     /* FIXME: complexity and recursion are both anathema to a very constrained execution environment */
 
@@ -21,30 +29,57 @@ bool zhe_urimatch(const uint8_t *a, size_t asz, const uint8_t *b, size_t bsz)
     } else if (*a == '*') {
         if (asz >= 2 && *(a+1) == '*') {
             /* ** allows any number of characters including slashes, which means some suffix of b should match the remainder of a. Any string matched by ** is also matched by * so it is safe to ignore *s in b */
-            return zhe_urimatch(a+2, asz-2, b, bsz) || zhe_urimatch(a, asz, b+1, bsz-1);
+            return urimatch1(a+2, asz-2, b, bsz) || urimatch1(a, asz, b+1, bsz-1);
         } else {
             /* similar, but we can't move forward over slashes */
-            return zhe_urimatch(a+1, asz-1, b, bsz) || (*b != '/' && zhe_urimatch(a, asz, b+1, bsz-1));
+            return urimatch1(a+1, asz-1, b, bsz) || (*b != '/' && urimatch1(a, asz, b+1, bsz-1));
         }
     } else if (*b == '?') {
         /* if a does not start with a *, then we can try matching a question mark in b */
-        return *a != '/' && zhe_urimatch(a+1, asz-1, b+1, bsz-1);
+        return *a != '/' && urimatch1(a+1, asz-1, b+1, bsz-1);
     } else if (*a == '?' || *b == '*') {
         /* if wildcards are in other operand, swap & try again */
-        return zhe_urimatch(b, bsz, a, asz);
+        return urimatch1(b, bsz, a, asz);
     } else if (*a == *b) {
         /* not a wildcard means characters must match */
-        return zhe_urimatch(a+1, asz-1, b+1, bsz-1);
+        return urimatch1(a+1, asz-1, b+1, bsz-1);
     } else {
         return false;
     }
 }
 
-bool zhe_urivalid(const uint8_t *a, size_t asz)
+bool zhe_urimatch(const uint8_t *a, size_t asz, const uint8_t *b, size_t bsz)
 {
-    if (asz > ZHE_MAX_URILENGTH) {
-        return false;
-    } else if (!((asz >= 1 && a[0] == '/') || (asz >= 2 && a[0] == '*' && a[1] == '*'))) {
+    /* properties are not part of the name */
+    return urimatch1(a, uripathlen(a, asz), b, uripathlen(b, bsz));
+}
+
+static bool uritagchar(uint8_t c)
+{
+    return isalnum(c) || c == '-' || c == '_';
+}
+
+/* Properties following the #: a single tag or a comma-separated list of them between braces */
+static bool uripropsvalid(const uint8_t *a, size_t asz)
+{
+    if (asz > 0 && a[0] == '{') {
+        if (asz < 3 || a[asz-1] != '}') {
+            return false;
+        }
+        a++;
+        asz -= 2;
+    }
+    for (size_t i = 0; i < asz; i++) {
+        if (!(uritagchar(a[i]) || (a[i] == ',' && i > 0 && i+1 < asz && a[i-1] != ','))) {
+            return false;
+        }
+    }
+    return asz > 0;
+}
+
+static bool uripathvalid(const uint8_t *a, size_t asz)
+{
+    if (!((asz >= 1 && a[0] == '/') || (asz >= 2 && a[0] == '*' && a[1] == '*'))) {
         /* should've started with either / or ** */
         return false;
     } else if (a[asz-1] == '/') {
@@ -64,3 +99,15 @@ bool zhe_urivalid(const uint8_t *a, size_t asz)
         return true;
     }
 }
+
+bool zhe_urivalid(const uint8_t *a, size_t asz)
+{
+    const size_t pathsz = uripathlen(a, asz);
+    if (asz > ZHE_MAX_URILENGTH) {
+        return false;
+    } else if (pathsz < asz && !uripropsvalid(a + pathsz + 1, asz - pathsz - 1)) {
+        return false;
+    } else {
+        return uripathvalid(a, pathsz);
+    }
+}
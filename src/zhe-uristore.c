@@ -9,6 +9,7 @@
 #include "zhe-tracing.h"
 #include "zhe-uristore.h"
 #include "zhe-uri.h"
+#include "zhe-stats.h"
 
 /* FIXME: get rid of these two -- or at least pubsub.h? */
 #include "zhe-int.h"
@@ -41,6 +42,11 @@ static struct restable ress[ZHE_MAX_RESOURCES]; /* contains nres entries where r
 static zhe_residx_t ress_idx[ZHE_MAX_RESOURCES];
 static zhe_rid_t ress_rid[ZHE_MAX_RESOURCES];
 
+static zhe_time_t gc_tlast;
+#if ENABLE_STATS
+static struct zhe_uristore_stats uristats;
+#endif
+
 void zhe_uristore_init(void)
 {
     zhe_icgcb_init(&uris.b, sizeof(uris));
@@ -51,6 +57,10 @@ void zhe_uristore_init(void)
         ress_rid[i] = 0;
     }
     nres = 0;
+    gc_tlast = 0;
+#if ENABLE_STATS
+    memset(&uristats, 0, sizeof(uristats));
+#endif
 }
 
 static void set_props_one(struct restable * const r, const uint8_t *tag, size_t taglen)
@@ -65,7 +75,7 @@ static void set_props_one(struct restable * const r, const uint8_t *tag, size_t
 static size_t scan_uri(const uint8_t *s, uint8_t a, uint8_t b, size_t n)
 {
     for (size_t i = 0; i < n; i++) {
-        if (*s == a && *s == b) {
+        if (*s == a || *s == b) {
             return i;
         } else {
             s++;
@@ -76,6 +86,7 @@ static size_t scan_uri(const uint8_t *s, uint8_t a, uint8_t b, size_t n)
 
 static void set_props_list(struct restable * const r, const uint8_t *tag, size_t len)
 {
+    /* comma-separated list of tags terminated by a '}', ignored if the terminator is missing */
     while (len > 0) {
         const size_t taglen = scan_uri(tag, ',', '}', len);
         zhe_assert(taglen <= len);
@@ -83,9 +94,12 @@ static void set_props_list(struct restable * const r, const uint8_t *tag, size_t
             return;
         }
         set_props_one(r, tag, taglen);
+        if (tag[taglen] == '}') {
+            return;
+        }
         tag += taglen + 1;
-        len -= taglen - 1;
-    } while(tag[-1] == ',');
+        len -= taglen + 1;
+    }
 }
 
 static peeridx_t zhe_uristore_record_tentative(peeridx_t peeridx, zhe_residx_t idx)
@@ -124,9 +138,11 @@ static enum uristore_result zhe_uristore_store_new(zhe_residx_t free_idx, peerid
             break;
         case IAR_AGAIN:
             ZT(PUBSUB, "uristore_store: again");
+            ZSTAT(uristats.store_again++);
             return USR_AGAIN;
         case IAR_NOSPACE:
             ZT(PUBSUB, "uristore_store: no space");
+            ZSTAT(uristats.store_nospace++);
             return USR_NOSPACE;
     }
     ress[free_idx].rid = rid;
@@ -285,6 +301,11 @@ void zhe_uristore_drop(peeridx_t peeridx, zhe_rid_t rid)
     }
 }
 
+bool zhe_uristore_transient_for_idx(zhe_residx_t idx)
+{
+    return ress[idx].rid != 0 && ress[idx].transient;
+}
+
 bool zhe_uristore_geturi_for_idx(zhe_residx_t idx, zhe_rid_t *rid, zhe_paysize_t *sz, const uint8_t **uri, bool *islocal)
 {
     const struct restable * const r = &ress[idx];
@@ -356,11 +377,69 @@ static void move_cb(uripos_t ref, void *newptr, void *arg)
     ress[ref].uripos = (uripos_t)((uint8_t *)newptr - uris.store);
 }
 
-void zhe_uristore_gc(void)
+static void uristore_gc_budget(uripos_t maxblocks, uripos_t maxbytes)
 {
-    zhe_icgcb_gc(&uris.b, move_cb, NULL);
+    const uripos_t moved = zhe_icgcb_gc_budget(&uris.b, maxblocks, maxbytes, move_cb, NULL);
+    ZSTAT(uristats.gc_steps++);
+    ZSTAT(uristats.gc_bytes_moved += moved);
+    (void)moved;
 }
 
+void zhe_uristore_gc(zhe_time_t tnow)
+{
+    const uripos_t garbage = zhe_icgcb_garbage(&uris.b);
+    if (garbage == 0) {
+        return;
+    } else if (uris.b.need > 0) {
+        /* A store failed for a lack of contiguous space and the declaration will be retried when it
+           is retransmitted. Open space only grows once all garbage has been collected, so this runs
+           on every call, unscaled by fragmentation and with URISTORE_GC_PRESSURE_FACTOR times the
+           budget, but still bounded to keep housekeeping from stalling on a large store: the
+           retries until the collection completes are cheaper than that. */
+        ZT(PUBSUB, "uristore_gc: pressure (need %u, garbage %u)", (unsigned)uris.b.need, (unsigned)garbage);
+        ZSTAT(uristats.gc_urgent++);
+        const uint64_t maxblocks = (uint64_t)URISTORE_GC_MAX_BLOCKS * URISTORE_GC_PRESSURE_FACTOR;
+        const uint64_t maxbytes = (uint64_t)URISTORE_GC_MAX_BYTES * URISTORE_GC_PRESSURE_FACTOR;
+        uristore_gc_budget((maxblocks < URIPOS_MAX) ? (uripos_t)maxblocks : URIPOS_MAX,
+                           (maxbytes < URIPOS_MAX) ? (uripos_t)maxbytes : URIPOS_MAX);
+    } else {
+#if URISTORE_GC_IDLE_INTERVAL == 0
+        /* No pressure and no scaling: a fixed budget on every call */
+        uristore_gc_budget(URISTORE_GC_MAX_BLOCKS, URISTORE_GC_MAX_BYTES);
+#else
+        /* No pressure: the budget scales with the fraction of the free space that is fragmented (in
+           1/256ths) and with little fragmentation, it only runs every URISTORE_GC_IDLE_INTERVAL */
+        const uint32_t frag = (uint32_t)(((uint64_t)garbage << 8) / uris.b.freespace);
+        if (frag < 64 && (zhe_timediff_t)(tnow - gc_tlast) < URISTORE_GC_IDLE_INTERVAL) {
+            return;
+        }
+        const uint64_t maxblocks = 1 + (((uint64_t)URISTORE_GC_MAX_BLOCKS * frag) >> 8);
+        const uint64_t maxbytes = 1 + (((uint64_t)URISTORE_GC_MAX_BYTES * frag) >> 8);
+        uristore_gc_budget((maxblocks < URIPOS_MAX) ? (uripos_t)maxblocks : URIPOS_MAX,
+                           (maxbytes < URIPOS_MAX) ? (uripos_t)maxbytes : URIPOS_MAX);
+#endif
+    }
+    gc_tlast = tnow;
+}
+
+void zhe_uristore_compact(void)
+{
+    if (zhe_icgcb_garbage(&uris.b) > 0) {
+        ZSTAT(uristats.gc_urgent++);
+        uristore_gc_budget(URIPOS_MAX, URIPOS_MAX);
+    }
+}
+
+#if ENABLE_STATS
+void zhe_uristore_get_stats(struct zhe_uristore_stats *st)
+{
+    *st = uristats;
+    st->free = uris.b.freespace;
+    st->garbage = zhe_icgcb_garbage(&uris.b);
+    st->open = zhe_icgcb_openspace(&uris.b);
+}
+#endif
+
 zhe_residx_t zhe_uristore_nres(void)
 {
     return nres;
@@ -30,13 +30,20 @@ typedef struct uristore_iter {
 } uristore_iter_t;
 
 void zhe_uristore_init(void);
-void zhe_uristore_gc(void);
+/* Incremental GC, called from housekeeping; compact collects all garbage at once */
+void zhe_uristore_gc(zhe_time_t tnow);
+void zhe_uristore_compact(void);
+#if ENABLE_STATS
+struct zhe_uristore_stats;
+void zhe_uristore_get_stats(struct zhe_uristore_stats *st);
+#endif
 zhe_residx_t zhe_uristore_nres(void);
 #define URISTORE_PEERIDX_SELF MAX_PEERS
 /* if tentative & result is OK, *loser is set to INVALID if all is well or to the peeridx of the peer that lost on doing a tentative definition, which may be peeridx itself */
 enum uristore_result zhe_uristore_store(zhe_residx_t *res_idx, peeridx_t peeridx, zhe_rid_t rid, const uint8_t *uri, size_t urilen_in, bool tentative, peeridx_t *loser);
 void zhe_uristore_drop(peeridx_t peeridx, zhe_rid_t rid);
 void zhe_uristore_reset_peer(peeridx_t peeridx);
+bool zhe_uristore_transient_for_idx(zhe_residx_t idx);
 bool zhe_uristore_geturi_for_idx(zhe_residx_t idx, zhe_rid_t *rid, zhe_paysize_t *sz, const uint8_t **uri, bool *islocal);
 bool zhe_uristore_geturi_for_rid(zhe_rid_t rid, zhe_paysize_t *sz, const uint8_t **uri);
 bool zhe_uristore_getidx_for_rid(zhe_rid_t rid, zhe_residx_t *idx);
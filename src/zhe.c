@@ -13,6 +13,8 @@
 #include "zhe-unpack.h"
 #include "zhe-bitset.h"
 #include "zhe-pubsub.h"
+#include "zhe-query.h"
+#include "zhe-subqueue.h"
 #include "zhe-binheap.h"
 
 #if ZHE_MAX_URISPACE > 0
@@ -25,6 +27,10 @@
 #define PEERST_OPENING_MAX   5
 #define PEERST_ESTABLISHED 255
 
+/* Once a peer stops scouting, KEEPALIVEs are only needed for peers that haven't been sent anything
+   recently; when scouting continues indefinitely the SCOUT messages keep the leases alive anyway */
+#define KEEPALIVE_SUPPRESSION (MAX_PEERS > 0 && SCOUT_COUNT > 0 && LEASE_DURATION > 0)
+
 static union {
     const struct peerid v;
     struct peerid v_nonconst;
@@ -73,12 +79,20 @@ struct out_conduit {
     seq_t    firstidx;
     xwpos_t *rbufidx;             /* rbuf[rbufidx[seq % xmitw_samples]] is first byte of length of message seq */
 #endif
+#if ENABLE_STATS
+    zhe_time_t tunacked;          /* time oldest unack'd sample was written or latest ACK was received */
+    zhe_time_t tdrain;            /* time draining_window was set */
+    struct zhe_conduit_stats stats;
+#endif
 };
 
 struct peer {
     uint8_t state;                /* connection state for this peer */
     zhe_time_t tlease;            /* peer must send something before tlease or we'll close the session | next time for scout/open msg */
     zhe_timediff_t lease_dur;     /* lease duration in ms */
+#if KEEPALIVE_SUPPRESSION
+    zhe_time_t tlastxmit;         /* time of last packet unicast to this peer */
+#endif
 #if HAVE_UNICAST_CONDUIT
     struct out_conduit oc;        /* unicast to this peer */
 #else
@@ -86,6 +100,10 @@ struct peer {
 #endif
     struct in_conduit ic[N_IN_CONDUITS]; /* one slot for each out conduit from this peer */
     struct peerid id;             /* peer id */
+#if ENABLE_STATS
+    struct zhe_peer_stats stats;  /* id, idlen only filled in by zhe_get_peer_stats */
+    zhe_time_t thist_decls;       /* time the session was established, for stats.hist_decls_time */
+#endif
 };
 
 #if N_OUT_MCONDUITS > 0
@@ -98,6 +116,9 @@ struct out_mconduit {
     struct out_conduit oc;        /* same transmit window management as unicast */
     zhe_minseqheap_t seqbase;     /* tracks ACKs from peers for computing oc.seqbase as min of them all */
     DECL_BITSET(members, MAX_PEERS_1); /* set of peers attached to this mconduit */
+#if KEEPALIVE_SUPPRESSION
+    zhe_time_t tlastxmit;         /* time of last packet sent to oc.addr */
+#endif
 };
 
 static struct out_mconduit out_mconduits[N_OUT_MCONDUITS];
@@ -114,6 +135,9 @@ struct zhe_platform *zhe_platform;
    necessary to have a separate address for scouting, as that we need a statically available address
    to use for the destination of the outgoing packet) */
 static zhe_address_t scoutaddr;
+#if KEEPALIVE_SUPPRESSION
+static zhe_time_t scoutaddr_tlastxmit; /* time of last packet sent to scoutaddr, reaching all peers */
+#endif
 
 #if MAX_MULTICAST_GROUPS > 0
 static uint16_t n_multicast_locators;
@@ -127,9 +151,8 @@ static zhe_msgsize_t outp;             /* current position in outbuf */
 static zhe_msgsize_t outspos;          /* OUTSPOS_UNSET or pos of last reliable SData/Declare header (OUTSPOS_UNSET <=> outc == NULL) */
 static struct out_conduit *outc;  /* conduit over which reliable messages are carried in this packet, or NULL */
 static zhe_address_t *outdst;    /* destination address: &scoutaddr, &peer.oc.addr, &out_mconduits[cid].addr */
-#if LATENCY_BUDGET != 0 && LATENCY_BUDGET != LATENCY_BUDGET_INF
 static zhe_time_t outdeadline;       /* pack until destination change, packet full, or this time passed */
-#endif
+static bool outdeadline_set;         /* whether outbuf holds a message with a finite latency budget (else no deadline) */
 
 /* In client mode, we pretend the broker is peer 0 (and the only peer at that). It isn't really a peer,
    but the data structures we need are identical, only the discovery behaviour and (perhaps) session
@@ -143,11 +166,22 @@ static xwpos_t peers_oc_rbufidx[MAX_PEERS_1][XMITW_SAMPLES_UNICAST];
 #endif
 #endif
 
+/* Every peer slot is on exactly one of three doubly-linked lists, according to its state: free
+   (UNKNOWN), opening (OPENING_MIN .. OPENING_MAX) or established. This allows the various loops
+   over peers to only visit the slots that matter, rather than all MAX_PEERS_1 of them. */
+#define PEERLIST_FREE        0
+#define PEERLIST_OPENING     1
+#define PEERLIST_ESTABLISHED 2
+static peeridx_t peerlist_head[3];
+static peeridx_t peerlist_next[MAX_PEERS_1];
+static peeridx_t peerlist_prev[MAX_PEERS_1];
+
 /* In peer mode, always send scouts periodically, with tlastscout giving the time of the last scout
    message to go out. In client mode, scouting is conditional upon the state of the broker, in that
    case scouts only go out if peers[0].state = UNKNOWN, but we then overload tlastscout to determine
    when to send a KEEPALIVE. And for that, we simply update tlastscout every time a packet goes out
-   when in client mode. */
+   when in client mode. In peer mode, the time of the last packet sent is tracked per destination,
+   and a KEEPALIVE is only sent when some peer hasn't been sent anything for SCOUT_INTERVAL. */
 #if SCOUT_COUNT > 0
 #if SCOUT_COUNT <= 255
 static uint8_t scout_count = SCOUT_COUNT;
@@ -186,6 +220,9 @@ static void oc_setup1(struct out_conduit * const oc, cid_t cid, xwpos_t xmitw_by
 #if XMITW_SAMPLE_INDEX
     oc->firstidx = 0;
     oc->rbufidx = rbufidx;
+#endif
+#if ENABLE_STATS
+    memset(&oc->stats, 0, sizeof(oc->stats));
 #endif
     oc_reset_transmit_window(oc);
 }
@@ -193,6 +230,7 @@ static void oc_setup1(struct out_conduit * const oc, cid_t cid, xwpos_t xmitw_by
 static void reset_outbuf(void)
 {
     outspos = OUTSPOS_UNSET;
+    outdeadline_set = false;
     outp = 0;
     outc = NULL;
     outdst = NULL;
@@ -203,6 +241,70 @@ bool zhe_established_peer(peeridx_t peeridx)
     return peers[peeridx].state == PEERST_ESTABLISHED;
 }
 
+static unsigned peerlist_for_state(uint8_t state)
+{
+    switch (state) {
+        case PEERST_UNKNOWN: return PEERLIST_FREE;
+        case PEERST_ESTABLISHED: return PEERLIST_ESTABLISHED;
+        default: return PEERLIST_OPENING;
+    }
+}
+
+static void peerlist_init(void)
+{
+    /* all slots free, in order of increasing index so new peers get the lowest available one */
+    peerlist_head[PEERLIST_FREE] = 0;
+    peerlist_head[PEERLIST_OPENING] = PEERIDX_INVALID;
+    peerlist_head[PEERLIST_ESTABLISHED] = PEERIDX_INVALID;
+    for (peeridx_t i = 0; i < MAX_PEERS_1; i++) {
+        peerlist_prev[i] = (i == 0) ? PEERIDX_INVALID : (peeridx_t)(i - 1);
+        peerlist_next[i] = (i == MAX_PEERS_1 - 1) ? PEERIDX_INVALID : (peeridx_t)(i + 1);
+    }
+}
+
+static void peerlist_move(peeridx_t peeridx, uint8_t oldstate, uint8_t newstate)
+{
+    const unsigned from = peerlist_for_state(oldstate);
+    const unsigned to = peerlist_for_state(newstate);
+    if (from == to) {
+        return;
+    }
+    /* unlink from old list */
+    if (peerlist_prev[peeridx] == PEERIDX_INVALID) {
+        zhe_assert(peerlist_head[from] == peeridx);
+        peerlist_head[from] = peerlist_next[peeridx];
+    } else {
+        peerlist_next[peerlist_prev[peeridx]] = peerlist_next[peeridx];
+    }
+    if (peerlist_next[peeridx] != PEERIDX_INVALID) {
+        peerlist_prev[peerlist_next[peeridx]] = peerlist_prev[peeridx];
+    }
+    /* push onto new one */
+    peerlist_prev[peeridx] = PEERIDX_INVALID;
+    peerlist_next[peeridx] = peerlist_head[to];
+    if (peerlist_head[to] != PEERIDX_INVALID) {
+        peerlist_prev[peerlist_head[to]] = peeridx;
+    }
+    peerlist_head[to] = peeridx;
+}
+
+static void set_peer_state(peeridx_t peeridx, uint8_t state)
+{
+    peerlist_move(peeridx, peers[peeridx].state, state);
+    peers[peeridx].state = state;
+}
+
+peeridx_t zhe_established_peers_first(void)
+{
+    return peerlist_head[PEERLIST_ESTABLISHED];
+}
+
+peeridx_t zhe_established_peers_next(peeridx_t peeridx)
+{
+    zhe_assert(peers[peeridx].state == PEERST_ESTABLISHED);
+    return peerlist_next[peeridx];
+}
+
 int zhe_compare_peer_ids_for_peeridx(peeridx_t a, peeridx_t b)
 {
     /* if a.id is a prefix of b.id, a precedes b */
@@ -227,6 +329,9 @@ static void reset_peer(peeridx_t peeridx, zhe_time_t tnow)
 #if ZHE_MAX_URISPACE > 0
     zhe_uristore_reset_peer(peeridx);
 #endif
+#if HAVE_QUERY
+    zhe_reset_peer_queries(peeridx);
+#endif
 #if HAVE_UNICAST_CONDUIT
     if (outdst == &p->oc.addr) {
         reset_outbuf();
@@ -255,6 +360,7 @@ static void reset_peer(peeridx_t peeridx, zhe_time_t tnow)
     if (p->state == PEERST_ESTABLISHED) {
         npeers--;
     }
+    peerlist_move(peeridx, p->state, PEERST_UNKNOWN);
 #ifndef NDEBUG
     /* State of most fields shouldn't matter if peer state is UNKNOWN, sequence numbers
        and transmit windows in conduits do matter (so we don't need to clear them upon
@@ -301,21 +407,35 @@ static void init_globals(zhe_time_t tnow)
         oc_setup1(&mc->oc, i, XMITW_BYTES, out_mconduits_oc_rbuf[i], XMITW_SAMPLES, rbufidx);
         mc->seqbase.n = 0;
         zhe_minseqheap_init(&mc->seqbase);
+#if KEEPALIVE_SUPPRESSION
+        mc->tlastxmit = tnow;
+#endif
     }
 #endif
     for (peeridx_t i = 0; i < MAX_PEERS_1; i++) {
         reset_peer(i, tnow);
     }
+    peerlist_init();
     npeers = 0;
     reset_outbuf();
-#if LATENCY_BUDGET != 0 && LATENCY_BUDGET != LATENCY_BUDGET_INF
     outdeadline = tnow;
-#endif
     tlastscout = tnow;
+#if KEEPALIVE_SUPPRESSION
+    scoutaddr_tlastxmit = tnow;
+#endif
+#if ENABLE_STATS
+    memset(&zhe_gstats, 0, sizeof(zhe_gstats));
+#endif
 #if ZHE_MAX_URISPACE > 0
     zhe_uristore_init();
 #endif
     zhe_pubsub_init();
+#if HAVE_QUERY
+    zhe_query_init();
+#endif
+#if HAVE_SUBQUEUES
+    zhe_subqueue_init();
+#endif
 }
 
 int zhe_seq_lt(seq_t a, seq_t b)
@@ -452,6 +572,73 @@ zhe_msgsize_t zhe_make_mscout(uint8_t *buf, size_t bufsz)
     return 2;
 }
 
+#if KEEPALIVE_SUPPRESSION || ENABLE_STATS
+static peeridx_t peeridx_from_outdst(const zhe_address_t *dst)
+{
+    /* unicast packets are always addressed using the address in the peer table */
+    if ((const void *)dst >= (const void *)&peers[0] && (const void *)dst < (const void *)&peers[MAX_PEERS_1]) {
+        const peeridx_t peeridx = (peeridx_t)(((const char *)dst - (const char *)peers) / sizeof(peers[0]));
+        zhe_assert(dst == &peers[peeridx].oc.addr);
+        return peeridx;
+    }
+    return PEERIDX_INVALID;
+}
+#endif
+
+#if ENABLE_STATS
+static void note_xmit_stats(const zhe_address_t *dst, zhe_msgsize_t sz, bool sent)
+{
+    if (!sent) {
+        zhe_gstats.pkts_out_dropped++;
+        return;
+    }
+    zhe_gstats.pkts_out++;
+    zhe_gstats.bytes_out += sz;
+#if N_OUT_MCONDUITS > 0
+    for (cid_t cid = 0; cid < N_OUT_MCONDUITS; cid++) {
+        if (dst == &out_mconduits[cid].oc.addr) {
+            out_mconduits[cid].oc.stats.pkts_out++;
+            out_mconduits[cid].oc.stats.bytes_out += sz;
+            return;
+        }
+    }
+#endif
+    const peeridx_t peeridx = peeridx_from_outdst(dst);
+    if (peeridx != PEERIDX_INVALID) {
+        peers[peeridx].stats.pkts_out++;
+        peers[peeridx].stats.bytes_out += sz;
+#if HAVE_UNICAST_CONDUIT
+        peers[peeridx].oc.stats.pkts_out++;
+        peers[peeridx].oc.stats.bytes_out += sz;
+#endif
+    }
+}
+#endif
+
+#if KEEPALIVE_SUPPRESSION
+static void note_xmit(const zhe_address_t *dst, zhe_time_t tnow)
+{
+    /* any packet renews the lease on the receiving side, so remember when each destination last
+       got one for the purpose of suppressing KEEPALIVEs */
+    if (dst == &scoutaddr) {
+        scoutaddr_tlastxmit = tnow;
+        return;
+    }
+#if N_OUT_MCONDUITS > 0
+    for (cid_t cid = 0; cid < N_OUT_MCONDUITS; cid++) {
+        if (dst == &out_mconduits[cid].oc.addr) {
+            out_mconduits[cid].tlastxmit = tnow;
+            return;
+        }
+    }
+#endif
+    const peeridx_t peeridx = peeridx_from_outdst(dst);
+    if (peeridx != PEERIDX_INVALID) {
+        peers[peeridx].tlastxmit = tnow;
+    }
+}
+#endif
+
 void zhe_pack_msend(zhe_time_t tnow)
 {
 #if MSYNCH_INTERVAL < 2 * ROUNDTRIP_TIME_ESTIMATE
@@ -481,10 +668,16 @@ void zhe_pack_msend(zhe_time_t tnow)
 #if MAX_PEERS == 0
             /* we didn't drop the packet for lack of space, so postpone next keepalive */
             tlastscout = tnow;
+#elif KEEPALIVE_SUPPRESSION
+            note_xmit(outdst, tnow);
 #endif
         }
+#if ENABLE_STATS
+        note_xmit_stats(outdst, outp, sendres > 0);
+#endif
         outp = 0;
         outspos = OUTSPOS_UNSET;
+        outdeadline_set = false;
         outc = NULL;
         outdst = NULL;
     }
@@ -509,17 +702,35 @@ void zhe_pack_reserve(zhe_address_t *dst, struct out_conduit *oc, zhe_paysize_t
         outc = oc;
     }
     outdst = dst;
-#if LATENCY_BUDGET != 0 && LATENCY_BUDGET != LATENCY_BUDGET_INF
-    if (outp == 0) {
-        /* packing deadline: note that no incomplete messages will ever be in the buffer when
-           we check, because it is single-threaded and we always complete whatever message we
-           start constructing */
-        outdeadline = tnow + LATENCY_BUDGET;
-        ZT(DEBUG, "deadline at %"PRIu32".%0"PRIu32, ZTIME_TO_SECu32(outdeadline), ZTIME_TO_MSECu32(outdeadline));
-    }
+}
+
+static void platform_flush(void)
+{
+#if TRANSPORT_BATCHING
+    zhe_platform_flush(zhe_platform);
 #endif
 }
 
+void zhe_pack_latency_budget(zhe_time_t budget, zhe_time_t tnow)
+{
+    /* Called once a message has been completed, the packet must go out within BUDGET, so the
+       deadline is set by the tightest message in it. Note that no incomplete messages will ever
+       be in the buffer when housekeeping checks the deadline, because it is single-threaded and
+       we always complete whatever message we start constructing */
+    if (budget == 0) {
+        zhe_pack_msend(tnow);
+        platform_flush();
+    } else if (budget != LATENCY_BUDGET_INF) {
+        const zhe_time_t deadline = tnow + budget;
+        zhe_assert(outp > 0);
+        if (!outdeadline_set || (zhe_timediff_t)(deadline - outdeadline) < 0) {
+            outdeadline = deadline;
+            outdeadline_set = true;
+            ZT(DEBUG, "deadline at %"PRIu32".%0"PRIu32, ZTIME_TO_SECu32(outdeadline), ZTIME_TO_MSECu32(outdeadline));
+        }
+    }
+}
+
 void zhe_pack1(uint8_t x)
 {
     pack_check_avail(1);
@@ -576,6 +787,12 @@ void zhe_pack_locs(void)
 
 void zhe_oc_hit_full_window(struct out_conduit *c, zhe_time_t tnow)
 {
+#if ENABLE_STATS
+    c->stats.full_window++;
+    if (!c->draining_window) {
+        c->tdrain = tnow;
+    }
+#endif
     c->draining_window = 1;
     if (outp > 0) {
         zhe_pack_msynch(outdst, MSFLAG, c->cid, c->seqbase, oc_get_nsamples(c), tnow);
@@ -588,6 +805,16 @@ int zhe_oc_am_draining_window(const struct out_conduit *c)
     return c->draining_window;
 }
 
+seq_t zhe_oc_next_seq(const struct out_conduit *c)
+{
+    return c->seq;
+}
+
+bool zhe_oc_acked_upto(const struct out_conduit *c, seq_t seq)
+{
+    return zhe_seq_le(seq, c->seqbase);
+}
+
 void zhe_oc_pack_copyrel(struct out_conduit *c, zhe_msgsize_t from)
 {
     /* only for non-empty sequence of initial bytes of message (i.e., starts with header */
@@ -652,6 +879,7 @@ void zhe_oc_pack_payload(struct out_conduit *c, int relflag, zhe_paysize_t sz, c
 
 void zhe_oc_pack_payload_done(struct out_conduit *c, int relflag, zhe_time_t tnow)
 {
+    ZSTAT(c->stats.samples_out++);
     if (!relflag) {
         c->useq += SEQNUM_UNIT;
     } else {
@@ -665,9 +893,20 @@ void zhe_oc_pack_payload_done(struct out_conduit *c, int relflag, zhe_time_t tno
         if (c->seq == c->seqbase) {
             /* first unack'd sample, schedule SYNCH */
             c->sched_synch = 1;
+            ZSTAT(c->tunacked = tnow);
         }
         /* prep for next sample */
         c->seq += SEQNUM_UNIT;
+#if ENABLE_STATS
+        const uint32_t nsamples = (uint32_t)oc_get_nsamples(c);
+        const uint32_t nbytes = (uint32_t)(c->spos - c->firstpos + (c->spos < c->firstpos ? c->xmitw_bytes : 0));
+        if (nsamples > c->stats.xmitw_samples_hwm) {
+            c->stats.xmitw_samples_hwm = nsamples;
+        }
+        if (nbytes > c->stats.xmitw_bytes_hwm) {
+            c->stats.xmitw_bytes_hwm = nbytes;
+        }
+#endif
     }
 }
 
@@ -839,6 +1078,20 @@ static zhe_unpack_result_t handle_dsub(peeridx_t peeridx, const uint8_t * const
         return res;
     }
     if (*interpret == DIM_INTERPRET) {
+#if HAVE_RSUB_FILTERS
+        struct zhe_subfilter filter;
+        bool hasfilter = false;
+        uint8_t propid;
+        zhe_paysize_t propsz;
+        const uint8_t *propdata;
+        while ((hdr & DPFLAG) && zhe_unpack_props_iter(&it, &propid, &propsz, &propdata)) {
+            if (propid == PROP_SUBFILTER) {
+                /* an invalid filter means everything must be sent */
+                hasfilter = zhe_unpack_subfilter(propsz, propdata, &filter);
+            }
+        }
+        zhe_rsub_note_filter(peeridx, rid, hasfilter ? &filter : NULL);
+#endif
         zhe_rsub_register(peeridx, rid, mode, tentative);
     }
     return ZUR_OK;
@@ -938,7 +1191,8 @@ static zhe_unpack_result_t handle_dresult(peeridx_t peeridx, const uint8_t * con
         return res;
     }
     ZT(PUBSUB, "handle_dresult %u intp %s | commitid %u status %u rid %ju", (unsigned)peeridx, decl_intp_mode_str(*interpret), commitid, status, (uintmax_t)rid);
-    if (*interpret == DIM_INTERPRET && status != 0) {
+    if (*interpret == DIM_INTERPRET) {
+        /* an OK result also needs noting: it is what allows the next batch of fresh declarations to go out */
         zhe_note_declstatus(peeridx, status, rid);
     }
     return ZUR_OK;
@@ -966,7 +1220,7 @@ static zhe_unpack_result_t handle_dfpub(peeridx_t peeridx, const uint8_t * const
     return ZUR_OK;
 }
 
-static zhe_unpack_result_t handle_dfsub(peeridx_t peeridx, const uint8_t * const end, const uint8_t **data, enum declaration_interpretation_mode *interpret)
+static zhe_unpack_result_t handle_dfsub(peeridx_t peeridx, const uint8_t * const end, const uint8_t **data, enum declaration_interpretation_mode *interpret, bool tentative)
 {
     zhe_unpack_result_t res;
     zhe_rid_t rid;
@@ -974,6 +1228,9 @@ static zhe_unpack_result_t handle_dfsub(peeridx_t peeridx, const uint8_t * const
         (res = zhe_unpack_rid(end, data, &rid)) != ZUR_OK) {
         return res;
     }
+    if (*interpret == DIM_INTERPRET) {
+        zhe_rsub_unregister(peeridx, rid, tentative);
+    }
     return ZUR_OK;
 }
 
@@ -1071,7 +1328,7 @@ static zhe_unpack_result_t handle_mhello(peeridx_t peeridx, const uint8_t * cons
                 ZT(PEERDISC, "'twas but a hello with an invalid locator list ...");
                 send_open = 0;
             } else {
-                peers[peeridx].state = PEERST_OPENING_MIN;
+                set_peer_state(peeridx, PEERST_OPENING_MIN);
                 peers[peeridx].tlease = tnow;
             }
         } else {
@@ -1100,10 +1357,7 @@ static peeridx_t find_peeridx_by_id(peeridx_t peeridx, zhe_paysize_t idlen, cons
         return peeridx;
     }
 
-    for (peeridx_t i = 0; i < MAX_PEERS_1; i++) {
-        if (peers[i].state != PEERST_ESTABLISHED) {
-            continue;
-        }
+    for (peeridx_t i = peerlist_head[PEERLIST_ESTABLISHED]; i != PEERIDX_INVALID; i = peerlist_next[i]) {
         if (peers[i].id.len == idlen && memcmp(peers[i].id.id, id, idlen) == 0) {
 #if ENABLE_TRACING
             if (ZTT(PEERDISC)) {
@@ -1154,11 +1408,18 @@ static void accept_peer(peeridx_t peeridx, zhe_paysize_t idlen, const uint8_t *
     }
 #endif
 
-    p->state = PEERST_ESTABLISHED;
+    set_peer_state(peeridx, PEERST_ESTABLISHED);
     p->id.len = idlen;
     memcpy(p->id.id, id, idlen);
     p->lease_dur = lease_dur;
     p->tlease = tnow + (zhe_time_t)p->lease_dur;
+#if KEEPALIVE_SUPPRESSION
+    p->tlastxmit = tnow;
+#endif
+#if ENABLE_STATS
+    memset(&p->stats, 0, sizeof(p->stats));
+    p->thist_decls = tnow;
+#endif
 #if N_OUT_MCONDUITS > 0
     for (cid_t cid = 0; cid < N_OUT_MCONDUITS; cid++) {
         struct out_mconduit * const mc = &out_mconduits[cid];
@@ -1276,6 +1537,7 @@ static zhe_unpack_result_t handle_mopen(peeridx_t * restrict peeridx, const uint
 
 reject:
     zhe_pack_mclose(&peers[*peeridx].oc.addr, reason, &ownid, tnow);
+    zhe_pack_msend(tnow);
     /* don't want anything to do with the other anymore; calling reset on one that is already in UNKNOWN is harmless */
     reset_peer(*peeridx, tnow);
     /* no point in interpreting following messages in packet */
@@ -1327,6 +1589,7 @@ static zhe_unpack_result_t handle_maccept(peeridx_t * restrict peeridx, const ui
 
 reject:
     zhe_pack_mclose(&peers[*peeridx].oc.addr, CLR_ERROR, &ownid, tnow);
+    zhe_pack_msend(tnow);
     /* don't want anything to do with the other anymore; calling reset on one that is already in UNKNOWN is harmless */
     reset_peer(*peeridx, tnow);
     /* no point in interpreting following messages in packet */
@@ -1401,6 +1664,13 @@ static void acknack_if_needed(peeridx_t peeridx, cid_t cid, int wantsack, zhe_ti
         zhe_pack_macknack(&peers[peeridx].oc.addr, cid, peers[peeridx].ic[cid].seq, mask, tnow);
         zhe_pack_msend(tnow);
         peers[peeridx].ic[cid].tack = tnow;
+#if ENABLE_STATS
+        if (mask == 0) {
+            peers[peeridx].stats.acks_out++;
+        } else {
+            peers[peeridx].stats.nacks_out++;
+        }
+#endif
     }
 }
 
@@ -1424,6 +1694,9 @@ static zhe_unpack_result_t handle_mdeclare(peeridx_t peeridx, const uint8_t * co
         (res = zhe_unpack_vle16(end, data, &ndecls)) != ZUR_OK) {
         return res;
     }
+#if ENABLE_STATS
+    const uint16_t ndecls_in = ndecls;
+#endif
     if (!(peers[peeridx].state == PEERST_ESTABLISHED && peers[peeridx].ic[cid].synched)) {
         intp = DIM_IGNORE;
     } else {
@@ -1444,7 +1717,7 @@ static zhe_unpack_result_t handle_mdeclare(peeridx_t peeridx, const uint8_t * co
             case DRESULT:     res = handle_dresult(peeridx, end, data, &intp); break;
             case DFRESOURCE:  res = handle_dfresource(peeridx, end, data, &intp); break;
             case DFPUB:       res = handle_dfpub(peeridx, end, data, &intp); break;
-            case DFSUB:       res = handle_dfsub(peeridx, end, data, &intp); break;
+            case DFSUB:       res = handle_dfsub(peeridx, end, data, &intp, !(hdr & MCFLAG)); break;
             case DFSELECTION: res = handle_dfselection(peeridx, end, data, &intp); break;
             default:          res = ZUR_OVERFLOW; break;
         }
@@ -1473,6 +1746,8 @@ static zhe_unpack_result_t handle_mdeclare(peeridx_t peeridx, const uint8_t * co
                uncommitted state accumulator, as we have now completely and successfully processed
                this message.  */
             ZT(PUBSUB, "handle_mdeclare %u .. packet done", peeridx);
+            ZSTAT(zhe_gstats.decls_in += ndecls_in);
+            ZSTAT(peers[peeridx].stats.decls_in += ndecls_in);
             zhe_rsub_precommit_curpkt_done(peeridx);
             (void)ic_update_seq(&peers[peeridx].ic[cid], MRFLAG, seq);
             /* If C flag set, commit, closing the connection if an error is encountered */
@@ -1530,6 +1805,78 @@ static zhe_unpack_result_t handle_msynch(peeridx_t peeridx, const uint8_t * cons
 
 unsigned zhe_delivered, zhe_discarded;
 
+#if ENABLE_STATS
+struct zhe_stats zhe_gstats;
+#endif
+
+#if SUBBATCH_MAX > 1
+/* Consecutive SDATA messages in a packet for the same resource, with consecutive sequence numbers,
+   are delivered together; NEXT[i] is the position following message i and SFLAG[i] the S flag of
+   messages 0 .. i combined */
+static struct {
+    struct zhe_sample samples[SUBBATCH_MAX];
+    const uint8_t *next[SUBBATCH_MAX];
+    uint8_t sflag[SUBBATCH_MAX];
+} msdata_batch;
+
+static unsigned collect_msdata_batch(const uint8_t * const end, uint8_t hdr, seq_t seq, zhe_rid_t prid)
+{
+    const uint8_t *data = msdata_batch.next[0];
+    unsigned n = 1;
+    while (n < SUBBATCH_MAX && data < end && (*data & (MKIND | MRFLAG)) == (MSDATA | (hdr & MRFLAG))) {
+        uint8_t hdr1;
+        seq_t seq1;
+        zhe_rid_t rid1, prid1;
+        zhe_paysize_t paysz1;
+        const uint8_t *pay1;
+        /* anything out of the ordinary ends the batch and is left to handle_packet */
+        if (zhe_unpack_byte(end, &data, &hdr1) != ZUR_OK ||
+            zhe_unpack_seq(end, &data, &seq1) != ZUR_OK || seq1 != (seq_t)(seq + n * SEQNUM_UNIT) ||
+            zhe_unpack_rid(end, &data, &rid1) != ZUR_OK) {
+            break;
+        }
+        if (!(hdr1 & MAFLAG)) {
+            prid1 = rid1;
+        } else if (zhe_unpack_rid(end, &data, &prid1) != ZUR_OK) {
+            break;
+        }
+        if (prid1 != prid || zhe_unpack_vecref(end, &data, &paysz1, &pay1) != ZUR_OK) {
+            break;
+        }
+        msdata_batch.samples[n].payload = pay1;
+        msdata_batch.samples[n].size = paysz1;
+        msdata_batch.next[n] = data;
+        msdata_batch.sflag[n] = (uint8_t)(msdata_batch.sflag[n-1] | (hdr1 & MSFLAG));
+        n++;
+    }
+    return n;
+}
+#endif
+
+/* Delivers the SDATA message just unpacked and, if possible, the ones directly following it in
+   the packet, updating *DATA to point past the last one delivered and *SFLAG to the combined S
+   flags; returns the number of messages delivered */
+static unsigned deliver_msdata(const uint8_t * const end, const uint8_t **data, uint8_t *sflag, uint8_t hdr, seq_t seq, zhe_rid_t prid, zhe_paysize_t paysz, const uint8_t *pay)
+{
+#if SUBBATCH_MAX > 1
+    msdata_batch.samples[0].payload = pay;
+    msdata_batch.samples[0].size = paysz;
+    msdata_batch.next[0] = *data;
+    msdata_batch.sflag[0] = (uint8_t)(hdr & MSFLAG);
+    const unsigned n = collect_msdata_batch(end, hdr, seq, prid);
+    const unsigned m = zhe_handle_msdata_deliver(prid, n, msdata_batch.samples);
+    if (m > 0) {
+        *data = msdata_batch.next[m-1];
+        *sflag = msdata_batch.sflag[m-1];
+    }
+    return m;
+#else
+    const struct zhe_sample sample = { .payload = pay, .size = paysz };
+    (void)end; (void)data; (void)hdr; (void)seq;
+    return zhe_handle_msdata_deliver(prid, 1, &sample);
+#endif
+}
+
 static zhe_unpack_result_t handle_msdata(peeridx_t peeridx, const uint8_t * const end, const uint8_t **data, cid_t cid, zhe_time_t tnow)
 {
     zhe_unpack_result_t res;
@@ -1557,10 +1904,19 @@ static zhe_unpack_result_t handle_msdata(peeridx_t peeridx, const uint8_t * cons
         return ZUR_OK;
     }
 
+    uint8_t sflag = (uint8_t)(hdr & MSFLAG);
     if (!(hdr & MRFLAG)) {
         if (ic_may_deliver_seq(&peers[peeridx].ic[cid], hdr, seq)) {
-            (void)zhe_handle_msdata_deliver(prid, paysz, pay);
+            /* unreliable data is dropped rather than retried, so it counts as delivered regardless */
+            unsigned n = deliver_msdata(end, data, &sflag, hdr, seq, prid, paysz, pay);
+            if (n == 0) {
+                n = 1;
+            }
+            /* a batch has consecutive sequence numbers, but only the first one was checked against
+               useq: the last one may be half the sequence number space beyond it and therefore not
+               deliverable in the eyes of ic_update_seq, so advance useq past the batch directly */
             ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
+            peers[peeridx].ic[cid].useq = (seq_t)(seq + n * SEQNUM_UNIT);
         }
     } else if (peers[peeridx].ic[cid].synched) {
         /* Only move lseqpU forward based on the received sequence number if the seq is greater than the next-to-be-delivered and greater than the latest known, or else we can end up with ic[cid].lseqpU < ic[cid].seq */
@@ -1569,16 +1925,25 @@ static zhe_unpack_result_t handle_msdata(peeridx_t peeridx, const uint8_t * cons
         }
         if (ic_may_deliver_seq(&peers[peeridx].ic[cid], hdr, seq)) {
             ZT(RELIABLE, "handle_msdata peeridx %u cid %d seq %"PRIuSEQ" deliver", peeridx, cid, (seq_t)(seq >> SEQNUM_SHIFT));
-            if (zhe_handle_msdata_deliver(prid, paysz, pay)) {
-                /* if failed to deliver, we must retry, which necessitates a retransmit and not updating the conduit state */
-                ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
+            const unsigned n = deliver_msdata(end, data, &sflag, hdr, seq, prid, paysz, pay);
+            /* if failed to deliver, we must retry, which necessitates a retransmit and not updating the conduit state */
+            if (n > 1) {
+                ZT(RELIABLE, "handle_msdata peeridx %u cid %d seq %"PRIuSEQ" delivered batch of %u", peeridx, cid, (seq_t)(seq >> SEQNUM_SHIFT), n);
+                if (zhe_seq_lt(peers[peeridx].ic[cid].lseqpU, (seq_t)(seq + n * SEQNUM_UNIT))) {
+                    peers[peeridx].ic[cid].lseqpU = (seq_t)(seq + n * SEQNUM_UNIT);
+                }
             }
-            zhe_delivered++;
+            for (unsigned i = 0; i < n; i++) {
+                ic_update_seq(&peers[peeridx].ic[cid], hdr, (seq_t)(seq + i * SEQNUM_UNIT));
+            }
+            zhe_delivered += (n > 0) ? n : 1;
+            ZSTAT(peers[peeridx].stats.delivered += (n > 0) ? n : 1);
         } else {
             ZT(RELIABLE, "handle_msdata peeridx %u cid %d seq %"PRIuSEQ" != %"PRIuSEQ, peeridx, cid, (seq_t)(seq >> SEQNUM_SHIFT), (seq_t)(peers[peeridx].ic[cid].seq >> SEQNUM_SHIFT));
             zhe_discarded++;
+            ZSTAT(peers[peeridx].stats.discarded++);
         }
-        acknack_if_needed(peeridx, cid, hdr & MSFLAG, tnow);
+        acknack_if_needed(peeridx, cid, sflag, tnow);
     }
 
     return ZUR_OK;
@@ -1634,9 +1999,11 @@ static zhe_unpack_result_t handle_mwdata(peeridx_t peeridx, const uint8_t * cons
             ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
 #endif
             zhe_delivered++;
+            ZSTAT(peers[peeridx].stats.delivered++);
         } else {
             ZT(RELIABLE, "handle_mwdata peeridx %u cid %d seq %"PRIuSEQ" != %"PRIuSEQ, peeridx, cid, (seq_t)(seq >> SEQNUM_SHIFT), (seq_t)(peers[peeridx].ic[cid].seq >> SEQNUM_SHIFT));
             zhe_discarded++;
+            ZSTAT(peers[peeridx].stats.discarded++);
         }
         acknack_if_needed(peeridx, cid, hdr & MSFLAG, tnow);
     }
@@ -1648,6 +2015,99 @@ err_invalid_uri:
 #endif
 }
 
+/* Queries and replies are only ever sent reliably: the sender relies on it for knowing when all
+   peers have answered and a peer that can't queue a query yet simply has it retransmitted */
+static zhe_unpack_result_t handle_mquery(peeridx_t peeridx, const uint8_t * const end, const uint8_t **data, cid_t cid, zhe_time_t tnow)
+{
+    zhe_unpack_result_t res;
+    uint8_t hdr;
+    seq_t seq;
+    uint16_t qid;
+    zhe_paysize_t urisz;
+    const uint8_t *uri;
+    if ((res = zhe_unpack_byte(end, data, &hdr)) != ZUR_OK ||
+        (res = zhe_unpack_seq(end, data, &seq)) != ZUR_OK ||
+        (res = zhe_unpack_vle16(end, data, &qid)) != ZUR_OK ||
+        (res = zhe_unpack_vecref(end, data, &urisz, &uri)) != ZUR_OK) {
+        return res;
+    }
+    if (peers[peeridx].state != PEERST_ESTABLISHED || !(hdr & MRFLAG)) {
+        return ZUR_OK;
+    }
+    if (peers[peeridx].ic[cid].synched) {
+        if (zhe_seq_le(peers[peeridx].ic[cid].seq, seq + SEQNUM_UNIT) && zhe_seq_lt(peers[peeridx].ic[cid].lseqpU, seq + SEQNUM_UNIT)) {
+            peers[peeridx].ic[cid].lseqpU = seq + SEQNUM_UNIT;
+        }
+        if (ic_may_deliver_seq(&peers[peeridx].ic[cid], hdr, seq)) {
+#if HAVE_QUERY
+            /* without a free slot the query is retransmitted and only counts as delivered once
+               it has been accepted */
+            if (zhe_handle_mquery_deliver(peeridx, &peers[peeridx].id, qid, urisz, uri)) {
+                ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
+                zhe_delivered++;
+                ZSTAT(peers[peeridx].stats.delivered++);
+            }
+#else
+            /* not answering means the querier has to wait for its timeout */
+            ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
+            zhe_delivered++;
+            ZSTAT(peers[peeridx].stats.delivered++);
+#endif
+        } else {
+            zhe_discarded++;
+            ZSTAT(peers[peeridx].stats.discarded++);
+        }
+        acknack_if_needed(peeridx, cid, hdr & MSFLAG, tnow);
+    }
+    return ZUR_OK;
+}
+
+static zhe_unpack_result_t handle_mreply(peeridx_t peeridx, const uint8_t * const end, const uint8_t **data, cid_t cid, zhe_time_t tnow)
+{
+    zhe_unpack_result_t res;
+    uint8_t hdr;
+    seq_t seq;
+    zhe_paysize_t qpidsz, paysz = 0;
+    const uint8_t *qpid, *pay = NULL;
+    uint16_t qid;
+    zhe_rid_t rid = 0;
+    if ((res = zhe_unpack_byte(end, data, &hdr)) != ZUR_OK ||
+        (res = zhe_unpack_seq(end, data, &seq)) != ZUR_OK ||
+        (res = zhe_unpack_vecref(end, data, &qpidsz, &qpid)) != ZUR_OK ||
+        (res = zhe_unpack_vle16(end, data, &qid)) != ZUR_OK) {
+        return res;
+    }
+    if (!(hdr & MFFLAG) &&
+        ((res = zhe_unpack_rid(end, data, &rid)) != ZUR_OK ||
+         (res = zhe_unpack_vecref(end, data, &paysz, &pay)) != ZUR_OK)) {
+        return res;
+    }
+    if (peers[peeridx].state != PEERST_ESTABLISHED || !(hdr & MRFLAG)) {
+        return ZUR_OK;
+    }
+    if (peers[peeridx].ic[cid].synched) {
+        if (zhe_seq_le(peers[peeridx].ic[cid].seq, seq + SEQNUM_UNIT) && zhe_seq_lt(peers[peeridx].ic[cid].lseqpU, seq + SEQNUM_UNIT)) {
+            peers[peeridx].ic[cid].lseqpU = seq + SEQNUM_UNIT;
+        }
+        if (ic_may_deliver_seq(&peers[peeridx].ic[cid], hdr, seq)) {
+#if HAVE_QUERY
+            /* without a unicast conduit, replies to other peers' queries arrive here, too */
+            if (qpidsz == ownid.len && memcmp(qpid, ownid.id, qpidsz) == 0) {
+                zhe_handle_mreply_deliver(peeridx, qid, (hdr & MFFLAG) != 0, rid, paysz, pay);
+            }
+#endif
+            ic_update_seq(&peers[peeridx].ic[cid], hdr, seq);
+            zhe_delivered++;
+            ZSTAT(peers[peeridx].stats.delivered++);
+        } else {
+            zhe_discarded++;
+            ZSTAT(peers[peeridx].stats.discarded++);
+        }
+        acknack_if_needed(peeridx, cid, hdr & MSFLAG, tnow);
+    }
+    return ZUR_OK;
+}
+
 #if ! XMITW_SAMPLE_INDEX
 static xwpos_t xmitw_skip_to_seq(const struct out_conduit *c, xwpos_t p, seq_t s, seq_t end)
 {
@@ -1750,8 +2210,32 @@ static zhe_unpack_result_t handle_macknack(peeridx_t peeridx, const uint8_t * co
     const seq_t seq_ack = zhe_minseqheap_raisekey(&out_mconduits[cid].seqbase, peeridx, seq, c->seqbase);
 #else
     const seq_t seq_ack = (cid == UNICAST_CID) ? seq : zhe_minseqheap_raisekey(&out_mconduits[cid].seqbase, peeridx, seq, c->seqbase);
+#endif
+#if ENABLE_STATS
+    const seq_t old_seqbase = c->seqbase;
+    const bool was_draining = c->draining_window;
 #endif
     remove_acked_messages(c, seq_ack);
+#if ENABLE_STATS
+    if (mask == 0) {
+        peers[peeridx].stats.acks_in++;
+    } else {
+        peers[peeridx].stats.nacks_in++;
+        c->stats.nacks_in++;
+    }
+    if (c->seqbase != old_seqbase) {
+        const zhe_time_t lat = tnow - c->tunacked;
+        if (lat > c->stats.ack_latency_max) {
+            c->stats.ack_latency_max = lat;
+        }
+        c->stats.ack_latency_sum += lat;
+        c->stats.ack_latency_count++;
+        c->tunacked = tnow;
+    }
+    if (was_draining && !c->draining_window) {
+        c->stats.draining_time += tnow - c->tdrain;
+    }
+#endif
 
     if (mask == 0) {
         /* Pure ACK - no need to do anything else */
@@ -1795,6 +2279,7 @@ static zhe_unpack_result_t handle_macknack(peeridx_t peeridx, const uint8_t * co
                    for the purpose of setting the S flag and scheduling SYNCH messages.  Retransmits
                    are require none of that beyond what we do here locally anyway. */
                 ZT(RELIABLE, "handle_macknack   rx %"PRIuSEQ"", (seq_t)(seq >> SEQNUM_SHIFT));
+                ZSTAT(c->stats.rexmits++);
                 sz = xmitw_load_msgsize(c, p);
                 p = xmitw_pos_add(c, p, sizeof(zhe_msgsize_t));
                 zhe_pack_reserve_mconduit(&c->addr, cid, false, sz, tnow);
@@ -1896,6 +2381,8 @@ static zhe_unpack_result_t handle_packet(peeridx_t * restrict peeridx, const uin
             case MDECLARE:   res = handle_mdeclare(*peeridx, end, &data1, cid, tnow); break;
             case MSDATA:     res = handle_msdata(*peeridx, end, &data1, cid, tnow); break;
             case MWDATA:     res = handle_mwdata(*peeridx, end, &data1, cid, tnow); break;
+            case MQUERY:     res = handle_mquery(*peeridx, end, &data1, cid, tnow); break;
+            case MREPLY:     res = handle_mreply(*peeridx, end, &data1, cid, tnow); break;
             case MPING:      res = handle_mping(*peeridx, end, &data1, tnow); break;
             case MPONG:      res = handle_mpong(*peeridx, end, &data1); break;
             case MSYNCH:     res = handle_msynch(*peeridx, end, &data1, cid, tnow); break;
@@ -1914,6 +2401,7 @@ static zhe_unpack_result_t handle_packet(peeridx_t * restrict peeridx, const uin
 int zhe_init(const struct zhe_config *config, struct zhe_platform *pf, zhe_time_t tnow)
 {
     /* Is there a way to make the transport pluggable at run-time without dynamic allocation? I don't think so, not with the MTU so important ... */
+    ZT_SETTIME(tnow);
     if (config->idlen == 0 || config->idlen > PEERID_SIZE) {
         return -1;
     }
@@ -1924,6 +2412,15 @@ int zhe_init(const struct zhe_config *config, struct zhe_platform *pf, zhe_time_
         /* but you don't have to join MAX groups */
         return -1;
     }
+#if HAVE_MCPARTITIONS
+    if (!zhe_mcpartitions_init(config->n_mcpartitions, config->mcpartitions)) {
+        return -1;
+    }
+#else
+    if (config->n_mcpartitions > 0) {
+        return -1;
+    }
+#endif
 
     ownid_union.v_nonconst.len = (zhe_paysize_t)config->idlen;
     memcpy(ownid_union.v_nonconst.id, config->id, config->idlen);
@@ -1965,13 +2462,18 @@ int zhe_input(const void * restrict buf, size_t sz, const struct zhe_address *sr
 #if ENABLE_TRACING
     char addrstr[TRANSPORT_ADDRSTRLEN];
 #endif
-    peeridx_t peeridx, free_peeridx = PEERIDX_INVALID;
+    peeridx_t peeridx = PEERIDX_INVALID;
+    const peeridx_t free_peeridx = peerlist_head[PEERLIST_FREE];
+    ZT_SETTIME(tnow);
 
-    for (peeridx = 0; peeridx < MAX_PEERS_1; peeridx++) {
-        if (zhe_platform_addr_eq(src, &peers[peeridx].oc.addr)) {
-            break;
-        } else if (peers[peeridx].state == PEERST_UNKNOWN && free_peeridx == PEERIDX_INVALID) {
-            free_peeridx = peeridx;
+    /* Only peers in the process of opening or established can have an address associated with them;
+       a message from any other address gets the first free slot */
+    for (unsigned l = PEERLIST_OPENING; l <= PEERLIST_ESTABLISHED && peeridx == PEERIDX_INVALID; l++) {
+        for (peeridx_t i = peerlist_head[l]; i != PEERIDX_INVALID; i = peerlist_next[i]) {
+            if (zhe_platform_addr_eq(src, &peers[i].oc.addr)) {
+                peeridx = i;
+                break;
+            }
         }
     }
 
@@ -1981,13 +2483,13 @@ int zhe_input(const void * restrict buf, size_t sz, const struct zhe_address *sr
     }
 #endif
 
-    if (peeridx == MAX_PEERS_1 && free_peeridx != PEERIDX_INVALID) {
+    if (peeridx == PEERIDX_INVALID && free_peeridx != PEERIDX_INVALID) {
         ZT(DEBUG, "possible new peer %s @ %u", addrstr, free_peeridx);
         peeridx = free_peeridx;
         peers[peeridx].oc.addr = *src;
     }
 
-    if (peeridx < MAX_PEERS_1) {
+    if (peeridx != PEERIDX_INVALID) {
         zhe_unpack_result_t res;
         const uint8_t *bufp = buf;
         ZT(DEBUG, "handle message from %s @ %u", addrstr, peeridx);
@@ -1995,6 +2497,14 @@ int zhe_input(const void * restrict buf, size_t sz, const struct zhe_address *sr
             peers[peeridx].tlease = tnow;
         }
         res = handle_packet(&peeridx, (const uint8_t *)buf + sz, &bufp, tnow);
+#if ENABLE_STATS
+        zhe_gstats.pkts_in++;
+        zhe_gstats.bytes_in += (uint32_t)(bufp - (const uint8_t *)buf);
+        if (peers[peeridx].state == PEERST_ESTABLISHED) {
+            peers[peeridx].stats.pkts_in++;
+            peers[peeridx].stats.bytes_in += (uint32_t)(bufp - (const uint8_t *)buf);
+        }
+#endif
         switch (res)
         {
             case ZUR_OK:
@@ -2009,6 +2519,7 @@ int zhe_input(const void * restrict buf, size_t sz, const struct zhe_address *sr
                 reset_peer(peeridx, tnow);
                 break;
         }
+        platform_flush();
         return (int)(bufp - (const uint8_t *)buf);
     } else {
         ZT(DEBUG, "message from %s dropped: no available peeridx", addrstr);
@@ -2040,6 +2551,46 @@ static void send_scout(zhe_time_t tnow)
     zhe_pack_msend(tnow);
 }
 #else /* SCOUT_COUNT > 0 && MAX_PEERS > 0 */
+#if KEEPALIVE_SUPPRESSION
+static zhe_time_t peer_tlastxmit(peeridx_t peeridx)
+{
+    /* most recent packet that will have reached the peer: unicast, to the scouting address or
+       over any multicast conduit the peer is a member of */
+    zhe_time_t t = peers[peeridx].tlastxmit;
+    if ((zhe_timediff_t)(scoutaddr_tlastxmit - t) > 0) {
+        t = scoutaddr_tlastxmit;
+    }
+#if N_OUT_MCONDUITS > 0
+    for (cid_t cid = 0; cid < N_OUT_MCONDUITS; cid++) {
+        const struct out_mconduit * const mc = &out_mconduits[cid];
+        if (zhe_bitset_test(mc->members, (unsigned)peeridx) && (zhe_timediff_t)(mc->tlastxmit - t) > 0) {
+            t = mc->tlastxmit;
+        }
+    }
+#endif
+    return t;
+}
+
+static bool keepalive_needed(zhe_time_t tnow)
+{
+    /* A KEEPALIVE is only needed if some peer hasn't been sent anything in the last SCOUT_INTERVAL;
+       if none qualifies, the next check is moved forward to SCOUT_INTERVAL after the oldest
+       transmission, so the maximum silence towards any peer is the same as without suppression */
+    zhe_time_t oldest = tnow;
+    for (peeridx_t i = zhe_established_peers_first(); i != PEERIDX_INVALID; i = zhe_established_peers_next(i)) {
+        const zhe_time_t t = peer_tlastxmit(i);
+        if ((zhe_timediff_t)(tnow - t) >= SCOUT_INTERVAL) {
+            return true;
+        } else if ((zhe_timediff_t)(oldest - t) > 0) {
+            oldest = t;
+        }
+    }
+    ZT(DEBUG, "suppressing keepalive");
+    tlastscout = oldest;
+    return false;
+}
+#endif /* KEEPALIVE_SUPPRESSION */
+
 static void send_scout(zhe_time_t tnow)
 {
     if (scout_count > 0) {
@@ -2047,7 +2598,7 @@ static void send_scout(zhe_time_t tnow)
         zhe_pack_mscout(&scoutaddr, tnow);
     }
 #if LEASE_DURATION > 0
-    if (npeers > 0 && (scout_count == 0 || zhe_platform_needs_keepalive(zhe_platform))) {
+    if (npeers > 0 && (zhe_platform_needs_keepalive(zhe_platform) || (scout_count == 0 && keepalive_needed(tnow)))) {
         zhe_pack_mkeepalive(&scoutaddr, &ownid, tnow);
     }
 #endif /* LEASE_DURATION */
@@ -2069,44 +2620,50 @@ void zhe_flush(zhe_time_t tnow)
     if (outp > 0) {
         zhe_pack_msend(tnow);
     }
+    platform_flush();
+}
+
+void zhe_compact(void)
+{
+#if ZHE_MAX_URISPACE > 0
+    zhe_uristore_compact();
+#endif
 }
 
 void zhe_housekeeping(zhe_time_t tnow)
 {
+    ZT_SETTIME(tnow);
     zhe_platform_housekeeping(zhe_platform, tnow);
 
-    /* FIXME: obviously, this is a waste of CPU time if MAX_PEERS is biggish (but worst-case cost isn't affected) */
-    for (peeridx_t i = 0; i < MAX_PEERS_1; i++) {
-        switch(peers[i].state) {
-            case PEERST_UNKNOWN:
-                break;
-            case PEERST_ESTABLISHED:
-                if ((zhe_timediff_t)(tnow - peers[i].tlease) > peers[i].lease_dur && peers[i].lease_dur != 0) {
-                    ZT(PEERDISC, "lease expired on peer @ %u", i);
-                    zhe_pack_mclose(&peers[i].oc.addr, 0, &ownid, tnow);
-                    zhe_pack_msend(tnow);
-                    reset_peer(i, tnow);
-                }
+    /* reset_peer moves the peer to the free list, so the successor must be fetched before handling it */
+    for (peeridx_t i = peerlist_head[PEERLIST_ESTABLISHED], inext; i != PEERIDX_INVALID; i = inext) {
+        inext = peerlist_next[i];
+        zhe_assert(peers[i].state == PEERST_ESTABLISHED);
+        if ((zhe_timediff_t)(tnow - peers[i].tlease) > peers[i].lease_dur && peers[i].lease_dur != 0) {
+            ZT(PEERDISC, "lease expired on peer @ %u", i);
+            zhe_pack_mclose(&peers[i].oc.addr, 0, &ownid, tnow);
+            zhe_pack_msend(tnow);
+            reset_peer(i, tnow);
+        }
 #if HAVE_UNICAST_CONDUIT
-                maybe_send_msync_oc(&peers[i].oc, tnow);
+        maybe_send_msync_oc(&peers[i].oc, tnow);
 #endif
-                break;
-            default:
-                zhe_assert(peers[i].state >= PEERST_OPENING_MIN && peers[i].state <= PEERST_OPENING_MAX);
-                if ((zhe_timediff_t)(tnow - peers[i].tlease) > OPEN_INTERVAL) {
-                    if (peers[i].state == PEERST_OPENING_MAX) {
-                        /* maximum number of attempts reached, forget it */
-                        ZT(PEERDISC, "giving up on attempting to establish a session with peer @ %u", i);
-                        reset_peer(i, tnow);
-                    } else {
-                        ZT(PEERDISC, "retry opening a session with peer @ %u", i);
-                        peers[i].state++;
-                        peers[i].tlease = tnow;
-                        zhe_pack_mopen(&peers[i].oc.addr, SEQNUM_LEN, &ownid, LEASE_DURATION, tnow);
-                        zhe_pack_msend(tnow);
-                    }
-                }
-                break;
+    }
+    for (peeridx_t i = peerlist_head[PEERLIST_OPENING], inext; i != PEERIDX_INVALID; i = inext) {
+        inext = peerlist_next[i];
+        zhe_assert(peers[i].state >= PEERST_OPENING_MIN && peers[i].state <= PEERST_OPENING_MAX);
+        if ((zhe_timediff_t)(tnow - peers[i].tlease) > OPEN_INTERVAL) {
+            if (peers[i].state == PEERST_OPENING_MAX) {
+                /* maximum number of attempts reached, forget it */
+                ZT(PEERDISC, "giving up on attempting to establish a session with peer @ %u", i);
+                reset_peer(i, tnow);
+            } else {
+                ZT(PEERDISC, "retry opening a session with peer @ %u", i);
+                peers[i].state++;
+                peers[i].tlease = tnow;
+                zhe_pack_mopen(&peers[i].oc.addr, SEQNUM_LEN, &ownid, LEASE_DURATION, tnow);
+                zhe_pack_msend(tnow);
+            }
         }
     }
 
@@ -2118,18 +2675,85 @@ void zhe_housekeeping(zhe_time_t tnow)
 #endif
 
     zhe_send_declares(tnow);
+#if HAVE_TRANSIENT_CACHE
+    zhe_lvc_push(tnow);
+#endif
+#if HAVE_QUERY
+    zhe_query_housekeeping(tnow);
+#endif
     if ((zhe_timediff_t)(tnow - tlastscout) >= SCOUT_INTERVAL) {
         tlastscout = tnow;
         send_scout(tnow);
     }
 #if ZHE_MAX_URISPACE > 0
-    zhe_uristore_gc();
+    zhe_uristore_gc(tnow);
 #endif
 
     /* Flush any pending output if the latency budget has been exceeded */
-#if LATENCY_BUDGET != 0 && LATENCY_BUDGET != LATENCY_BUDGET_INF
-    if (outp > 0 && (zhe_timediff_t)(tnow - outdeadline) >= 0) {
+    if (outp > 0 && outdeadline_set && (zhe_timediff_t)(tnow - outdeadline) >= 0) {
         zhe_pack_msend(tnow);
     }
+    platform_flush();
+}
+
+#if ENABLE_STATS
+void zhe_get_stats(struct zhe_stats *st)
+{
+    *st = zhe_gstats;
+    st->delivered = zhe_delivered;
+    st->discarded = zhe_discarded;
+    st->synchs_out = zhe_synch_sent;
+}
+
+void zhe_note_hist_decls_done(peeridx_t peeridx, zhe_time_t tnow)
+{
+    if (!peers[peeridx].stats.hist_decls_done) {
+        peers[peeridx].stats.hist_decls_done = 1;
+        peers[peeridx].stats.hist_decls_time = tnow - peers[peeridx].thist_decls;
+    }
+}
+
+int zhe_get_uristore_stats(struct zhe_uristore_stats *st)
+{
+#if ZHE_MAX_URISPACE > 0
+    zhe_uristore_get_stats(st);
+    return 1;
+#else
+    return 0;
 #endif
 }
+
+int zhe_get_peer_stats(unsigned peeridx, struct zhe_peer_stats *st)
+{
+    if (peeridx >= MAX_PEERS_1 || peers[peeridx].state != PEERST_ESTABLISHED) {
+        return 0;
+    }
+    *st = peers[peeridx].stats;
+    st->idlen = peers[peeridx].id.len;
+    memcpy(st->id, peers[peeridx].id.id, peers[peeridx].id.len);
+    return 1;
+}
+
+int zhe_get_conduit_stats(int cid, struct zhe_conduit_stats *st)
+{
+#if N_OUT_MCONDUITS == 0
+    if (cid != -1 && cid != 0) {
+        return 0;
+    }
+    *st = peers[0].oc.stats;
+    return 1;
+#else
+    if (cid >= 0 && cid < N_OUT_MCONDUITS) {
+        *st = out_mconduits[cid].oc.stats;
+        return 1;
+    }
+#if HAVE_UNICAST_CONDUIT
+    if (cid < 0 && cid >= -MAX_PEERS_1 && peers[-cid-1].state == PEERST_ESTABLISHED) {
+        *st = peers[-cid-1].oc.stats;
+        return 1;
+    }
+#endif
+    return 0;
+#endif
+}
+#endif
@@ -32,9 +32,25 @@ typedef struct { zhe_subidx_inner_t idx; } zhe_subidx_t;
 
 typedef void (*zhe_subhandler_t)(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg);
 
+/* A sample passed to a batch handler, the payload points into the received packet */
+struct zhe_sample {
+    const void *payload;
+    zhe_paysize_t size;
+};
+typedef void (*zhe_subbatchhandler_t)(zhe_rid_t rid, unsigned n, const struct zhe_sample *samples, void *arg);
+
 struct zhe_address;
 struct zhe_platform;
 
+/* Publications for a resource with a URI starting with URIPREFIX (if not NULL, the string must
+   remain valid), or else with an id in [RIDMIN,RIDMAX], go out over multicast conduit CID; the
+   first matching entry applies */
+struct zhe_mcpartition {
+    const char *uriprefix;
+    zhe_rid_t ridmin, ridmax;
+    unsigned cid;
+};
+
 struct zhe_config {
     size_t idlen;
     const void *id;
@@ -46,6 +62,9 @@ struct zhe_config {
 
     size_t n_mconduit_dstaddrs;
     struct zhe_address *mconduit_dstaddrs;
+
+    size_t n_mcpartitions;
+    const struct zhe_mcpartition *mcpartitions;
 };
 
 /* numerical values also appear on the wire (with the exception of PENDING, which is disallowed on the wire but rather generated locally) */
@@ -67,16 +86,85 @@ void zhe_start(zhe_time_t tnow);
 void zhe_housekeeping(zhe_time_t tnow);
 int zhe_input(const void *buf, size_t sz, const struct zhe_address *src, zhe_time_t tnow);
 void zhe_flush(zhe_time_t tnow);
+/* Collects all garbage in the URI store at once, housekeeping otherwise does it incrementally; a
+   no-op if URIs are not supported. Must not be called from a handler. */
+void zhe_compact(void);
 
 bool zhe_declare_resource(zhe_rid_t rid, const char *uri);
 zhe_pubidx_t zhe_publish(zhe_rid_t rid, unsigned cid, int reliable);
 zhe_subidx_t zhe_subscribe(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, void *arg);
+/* Batch subscription: HANDLER is called once for up to SUBBATCH_MAX consecutive samples for the
+   resource in a packet, in order, with XMITNEED the space it needs in the transmit window of CID
+   for the entire batch. Samples written using zhe_write_uri are passed one at a time. */
+zhe_subidx_t zhe_subscribe_batch(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subbatchhandler_t handler, void *arg);
+/* Queued subscription: samples are copied into a ring of SUBQUEUE_DEPTH samples instead of
+   calling a handler, and taken from it by zhe_subqueue_take, which may be called from one other
+   thread. When the ring is full, POLICY decides between discarding the oldest sample, the new one
+   or refusing it, in which case a reliable sample is retransmitted by its publisher just like
+   when the transmit window a subscription requires is full. False if there is no queue available
+   or queued subscriptions are not supported. */
+enum zhe_subqueue_policy {
+    ZHE_SUBQ_DROP_OLDEST,
+    ZHE_SUBQ_DROP_NEWEST,
+    ZHE_SUBQ_REFUSE
+};
+bool zhe_subscribe_queued(zhe_rid_t rid, enum zhe_subqueue_policy policy, zhe_subidx_t *subidx);
+/* Copies the oldest sample in the queue of SUBIDX into BUF (truncated to BUFSZ bytes), sets *RID
+   and *SIZE to its resource id and actual size and removes it from the queue; false if the queue
+   is empty. The subscription must not be deleted while another thread may be calling this. */
+bool zhe_subqueue_take(zhe_subidx_t subidx, zhe_rid_t *rid, void *buf, zhe_paysize_t bufsz, zhe_paysize_t *size);
+/* Filtered subscription: HANDLER is only called for samples of which the LEN bytes at OFFSET in
+   the payload compare to VALUE as specified by OP, comparing them as unsigned big-endian numbers
+   (i.e., using memcmp); shorter samples never match. With OP = EQ and OFFSET = 0 this is a match
+   on a key at the start of the payload. The filter is declared to the publishers, which don't
+   send samples that no remote subscription is interested in; if all local subscriptions to RID
+   don't have the same filter, or a publisher doesn't support filters, the samples are filtered
+   on receipt instead. False if the filter is invalid or filters are not supported. */
+enum zhe_subfilter_op { /* numerical values also appear on the wire */
+    ZHE_SUBFILTER_EQ = 0,
+    ZHE_SUBFILTER_NE = 1,
+    ZHE_SUBFILTER_LT = 2,
+    ZHE_SUBFILTER_LE = 3,
+    ZHE_SUBFILTER_GT = 4,
+    ZHE_SUBFILTER_GE = 5
+};
+#define ZHE_SUBFILTER_MAXLEN 8
+struct zhe_subfilter {
+    enum zhe_subfilter_op op;
+    zhe_paysize_t offset;
+    uint8_t len; /* 1 .. ZHE_SUBFILTER_MAXLEN */
+    uint8_t value[ZHE_SUBFILTER_MAXLEN];
+};
+bool zhe_subscribe_filtered(zhe_rid_t rid, const struct zhe_subfilter *filter, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t handler, void *arg, zhe_subidx_t *subidx);
+/* Delete a publication/subscription, the slot is reused by later calls to zhe_publish/zhe_subscribe;
+   false if too many undeclarations are still waiting to be sent (nothing changes, try again later).
+   Neither may be called from within a subscription handler */
+bool zhe_unpublish(zhe_pubidx_t pubidx);
+bool zhe_unsubscribe(zhe_subidx_t subidx);
 /* FIXME: should add zhe_declcommit(void) or something like that, rather than always auto-committing like it does now */
 enum zhe_declstatus zhe_get_declstatus(zhe_rid_t *rid);
 
+/* Latency budget for data written by a publisher (initially LATENCY_BUDGET): a packet goes out
+   at the latest when the budget of the tightest sample in it has been used up; 0 sends the data
+   immediately, ZHE_LATENCY_BUDGET_INF only sends it when the packet is full or flushed */
+#define ZHE_LATENCY_BUDGET_INF ((zhe_time_t)-1)
+void zhe_set_latency_budget(zhe_pubidx_t pubidx, zhe_time_t budget);
+
 int zhe_write(zhe_pubidx_t pubidx, const void *data, zhe_paysize_t sz, zhe_time_t tnow);
 int zhe_write_uri(const char *uri, const void *data, zhe_paysize_t sz, zhe_time_t tnow);
 
+/* Storages answer queries with the latest sample of each resource matching the query; a storage
+   is a subscription to RID (typically a resource declared with a wildcard URI), so it can be
+   removed again using zhe_unsubscribe. False if storages are not supported. */
+bool zhe_register_storage(zhe_rid_t rid, zhe_subidx_t *subidx);
+/* Queries the storages of all peers and the local ones for URI: HANDLER is called for each reply
+   (for the local storages already before zhe_query returns), and once more with RID 0 and
+   PAYLOAD NULL when all peers have answered or QUERY_TIMEOUT has passed. Returns 1 if the query
+   was sent, 0 if it should be retried later (too many outstanding queries or a full transmit
+   window) and -1 if the URI is invalid or queries are not supported. */
+typedef void (*zhe_replyhandler_t)(zhe_rid_t rid, const void *payload, zhe_paysize_t size, void *arg);
+int zhe_query(const char *uri, zhe_replyhandler_t handler, void *arg, zhe_time_t tnow);
+
 #ifdef __cplusplus
 }
 #endif
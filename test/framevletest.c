@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+/* The frame length encoding is private to the TCP platform, so test it by including it. Lengths
+   of 0x4000 and up only fit with a 3-byte length, so build it with a large MTU and link it with a
+   library built the same way, e.g.:
+     cmake -S . -B build-tcpl -DTCP=ON -DTCP_MTU=65534 && cmake --build build-tcpl
+     cc -std=gnu99 -DTCP -DTCP_MTU=65534u -Isrc -Iexample/configs/p2p -Iexample/platform test/framevletest.c build-tcpl/src/libzhe.a */
+#include "platform-tcp.c"
+
+static void roundtrip(size_t val, size_t expected_len)
+{
+    uint8_t buf[FRAMELEN_MAXBYTES];
+    size_t dec;
+    const size_t n = encvle(buf, val);
+    assert(n == expected_len);
+    assert(decvle(buf, n, &dec) == (int)n);
+    assert(dec == val);
+    /* a length split over two reads is incomplete, not an error */
+    for (size_t k = 1; k < n; k++) {
+        assert(decvle(buf, k, &dec) == 0);
+    }
+}
+
+/* A frame length that exceeds the MTU must be treated as a framing error and close the
+   connection rather than wait for a frame that can't fit in the buffer */
+static void reject(size_t val)
+{
+    struct tcp * const tcp = &gtcp;
+    struct conn * const conn = &tcp->conns[0];
+    zhe_recvbuf_t rbuf;
+    uint8_t vle[4];
+    size_t n = 0;
+    while (val > 0x7f) {
+        vle[n++] = (uint8_t)(0x80 | (val & 0x7f));
+        val >>= 7;
+    }
+    vle[n++] = (uint8_t)val;
+    memset(conn, 0, sizeof(*conn));
+    conn->state = CS_WAITDATA;
+    conn->s = -1;
+    conn->inframed = true;
+    conn->pingprogeny = PINGADDRIDX_INVALID;
+#if USE_EPOLL
+    tcp->readyhead = tcp->readytail = CONNIDX_NONE;
+#endif
+    memcpy(conn->in.buf, vle, n);
+    assert(handle_data(tcp, conn, &rbuf, (ssize_t)n) == 0);
+    assert(conn->state == CS_CLOSED);
+}
+
+int main()
+{
+    roundtrip(1, 1);
+#if TRANSPORT_MTU >= 0x80
+    roundtrip(0x7f, 1);
+    roundtrip(0x80, 2);
+#endif
+#if TRANSPORT_MTU >= 0x4000
+    roundtrip(0x3fff, 2);
+    roundtrip(0x4000, 3);
+#endif
+    roundtrip(TRANSPORT_MTU, (TRANSPORT_MTU <= 0x7f) ? 1 : (TRANSPORT_MTU <= 0x3fff) ? 2 : 3);
+    reject(TRANSPORT_MTU + 1);
+    reject(0x1fffff);
+    printf("frame length VLE ok for MTU %u\n", (unsigned)TRANSPORT_MTU);
+    return 0;
+}
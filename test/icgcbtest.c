@@ -29,6 +29,49 @@ static void move_cb (uripos_t ref, void *newp, void *varg)
 #define UNIT 4
 #define ICGCBSIZE 10
 
+/* Fragments a buffer and collects it with the smallest possible budget: every call must move at
+   most one block, the open space must not change until the last of the garbage is gone and the
+   surviving blocks must be intact */
+static void test_gc_budget(void)
+{
+    char buf[2048];
+    struct icgcb *b = (struct icgcb *)buf;
+    void *bb[N];
+    uripos_t open0, garbage0;
+    int n = 0, calls = 0;
+    zhe_icgcb_init(b, sizeof (buf));
+    while (n < N && zhe_icgcb_alloc(&bb[n], b, 20, (uripos_t)n) == IAR_OK) {
+        memset(bb[n], n, 20);
+        n++;
+    }
+    assert(n > 4);
+    for (int i = 0; i < n; i += 2) {
+        zhe_icgcb_free(b, bb[i]);
+        bb[i] = NULL;
+    }
+    open0 = zhe_icgcb_openspace(b);
+    garbage0 = zhe_icgcb_garbage(b);
+    assert(garbage0 > 0);
+    while (zhe_icgcb_garbage(b) > 0) {
+        const uripos_t moved = zhe_icgcb_gc_budget(b, 2, 1, move_cb, bb);
+        assert(moved <= UNIT + alignup(20));
+        if (zhe_icgcb_garbage(b) > 0) {
+            assert(zhe_icgcb_garbage(b) == garbage0);
+            assert(zhe_icgcb_openspace(b) == open0);
+        }
+        calls++;
+        assert(calls < 4 * n);
+    }
+    assert(calls > n / 2);
+    assert(zhe_icgcb_openspace(b) == open0 + garbage0);
+    for (int i = 1; i < n; i += 2) {
+        for (int j = 0; j < 20; j++) {
+            assert(((unsigned char *)bb[i])[j] == i);
+        }
+    }
+    printf("gc budget: %d calls\n", calls);
+}
+
 int main ()
 {
     char buf[10240];
@@ -44,6 +87,7 @@ int main ()
     unsigned long ops = 0, agains = 0, nospaces = 0;
     clock_t tnow, tnextprint, tstart;
     srandomdev ();
+    test_gc_budget();
     for (int i = 0; i < N; i++)
     {
         bb[i] = NULL;
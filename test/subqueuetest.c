@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+/* The ring is tested on its own: the subscription it hangs off is faked by zhe_subscribe below,
+   which captures the handler that zhe_subscribe_queued installs. Build with a configuration
+   that has queued subscriptions and a trace ring, e.g.:
+     cc -std=gnu99 -Isrc -Iexample/configs/p2p-large -Iexample/platform test/subqueuetest.c src/zhe-tracering.c -lpthread */
+#include "zhe-subqueue.c"
+
+#if !HAVE_SUBQUEUES
+#error "subqueuetest requires a configuration with ZHE_MAX_SUBQUEUES > 0"
+#endif
+
+#define NSAMPLES 2000000u
+#define SAMPLESIZE 64
+
+#if ENABLE_TRACING
+unsigned zhe_trace_cats;
+#endif
+
+static zhe_subhandler_t handler;
+static void *handlerarg;
+
+zhe_subidx_t zhe_subscribe(zhe_rid_t rid, zhe_paysize_t xmitneed, unsigned cid, zhe_subhandler_t h, void *arg)
+{
+    static zhe_subidx_inner_t next;
+    zhe_subidx_t idx = { next++ };
+    (void)rid; (void)xmitneed; (void)cid;
+    handler = h;
+    handlerarg = arg;
+    return idx;
+}
+
+static void put(uint32_t v, zhe_paysize_t size)
+{
+    uint8_t buf[SUBQUEUE_PAYLOAD + 1];
+    assert(size <= sizeof(buf));
+    memset(buf, (int)(v % 256), size);
+    if (size >= sizeof(v)) {
+        memcpy(buf, &v, sizeof(v));
+    }
+    handler(1, buf, size, handlerarg);
+}
+
+static int take(zhe_subidx_t s, uint32_t *v)
+{
+    uint8_t buf[SUBQUEUE_PAYLOAD];
+    zhe_rid_t rid;
+    zhe_paysize_t size;
+    if (!zhe_subqueue_take(s, &rid, buf, sizeof(buf), &size)) {
+        return 0;
+    }
+    assert(rid == 1);
+    assert(size >= sizeof(*v));
+    memcpy(v, buf, sizeof(*v));
+    for (zhe_paysize_t i = sizeof(*v); i < size; i++) {
+        assert(buf[i] == *v % 256);
+    }
+    return 1;
+}
+
+static void test_policy(enum zhe_subqueue_policy policy)
+{
+    zhe_subidx_t s;
+    uint32_t v, first;
+    zhe_subqueue_init();
+    assert(zhe_subscribe_queued(1, policy, &s));
+    for (uint32_t i = 0; i < SUBQUEUE_DEPTH + 3; i++) {
+        assert(policy != ZHE_SUBQ_REFUSE || zhe_subqueue_accepts(handlerarg, 1) == (i < SUBQUEUE_DEPTH));
+        put(i, 16);
+    }
+    /* oversized samples are always dropped */
+    put(SUBQUEUE_DEPTH + 3, SUBQUEUE_PAYLOAD + 1);
+    first = (policy == ZHE_SUBQ_DROP_OLDEST) ? 3 : 0;
+    for (uint32_t i = 0; i < SUBQUEUE_DEPTH; i++) {
+        assert(take(s, &v));
+        assert(v == first + i);
+    }
+    assert(!take(s, &v));
+#if ENABLE_STATS
+    struct zhe_subqueue_stats st;
+    assert(zhe_get_subqueue_stats(s, &st));
+    assert(st.dropped == 4 && st.depth == 0 && st.depth_max == SUBQUEUE_DEPTH);
+#endif
+    /* the indices run on after wrapping around */
+    put(1000, 16);
+    put(1001, 16);
+    assert(take(s, &v) && v == 1000);
+    put(1002, 16);
+    assert(take(s, &v) && v == 1001);
+    assert(take(s, &v) && v == 1002);
+    assert(!take(s, &v));
+    zhe_subqueue_release(handlerarg);
+}
+
+static void *producer(void *varg)
+{
+    (void)varg;
+    for (uint32_t i = 1; i <= NSAMPLES; i++) {
+        put(i, SAMPLESIZE);
+    }
+    return NULL;
+}
+
+/* With a concurrent producer overwriting the oldest samples, the consumer must never see a torn
+   sample nor one out of order, and must see the final one */
+static void test_concurrent(void)
+{
+    zhe_subidx_t s;
+    pthread_t tid;
+    uint32_t v, last = 0;
+    unsigned long got = 0;
+    zhe_subqueue_init();
+    assert(zhe_subscribe_queued(1, ZHE_SUBQ_DROP_OLDEST, &s));
+    pthread_create(&tid, NULL, producer, NULL);
+    while (last != NSAMPLES) {
+        if (take(s, &v)) {
+            assert(v > last);
+            last = v;
+            got++;
+        }
+    }
+    pthread_join(tid, NULL);
+    assert(!take(s, &v));
+    printf("concurrent: took %lu of %u\n", got, NSAMPLES);
+}
+
+int main()
+{
+    test_policy(ZHE_SUBQ_DROP_OLDEST);
+    test_policy(ZHE_SUBQ_DROP_NEWEST);
+    test_policy(ZHE_SUBQ_REFUSE);
+    test_concurrent();
+    return 0;
+}